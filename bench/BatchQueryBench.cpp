@@ -0,0 +1,117 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "rtree/AABB.hpp"
+#include "rtree/BatchQuery.hpp"
+#include "rtree/RTree.hpp"
+
+using namespace rtree;
+
+using point_type = point_t<double, 2>;
+using bound_type = aabb_t<point_type>;
+using tree_type = RTree<bound_type, bound_type, int>;
+
+/*
+ * throughput of execute_batch against running the same queries one after
+ * another with execute_query
+ * usage: BatchQueryBench [entries] [queries] [capacity]
+ */
+
+struct batch_t {
+  std::vector<batch_query_t<tree_type>> queries;
+  std::vector<tree_type::value_type const*> out;
+};
+
+static batch_t make_batch(query_kind kind, int count, size_type capacity,
+                          double width, std::mt19937& gen) {
+  std::uniform_real_distribution<double> coord(0, 10000);
+  batch_t batch;
+  batch.out.resize(static_cast<std::size_t>(count) * capacity);
+  for (int i = 0; i < count; ++i) {
+    point_type a;
+    a[0] = coord(gen);
+    a[1] = coord(gen);
+    point_type b = a;
+    // one query in 64 is much larger, as in a skewed workload
+    const double w = i % 64 == 0 ? width * 8 : width;
+    b[0] += w;
+    b[1] += w;
+    auto* first = batch.out.data() + static_cast<std::size_t>(i) * capacity;
+    batch.queries.emplace_back(
+        kind, kind == query_kind::nearest ? bound_type(a) : bound_type(a, b),
+        first, first + capacity);
+  }
+  return batch;
+}
+
+template <typename Functor>
+static double seconds(Functor functor) {
+  const auto start = std::chrono::steady_clock::now();
+  functor();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                       - start)
+      .count();
+}
+
+int main(int argc, char** argv) {
+  const int entries = argc > 1 ? std::atoi(argv[1]) : 1000000;
+  const int count = argc > 2 ? std::atoi(argv[2]) : 100000;
+  const size_type capacity
+      = argc > 3 ? static_cast<size_type>(std::atoi(argv[3])) : 256;
+
+  std::mt19937 gen(1);
+  std::uniform_real_distribution<double> coord(0, 10000);
+  tree_type tree;
+  const double build = seconds([&] {
+    for (int i = 0; i < entries; ++i) {
+      point_type a;
+      a[0] = coord(gen);
+      a[1] = coord(gen);
+      point_type b = a;
+      b[0] += 2;
+      b[1] += 2;
+      tree.insert({ bound_type(a, b), i });
+    }
+  });
+  std::printf("%d entries built in %.2f s, %d queries per batch\n", entries,
+              build, count);
+
+  std::vector<unsigned> thread_counts { 1, 2, 4 };
+  const unsigned hardware = std::thread::hardware_concurrency();
+  if (hardware > 4) {
+    thread_counts.push_back(hardware);
+  }
+
+  struct kind_t {
+    char const* name;
+    query_kind kind;
+  } const kinds[] = { { "overlap", query_kind::overlap },
+                      { "inside", query_kind::inside },
+                      { "nearest", query_kind::nearest } };
+
+  std::printf("%-8s %8s %14s %9s\n", "query", "threads", "queries/s",
+              "speedup");
+  for (kind_t const& k : kinds) {
+    batch_t batch = make_batch(k.kind, count, capacity, 40, gen);
+    const double sequential = seconds([&] {
+      for (auto& q : batch.queries) {
+        execute_query(tree, q);
+      }
+    });
+    std::printf("%-8s %8s %14.0f %9s\n", k.name, "seq", count / sequential,
+                "1.00");
+    for (unsigned threads : thread_counts) {
+      thread_pool_t pool(threads);
+      const double parallel
+          = seconds([&] { execute_batch(tree, batch.queries, pool); });
+      std::printf("%-8s %8u %14.0f %9.2f\n", k.name, threads, count / parallel,
+                  sequential / parallel);
+    }
+  }
+  return 0;
+}
@@ -84,6 +84,26 @@ namespace rtree {
       ArithmeticType dist = b1.min_ + b1.max_ - b2.min_ - b2.max_;
       return std::abs(dist);
     }
+    // ==================== for nearest neighbour search ====================
+    // smallest distance between two bounding boxes; 0 if they overlap
+    static ArithmeticType min_distance(AABB const& b1, AABB const& b2) {
+      if (b1.max_ < b2.min_) {
+        return b2.min_ - b1.max_;
+      }
+      if (b2.max_ < b1.min_) {
+        return b1.min_ - b2.max_;
+      }
+      return 0;
+    }
+    static ArithmeticType min_distance(AABB const& b, ArithmeticType p) {
+      return min_distance(b, AABB(p));
+    }
+    static ArithmeticType min_distance(ArithmeticType p, AABB const& b) {
+      return min_distance(b, AABB(p));
+    }
+    static ArithmeticType min_distance(ArithmeticType p, ArithmeticType p2) {
+      return std::abs(p - p2);
+    }
   };
 
   // traits for multi-dimension point
@@ -118,10 +138,21 @@ namespace rtree {
       }
       return true;
     }
+    // check if a point key is overlapping with the bounding box
+    static bool is_overlap(Point const& p, AABB const& aabb) {
+      return is_inside(aabb, p);
+    }
     // merge a point with the bounding box
     static AABB merge(AABB const& aabb, Point const& p) {
       return { min(aabb.min_, p), max(aabb.max_, p) };
     }
+    static AABB merge(Point const& p, AABB const& aabb) {
+      return merge(aabb, p);
+    }
+    // smallest bounding box containing both points
+    static AABB merge(Point const& p, Point const& p2) {
+      return { min(p, p2), max(p, p2) };
+    }
     // merge two bounding boxes
     static AABB merge(AABB const& aabb, AABB const& aabb2) {
       return { min(aabb.min_, aabb2.min_), max(aabb.max_, aabb2.max_) };
@@ -134,6 +165,10 @@ namespace rtree {
       }
       return ret;
     }
+    // a point has no extent
+    static area_type area(Point const&) {
+      return 0;
+    }
     /**
     * Return the intersection of two bounding boxes
     * @param aabb: a bounding box aabb_t<Point> object
@@ -145,6 +180,17 @@ namespace rtree {
       const auto ret_min = max(aabb.min_, aabb2.min_);
       return { ret_min, max(ret_min, min(aabb.max_, aabb2.max_)) };
     }
+    // intersections involving a point key are always zero-sized
+    static AABB intersection(AABB const& aabb, Point const& p) {
+      const auto ret_min = max(aabb.min_, p);
+      return { ret_min, max(ret_min, min(aabb.max_, p)) };
+    }
+    static AABB intersection(Point const& p, AABB const& aabb) {
+      return intersection(aabb, p);
+    }
+    static AABB intersection(Point const& p, Point const& p2) {
+      return { max(p, p2) };
+    }
 
     static bool less_than(Point const& lhs, Point const& rhs) {
       for (unsigned int i = 0; i < Dim; ++i) {
@@ -200,6 +246,12 @@ namespace rtree {
     static auto max_point(AABB const& bound, int axis){
       return bound.max_[axis];
     }
+    static auto min_point(Point const& p, int axis){
+      return p[axis];
+    }
+    static auto max_point(Point const& p, int axis){
+      return p[axis];
+    }
     // sum of all length of bound for all dimension
     static area_type margin(AABB const& bound) {
       area_type sum = 0;
@@ -208,6 +260,9 @@ namespace rtree {
       }
       return sum;
     }
+    static area_type margin(Point const&) {
+      return 0;
+    }
 
     static T distance_center(AABB const& b1, AABB const& b2) {
       T ret = 0;
@@ -218,5 +273,45 @@ namespace rtree {
       }
       return ret;
     }
+    static T distance_center(AABB const& b, Point const& p) {
+      T ret = 0;
+      for (unsigned int i = 0; i < Dim; ++i) {
+        T dist = b.min_[i] + b.max_[i] - p[i] - p[i];
+        dist /= 2;
+        ret += dist * dist;
+      }
+      return ret;
+    }
+    // ==================== for nearest neighbour search ====================
+    // squared smallest distance between two bounds; 0 if they overlap
+    // only used to order entries, so no sqrt()
+    static T min_distance(AABB const& b1, AABB const& b2) {
+      T ret = 0;
+      for (unsigned int i = 0; i < Dim; ++i) {
+        T dist = 0;
+        if (b1.max_[i] < b2.min_[i]) {
+          dist = b2.min_[i] - b1.max_[i];
+        }
+        else if (b2.max_[i] < b1.min_[i]) {
+          dist = b1.min_[i] - b2.max_[i];
+        }
+        ret += dist * dist;
+      }
+      return ret;
+    }
+    static T min_distance(AABB const& b, Point const& p) {
+      return min_distance(b, AABB(p));
+    }
+    static T min_distance(Point const& p, AABB const& b) {
+      return min_distance(b, AABB(p));
+    }
+    static T min_distance(Point const& p, Point const& p2) {
+      T ret = 0;
+      for (unsigned int i = 0; i < Dim; ++i) {
+        const T dist = p[i] - p2[i];
+        ret += dist * dist;
+      }
+      return ret;
+    }
   };
 }
\ No newline at end of file
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <vector>
+
+#include "Global.hpp"
+#include "ThreadPool.hpp"
+
+namespace rtree
+{
+
+enum class query_kind
+{
+  overlap,
+  inside,
+  nearest
+};
+
+/*
+ * batch_query_t is one query of a batch run by execute_batch.
+ * Results are pointers to the entries of the searched tree, written to the
+ * caller-provided range [first, last); they stay valid until the tree is
+ * modified.
+ * overlap / inside stop once the range is full and set `truncated` if
+ * there were more matches. nearest returns the `last - first` entries
+ * closest to `range`, nearest first.
+ */
+template <typename TreeType>
+struct batch_query_t
+{
+  using geometry_type = typename TreeType::geometry_type;
+  using value_type = typename TreeType::value_type;
+  using size_type = typename TreeType::size_type;
+
+  query_kind kind;
+  geometry_type range;
+  value_type const** first;
+  value_type const** last;
+
+  // filled in by execute_batch
+  size_type count = 0;
+  bool truncated = false;
+
+  batch_query_t(query_kind kind_,
+                geometry_type const& range_,
+                value_type const** first_,
+                value_type const** last_)
+      : kind(kind_)
+      , range(range_)
+      , first(first_)
+      , last(last_)
+  {
+  }
+};
+
+// run a single query of a batch on the calling thread
+template <typename TreeType>
+void execute_query(TreeType const& tree, batch_query_t<TreeType>& query)
+{
+  using value_type = typename TreeType::value_type;
+  using size_type = typename TreeType::size_type;
+
+  const size_type capacity = static_cast<size_type>(query.last - query.first);
+  query.count = 0;
+  query.truncated = false;
+  auto collect = [&query, capacity](value_type const& v) {
+    if (query.count == capacity)
+    {
+      query.truncated = true;
+      return true;
+    }
+    query.first[query.count++] = &v;
+    return false;
+  };
+  switch (query.kind)
+  {
+  case query_kind::overlap:
+    tree.search_overlap(query.range, collect);
+    break;
+  case query_kind::inside:
+    tree.search_inside(query.range, collect);
+    break;
+  case query_kind::nearest:
+    tree.search_nearest(query.range, capacity, collect);
+    break;
+  }
+}
+
+/*
+ * run every query of [first, last) against `tree` on the workers of `pool`.
+ * The batch is split in halves recursively down to `grain` queries per
+ * task: a worker keeps the newest (smallest) halves it pushed for itself
+ * while idle workers steal the oldest (largest) ones, so a few expensive
+ * queries do not leave the other workers idle.
+ * The tree must not be modified until the call returns.
+ */
+template <typename TreeType>
+void execute_batch(TreeType const& tree,
+                   batch_query_t<TreeType>* first,
+                   batch_query_t<TreeType>* last,
+                   thread_pool_t& pool,
+                   size_type grain = 16)
+{
+  if (grain == 0)
+  {
+    grain = 1;
+  }
+  task_group_t tasks(pool);
+  // a std::function can't refer to itself, so recurse through a plain
+  // function object
+  struct splitter_t
+  {
+    TreeType const& tree;
+    task_group_t& tasks;
+    size_type grain;
+
+    void operator()(batch_query_t<TreeType>* b, batch_query_t<TreeType>* e) const
+    {
+      while (static_cast<size_type>(e - b) > grain)
+      {
+        batch_query_t<TreeType>* mid = b + (e - b) / 2;
+        splitter_t self = *this;
+        tasks.run([self, mid, e] { self(mid, e); });
+        e = mid;
+      }
+      for (; b != e; ++b)
+      {
+        execute_query(tree, *b);
+      }
+    }
+  };
+  splitter_t { tree, tasks, grain }(first, last);
+  tasks.wait();
+}
+
+template <typename TreeType>
+void execute_batch(TreeType const& tree,
+                   std::vector<batch_query_t<TreeType>>& queries,
+                   thread_pool_t& pool,
+                   size_type grain = 16)
+{
+  execute_batch(tree, queries.data(), queries.data() + queries.size(), pool,
+                grain);
+}
+
+}
@@ -0,0 +1,402 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Global.hpp"
+
+namespace rtree {
+
+using page_id_type = std::uint32_t;
+constexpr page_id_type INVALID_PAGE = ~page_id_type(0);
+
+/*
+ * page_file_t is a file of fixed-size pages accessed with pread / pwrite.
+ * Pages past the end of the file read as zeros.
+ */
+class page_file_t {
+protected:
+  int _fd = -1;
+  std::uint32_t _page_size = 0;
+
+public:
+  page_file_t() = default;
+  page_file_t(page_file_t const&) = delete;
+  page_file_t& operator=(page_file_t const&) = delete;
+  ~page_file_t() {
+    close();
+  }
+
+  // open `path`, creating it if needed
+  bool open(std::string const& path, std::uint32_t page_size) {
+    close();
+    _fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    _page_size = page_size;
+    return _fd >= 0;
+  }
+  void close() {
+    if (_fd >= 0) {
+      ::close(_fd);
+      _fd = -1;
+    }
+  }
+  bool is_open() const {
+    return _fd >= 0;
+  }
+  int fd() const {
+    return _fd;
+  }
+  std::uint32_t page_size() const {
+    return _page_size;
+  }
+  off_t offset(page_id_type page) const {
+    return static_cast<off_t>(page) * _page_size;
+  }
+  // number of pages the file currently holds
+  page_id_type page_count() const {
+    struct stat st;
+    if (fstat(_fd, &st) != 0) {
+      return 0;
+    }
+    return static_cast<page_id_type>(st.st_size / _page_size);
+  }
+
+  bool read(page_id_type page, void* data) const {
+    std::size_t done = 0;
+    while (done < _page_size) {
+      const ssize_t n = pread(_fd, static_cast<char*>(data) + done,
+                              _page_size - done, offset(page) + done);
+      if (n < 0) {
+        return false;
+      }
+      if (n == 0) {
+        std::memset(static_cast<char*>(data) + done, 0, _page_size - done);
+        break;
+      }
+      done += static_cast<std::size_t>(n);
+    }
+    return true;
+  }
+  bool write(page_id_type page, void const* data) {
+    std::size_t done = 0;
+    while (done < _page_size) {
+      const ssize_t n = pwrite(_fd, static_cast<char const*>(data) + done,
+                               _page_size - done, offset(page) + done);
+      if (n <= 0) {
+        return false;
+      }
+      done += static_cast<std::size_t>(n);
+    }
+    return true;
+  }
+  // make every written page durable
+  bool sync() {
+#if defined(__linux__)
+    return fdatasync(_fd) == 0;
+#else
+    return fsync(_fd) == 0;
+#endif
+  }
+};
+
+// one page read of a batch
+struct page_read_t {
+  page_id_type page;
+  void* data;
+  bool ok;
+};
+
+// reads a batch of pages one pread at a time
+struct pread_page_reader_t {
+  bool read(page_file_t const& file, page_read_t* first, page_read_t* last) {
+    bool ok = true;
+    for (; first != last; ++first) {
+      first->ok = file.read(first->page, first->data);
+      ok = ok && first->ok;
+    }
+    return ok;
+  }
+};
+
+/*
+ * buffer_pool_t caches the pages of a page_file_t in a fixed number of
+ * frames. fetch() pins a page in a frame (reading it on a miss) and
+ * returns a page_ref_t that unpins it when destroyed; pages are modified
+ * in place and marked dirty. Frames are recycled with the CLOCK policy,
+ * skipping pinned frames and writing dirty victims back first.
+ * Frame memory is page aligned. Not thread-safe.
+ */
+class buffer_pool_t {
+public:
+  struct stats_type {
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    std::uint64_t evictions = 0;
+    std::uint64_t writes = 0;
+    std::uint64_t prefetches = 0;
+  };
+
+protected:
+  struct frame_t {
+    page_id_type page = INVALID_PAGE;
+    std::uint32_t pins = 0;
+    bool dirty = false;
+    bool referenced = false;
+  };
+  constexpr static std::size_t FRAME_ALIGN = 4096;
+  constexpr static size_type NO_FRAME = ~size_type(0);
+
+  page_file_t& _file;
+  std::vector<frame_t> _frames;
+  unsigned char* _memory = nullptr;
+  std::unordered_map<page_id_type, size_type> _table;
+  size_type _hand = 0;
+  stats_type _stats;
+
+public:
+  // pinned page; unpins on destruction
+  class page_ref_t {
+    friend class buffer_pool_t;
+    buffer_pool_t* _pool = nullptr;
+    size_type _frame = 0;
+
+    page_ref_t(buffer_pool_t* pool, size_type frame)
+        : _pool(pool)
+        , _frame(frame)
+    {
+    }
+
+  public:
+    page_ref_t() = default;
+    page_ref_t(page_ref_t&& rhs)
+        : _pool(rhs._pool)
+        , _frame(rhs._frame)
+    {
+      rhs._pool = nullptr;
+    }
+    page_ref_t& operator=(page_ref_t&& rhs) {
+      if (this != &rhs) {
+        release();
+        _pool = rhs._pool;
+        _frame = rhs._frame;
+        rhs._pool = nullptr;
+      }
+      return *this;
+    }
+    page_ref_t(page_ref_t const&) = delete;
+    page_ref_t& operator=(page_ref_t const&) = delete;
+    ~page_ref_t() {
+      release();
+    }
+
+    explicit operator bool() const {
+      return _pool != nullptr;
+    }
+    void release() {
+      if (_pool) {
+        --_pool->_frames[_frame].pins;
+        _pool = nullptr;
+      }
+    }
+    page_id_type page() const {
+      return _pool->_frames[_frame].page;
+    }
+    unsigned char* data() const {
+      return _pool->frame_data(_frame);
+    }
+    template <typename T>
+    T* as() const {
+      return reinterpret_cast<T*>(data());
+    }
+    void mark_dirty() const {
+      _pool->_frames[_frame].dirty = true;
+    }
+  };
+
+  buffer_pool_t(page_file_t& file, size_type frames)
+      : _file(file)
+      , _frames(frames > 0 ? frames : 1)
+  {
+    _memory = static_cast<unsigned char*>(::operator new(
+        std::size_t(_frames.size()) * _file.page_size(),
+        std::align_val_t(FRAME_ALIGN)));
+  }
+  buffer_pool_t(buffer_pool_t const&) = delete;
+  buffer_pool_t& operator=(buffer_pool_t const&) = delete;
+  ~buffer_pool_t() {
+    ::operator delete(_memory, std::align_val_t(FRAME_ALIGN));
+  }
+
+  // pin `page`, reading it from the file unless it is cached
+  // empty on I/O error or if every frame is pinned
+  page_ref_t fetch(page_id_type page) {
+    auto found = _table.find(page);
+    if (found != _table.end()) {
+      ++_stats.hits;
+      return pin(found->second);
+    }
+    ++_stats.misses;
+    const size_type frame = victim();
+    if (frame == NO_FRAME) {
+      return {};
+    }
+    if (_file.read(page, frame_data(frame)) == false) {
+      return {};
+    }
+    assign(frame, page);
+    return pin(frame);
+  }
+  // pin `page` with zeroed contents, without reading it; the page is dirty
+  page_ref_t create(page_id_type page) {
+    auto found = _table.find(page);
+    size_type frame = found != _table.end() ? found->second : victim();
+    if (frame == NO_FRAME) {
+      return {};
+    }
+    std::memset(frame_data(frame), 0, _file.page_size());
+    if (found == _table.end()) {
+      assign(frame, page);
+    }
+    _frames[frame].dirty = true;
+    return pin(frame);
+  }
+  /*
+   * read the pages of [first, last) that are not cached as one batch
+   * through `reader` (see pread_page_reader_t), so their reads overlap;
+   * the pages are left unpinned. Stops early once every frame is pinned
+   * or taken by the batch. returns the number of pages read.
+   */
+  template <typename Reader>
+  size_type prefetch(page_id_type const* first, page_id_type const* last,
+                     Reader& reader) {
+    std::vector<page_read_t> reads;
+    std::vector<size_type> frames;
+    for (; first != last; ++first) {
+      if (_table.count(*first) != 0) {
+        continue;
+      }
+      const size_type frame = victim();
+      if (frame == NO_FRAME) {
+        break;
+      }
+      // entered in the table now so duplicates are skipped, pinned so the
+      // rest of the batch does not take the frame back
+      assign(frame, *first);
+      ++_frames[frame].pins;
+      reads.push_back({ *first, frame_data(frame), false });
+      frames.push_back(frame);
+    }
+    reader.read(_file, reads.data(), reads.data() + reads.size());
+    size_type loaded = 0;
+    for (std::size_t i = 0; i < reads.size(); ++i) {
+      frame_t& f = _frames[frames[i]];
+      --f.pins;
+      if (reads[i].ok) {
+        f.referenced = true;
+        ++loaded;
+      }
+      else {
+        _table.erase(f.page);
+        f = frame_t();
+      }
+    }
+    _stats.prefetches += loaded;
+    return loaded;
+  }
+  bool contains(page_id_type page) const {
+    return _table.count(page) != 0;
+  }
+
+  // write every dirty page back
+  bool flush() {
+    for (size_type i = 0; i < _frames.size(); ++i) {
+      if (write_back(i) == false) {
+        return false;
+      }
+    }
+    return true;
+  }
+  // forget every unpinned page without writing it back
+  void discard_all() {
+    for (size_type i = 0; i < _frames.size(); ++i) {
+      if (_frames[i].pins == 0 && _frames[i].page != INVALID_PAGE) {
+        _table.erase(_frames[i].page);
+        _frames[i] = frame_t();
+      }
+    }
+  }
+
+  size_type frame_count() const {
+    return static_cast<size_type>(_frames.size());
+  }
+  stats_type const& stats() const {
+    return _stats;
+  }
+  page_file_t& file() const {
+    return _file;
+  }
+
+protected:
+  unsigned char* frame_data(size_type frame) const {
+    return _memory + std::size_t(frame) * _file.page_size();
+  }
+  page_ref_t pin(size_type frame) {
+    ++_frames[frame].pins;
+    _frames[frame].referenced = true;
+    return page_ref_t(this, frame);
+  }
+  void assign(size_type frame, page_id_type page) {
+    _frames[frame].page = page;
+    _frames[frame].dirty = false;
+    _table[page] = frame;
+  }
+  bool write_back(size_type frame) {
+    frame_t& f = _frames[frame];
+    if (f.page == INVALID_PAGE || f.dirty == false) {
+      return true;
+    }
+    if (_file.write(f.page, frame_data(frame)) == false) {
+      return false;
+    }
+    ++_stats.writes;
+    f.dirty = false;
+    return true;
+  }
+  // CLOCK: sweep the frames, giving referenced ones a second chance
+  size_type victim() {
+    const size_type n = static_cast<size_type>(_frames.size());
+    for (size_type step = 0; step < 2 * n; ++step) {
+      const size_type frame = _hand;
+      _hand = (_hand + 1) % n;
+      frame_t& f = _frames[frame];
+      if (f.pins > 0) {
+        continue;
+      }
+      if (f.referenced) {
+        f.referenced = false;
+        continue;
+      }
+      if (write_back(frame) == false) {
+        return NO_FRAME;
+      }
+      if (f.page != INVALID_PAGE) {
+        _table.erase(f.page);
+        ++_stats.evictions;
+      }
+      f = frame_t();
+      return frame;
+    }
+    return NO_FRAME;
+  }
+};
+
+}
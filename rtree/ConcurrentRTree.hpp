@@ -0,0 +1,211 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <utility>
+
+#include "Global.hpp"
+
+namespace rtree
+{
+
+/*
+ * distributed_shared_mutex is a reader-writer lock for read-mostly data.
+ * Every reader thread is bound to one of SLOTS counters, each on its own
+ * cache line, so concurrent readers never write to a shared cache line.
+ * A writer raises a flag and waits for all counters to drain; readers that
+ * see the flag back off until the writer is done, so writers are not
+ * starved by a steady stream of readers.
+ * Satisfies the SharedMutex requirements used by std::shared_lock and
+ * std::unique_lock. Not recursive.
+ */
+class distributed_shared_mutex
+{
+public:
+  constexpr static size_type SLOTS = 64;
+  constexpr static size_type CACHE_LINE = 64;
+
+protected:
+  struct alignas(CACHE_LINE) slot_t
+  {
+    std::atomic<int> readers { 0 };
+  };
+
+  slot_t _slots[SLOTS];
+  alignas(CACHE_LINE) std::atomic<bool> _writer { false };
+  std::mutex _write_mutex;
+
+  // threads are assigned slots round-robin on first use
+  static size_type thread_slot()
+  {
+    static std::atomic<size_type> next { 0 };
+    thread_local const size_type slot
+        = next.fetch_add(1, std::memory_order_relaxed) % SLOTS;
+    return slot;
+  }
+
+public:
+  distributed_shared_mutex() = default;
+  distributed_shared_mutex(distributed_shared_mutex const&) = delete;
+  distributed_shared_mutex& operator=(distributed_shared_mutex const&) = delete;
+
+  void lock_shared()
+  {
+    std::atomic<int>& readers = _slots[thread_slot()].readers;
+    for (;;)
+    {
+      readers.fetch_add(1, std::memory_order_seq_cst);
+      if (_writer.load(std::memory_order_seq_cst) == false)
+      {
+        return;
+      }
+      readers.fetch_sub(1, std::memory_order_release);
+      while (_writer.load(std::memory_order_relaxed))
+      {
+        std::this_thread::yield();
+      }
+    }
+  }
+  bool try_lock_shared()
+  {
+    std::atomic<int>& readers = _slots[thread_slot()].readers;
+    readers.fetch_add(1, std::memory_order_seq_cst);
+    if (_writer.load(std::memory_order_seq_cst) == false)
+    {
+      return true;
+    }
+    readers.fetch_sub(1, std::memory_order_release);
+    return false;
+  }
+  void unlock_shared()
+  {
+    _slots[thread_slot()].readers.fetch_sub(1, std::memory_order_release);
+  }
+
+  void lock()
+  {
+    _write_mutex.lock();
+    _writer.store(true, std::memory_order_seq_cst);
+    for (slot_t& s : _slots)
+    {
+      while (s.readers.load(std::memory_order_seq_cst) != 0)
+      {
+        std::this_thread::yield();
+      }
+    }
+  }
+  bool try_lock()
+  {
+    if (_write_mutex.try_lock() == false)
+    {
+      return false;
+    }
+    _writer.store(true, std::memory_order_seq_cst);
+    for (slot_t& s : _slots)
+    {
+      if (s.readers.load(std::memory_order_seq_cst) != 0)
+      {
+        unlock();
+        return false;
+      }
+    }
+    return true;
+  }
+  void unlock()
+  {
+    _writer.store(false, std::memory_order_release);
+    _write_mutex.unlock();
+  }
+};
+
+/*
+ * concurrent_rtree wraps a TreeType (an RTree instantiation) for one or more
+ * writer threads and any number of query threads.
+ * Queries run in parallel under a distributed_shared_mutex; insert and
+ * erase are serialised and wait for running queries to finish.
+ * Functors passed to the queries run while the lock is held and must not
+ * call back into this object.
+ */
+template <typename TreeType, typename MutexType = distributed_shared_mutex>
+class concurrent_rtree
+{
+public:
+  using tree_type = TreeType;
+  using mutex_type = MutexType;
+  using size_type = typename TreeType::size_type;
+  using geometry_type = typename TreeType::geometry_type;
+  using key_type = typename TreeType::key_type;
+  using mapped_type = typename TreeType::mapped_type;
+  using value_type = typename TreeType::value_type;
+
+protected:
+  TreeType _tree;
+  mutable MutexType _mutex;
+
+public:
+  concurrent_rtree() = default;
+  explicit concurrent_rtree(TreeType tree)
+      : _tree(std::move(tree))
+  {
+  }
+  concurrent_rtree(concurrent_rtree const&) = delete;
+  concurrent_rtree& operator=(concurrent_rtree const&) = delete;
+
+  void insert(value_type new_val)
+  {
+    std::unique_lock<MutexType> lock(_mutex);
+    _tree.insert(std::move(new_val));
+  }
+  template <typename... Args>
+  void emplace(Args&&... args)
+  {
+    insert(value_type(std::forward<Args>(args)...));
+  }
+  void deleteEntrie(value_type const& entrie)
+  {
+    std::unique_lock<MutexType> lock(_mutex);
+    _tree.deleteEntrie(entrie);
+  }
+  void clear()
+  {
+    std::unique_lock<MutexType> lock(_mutex);
+    _tree.clear();
+  }
+
+  template <typename _GeometryType, typename Functor>
+  void search_inside(_GeometryType const& search_range, Functor functor) const
+  {
+    std::shared_lock<MutexType> lock(_mutex);
+    _tree.search_inside(search_range, functor);
+  }
+  template <typename _GeometryType, typename Functor>
+  void search_overlap(_GeometryType const& search_range, Functor functor) const
+  {
+    std::shared_lock<MutexType> lock(_mutex);
+    _tree.search_overlap(search_range, functor);
+  }
+  size_type size() const
+  {
+    std::shared_lock<MutexType> lock(_mutex);
+    return _tree.size();
+  }
+
+  // run `functor(tree_type const&)` under the shared lock
+  template <typename Functor>
+  decltype(auto) read(Functor functor) const
+  {
+    std::shared_lock<MutexType> lock(_mutex);
+    return functor(static_cast<TreeType const&>(_tree));
+  }
+  // run `functor(tree_type&)` under the exclusive lock
+  template <typename Functor>
+  decltype(auto) write(Functor functor)
+  {
+    std::unique_lock<MutexType> lock(_mutex);
+    return functor(_tree);
+  }
+};
+
+}
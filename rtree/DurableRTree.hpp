@@ -0,0 +1,322 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "ConcurrentRTree.hpp"
+#include "Global.hpp"
+#include "Serialization.hpp"
+#include "WriteAheadLog.hpp"
+
+namespace rtree
+{
+
+// operations recorded in the log of a durable_rtree
+enum class wal_op : std::uint32_t
+{
+  insert = 1,
+  erase = 2,
+  clear = 3
+};
+
+// written in front of RTree::save's output in a durable_rtree snapshot
+struct durable_snapshot_header_t
+{
+  constexpr static std::uint32_t MAGIC = 0x53525452; // "RTRS"
+  constexpr static std::uint32_t VERSION = 1;
+
+  std::uint32_t magic = MAGIC;
+  std::uint32_t version = VERSION;
+  // last log record the snapshot includes
+  lsn_type lsn = 0;
+};
+
+/*
+ * durable_rtree keeps a TreeType (an RTree instantiation) recoverable
+ * after a crash.
+ * State lives in two files next to `path`: a snapshot (`path`.snapshot,
+ * RTree::save's format behind a durable_snapshot_header_t) and a
+ * write-ahead log (`path`.wal). insert / deleteEntrie / clear change the
+ * tree and append a record to the log under the exclusive lock, then
+ * wait for the record to be synced outside of it, so concurrent writers
+ * are batched into one fsync (see write_ahead_log_t). They return false
+ * if the record could not be made durable. Once the log has failed they
+ * return false without changing the tree; reopen to recover.
+ * open() loads the snapshot and replays the log records after it.
+ * checkpoint() writes a new snapshot and empties the log, bounding replay
+ * time; call it when the log has grown large.
+ * Queries see a change as soon as its writer releases the lock, which may
+ * be before the change is durable.
+ * Mapped values go through `Codec` (see raw_codec_t); erase records
+ * replay as deleteEntrie, matching the mapped value.
+ */
+template <typename TreeType,
+          typename Codec = raw_codec_t<typename TreeType::mapped_type>,
+          typename MutexType = distributed_shared_mutex>
+class durable_rtree
+{
+public:
+  using tree_type = TreeType;
+  using codec_type = Codec;
+  using mutex_type = MutexType;
+  using size_type = typename TreeType::size_type;
+  using geometry_type = typename TreeType::geometry_type;
+  using key_type = typename TreeType::key_type;
+  using mapped_type = typename TreeType::mapped_type;
+  using value_type = typename TreeType::value_type;
+
+protected:
+  TreeType _tree;
+  Codec _codec;
+  leaf_encoding _encoding;
+  std::string _snapshot_path;
+  std::string _log_path;
+  write_ahead_log_t _log;
+  mutable MutexType _mutex;
+  // one checkpoint at a time
+  std::mutex _checkpoint_mutex;
+  // record encoding buffer, used under the exclusive lock
+  std::ostringstream _record;
+
+  // encode `op` on `value` and append it to the log; exclusive lock held
+  lsn_type append(wal_op op, value_type const* value)
+  {
+    _record.str(std::string());
+    if (value)
+    {
+      binary_writer_t writer(_record);
+      writer.write(value->first);
+      _codec.write(writer, value->second);
+    }
+    std::string const bytes = _record.str();
+    return _log.append(static_cast<std::uint32_t>(op), bytes.data(),
+                       bytes.size());
+  }
+
+  bool apply(wal_record_header_t const& header, unsigned char const* payload)
+  {
+    if (header.kind == static_cast<std::uint32_t>(wal_op::clear))
+    {
+      _tree.clear();
+      return true;
+    }
+    std::istringstream in(
+        std::string(reinterpret_cast<char const*>(payload), header.size));
+    binary_reader_t reader(in);
+    raw_storage_t<key_type> key;
+    mapped_type mapped {};
+    if (key.read(reader) == false || _codec.read(reader, mapped) == false)
+    {
+      return false;
+    }
+    value_type value(key.get(), std::move(mapped));
+    if (header.kind == static_cast<std::uint32_t>(wal_op::insert))
+    {
+      _tree.insert(std::move(value));
+    }
+    else if (header.kind == static_cast<std::uint32_t>(wal_op::erase))
+    {
+      _tree.deleteEntrie(value);
+    }
+    else
+    {
+      return false;
+    }
+    return true;
+  }
+
+public:
+  // snapshots are written with `encoding` (see RTree::save)
+  explicit durable_rtree(Codec codec = Codec(),
+                         leaf_encoding encoding = leaf_encoding::raw)
+      : _codec(std::move(codec))
+      , _encoding(encoding)
+  {
+  }
+  durable_rtree(durable_rtree const&) = delete;
+  durable_rtree& operator=(durable_rtree const&) = delete;
+
+  /*
+   * recover the tree stored at `path` (empty if there is none) and start
+   * logging to it.
+   * returns false if the snapshot or the log cannot be read, or a log
+   * record cannot be decoded; a torn record at the end of the log is
+   * expected after a crash and is dropped.
+   */
+  bool open(std::string const& path)
+  {
+    std::unique_lock<MutexType> lock(_mutex);
+    _log.close();
+    _tree.clear();
+    _snapshot_path = path + ".snapshot";
+    _log_path = path + ".wal";
+
+    durable_snapshot_header_t header;
+    std::ifstream snapshot(_snapshot_path, std::ios::binary);
+    if (snapshot.is_open())
+    {
+      binary_reader_t reader(snapshot);
+      if (reader.read(header) == false
+          || header.magic != durable_snapshot_header_t::MAGIC
+          || header.version != durable_snapshot_header_t::VERSION
+          || _tree.load(snapshot, _codec) == false)
+      {
+        return false;
+      }
+    }
+
+    bool ok = true;
+    std::uint64_t valid_bytes;
+    lsn_type last_lsn = header.lsn;
+    const bool readable = write_ahead_log_t::replay(
+        _log_path,
+        [&](wal_record_header_t const& record, unsigned char const* payload) {
+          // records before a checkpoint whose log reset did not happen
+          if (ok && record.lsn > header.lsn)
+          {
+            ok = apply(record, payload);
+          }
+        },
+        valid_bytes, last_lsn);
+    if (readable == false || ok == false)
+    {
+      _tree.clear();
+      return false;
+    }
+    if (last_lsn < header.lsn)
+    {
+      last_lsn = header.lsn;
+    }
+    return _log.open(_log_path, valid_bytes, last_lsn + 1);
+  }
+  bool is_open() const
+  {
+    return _log.is_open();
+  }
+
+  bool insert(value_type new_val)
+  {
+    lsn_type lsn;
+    {
+      std::unique_lock<MutexType> lock(_mutex);
+      if (_log.failed())
+      {
+        return false;
+      }
+      lsn = append(wal_op::insert, &new_val);
+      _tree.insert(std::move(new_val));
+    }
+    return _log.commit(lsn);
+  }
+  template <typename... Args>
+  bool emplace(Args&&... args)
+  {
+    return insert(value_type(std::forward<Args>(args)...));
+  }
+  bool deleteEntrie(value_type const& entrie)
+  {
+    lsn_type lsn;
+    {
+      std::unique_lock<MutexType> lock(_mutex);
+      if (_log.failed())
+      {
+        return false;
+      }
+      lsn = append(wal_op::erase, &entrie);
+      _tree.deleteEntrie(entrie);
+    }
+    return _log.commit(lsn);
+  }
+  bool clear()
+  {
+    lsn_type lsn;
+    {
+      std::unique_lock<MutexType> lock(_mutex);
+      if (_log.failed())
+      {
+        return false;
+      }
+      lsn = append(wal_op::clear, nullptr);
+      _tree.clear();
+    }
+    return _log.commit(lsn);
+  }
+
+  /*
+   * write a snapshot of the tree and empty the log
+   * the snapshot is written to a temporary file, synced and renamed over
+   * the old one, so a crash leaves either snapshot intact. Writers wait
+   * while the snapshot is written; queries keep running.
+   */
+  bool checkpoint()
+  {
+    std::lock_guard<std::mutex> checkpoint_lock(_checkpoint_mutex);
+    std::shared_lock<MutexType> lock(_mutex);
+    const std::string temp_path = _snapshot_path + ".tmp";
+    {
+      std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+      binary_writer_t writer(out);
+      durable_snapshot_header_t header;
+      header.lsn = _log.last_lsn();
+      writer.write(header);
+      if (_tree.save(out, _codec, _encoding) == false)
+      {
+        return false;
+      }
+      out.close();
+      if (out.fail())
+      {
+        return false;
+      }
+    }
+    if (sync_path(temp_path, O_RDONLY) == false
+        || std::rename(temp_path.c_str(), _snapshot_path.c_str()) != 0
+        || sync_path(directory_of(_snapshot_path), O_RDONLY | O_DIRECTORY)
+               == false)
+    {
+      return false;
+    }
+    return _log.reset();
+  }
+
+  template <typename _GeometryType, typename Functor>
+  void search_inside(_GeometryType const& search_range, Functor functor) const
+  {
+    std::shared_lock<MutexType> lock(_mutex);
+    _tree.search_inside(search_range, functor);
+  }
+  template <typename _GeometryType, typename Functor>
+  void search_overlap(_GeometryType const& search_range, Functor functor) const
+  {
+    std::shared_lock<MutexType> lock(_mutex);
+    _tree.search_overlap(search_range, functor);
+  }
+  size_type size() const
+  {
+    std::shared_lock<MutexType> lock(_mutex);
+    return _tree.size();
+  }
+  write_ahead_log_t::stats_type log_stats() const
+  {
+    return _log.stats();
+  }
+
+  // run `functor(tree_type const&)` under the shared lock
+  template <typename Functor>
+  decltype(auto) read(Functor functor) const
+  {
+    std::shared_lock<MutexType> lock(_mutex);
+    return functor(static_cast<TreeType const&>(_tree));
+  }
+};
+
+}
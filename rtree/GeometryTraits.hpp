@@ -57,5 +57,13 @@ namespace rtree {
 			return bound1.distance_center(bound2);
 		}
 		// ===================== MUST IMPLEMENT =====================
+
+		// ================ for nearest neighbour search ================
+		// smallest distance between bound and a point or bound, 0 if they
+		// overlap; any monotonic measure (e.g. squared distance) will do
+		template <typename PointOrBoundType>
+		static auto min_distance(GeometryType const& bound, PointOrBoundType const& p) {
+			return bound.min_distance(p);
+		}
 	};
 }
\ No newline at end of file
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "Global.hpp"
+#include "RTree.hpp"
+
+namespace rtree
+{
+
+/*
+ * hot_cold_rtree_t keeps mapped values out of the leaf nodes.
+ * Leaves store only `std::pair<key_type, slot_type>`, where the 32-bit slot
+ * indexes a dense value array owned by this tree. Scans therefore read only
+ * keys, and a value is touched only when its key matches the query.
+ * Slots of erased values are recycled by later inserts.
+ * mapped_type must be default constructible.
+ */
+template <typename GeometryType, // bounding box representation
+          typename KeyType, // key type, either bounding box or point
+          typename MappedType, // mapped type, user defined
+          size_type MinEntry = 8u, // m
+          size_type MaxEntry = 16u, // M
+          template <typename _T> class Allocator = std::allocator, // allocator
+          size_type MinLeafEntry = MinEntry, // m of leaf nodes
+          size_type MaxLeafEntry = MaxEntry // M of leaf nodes
+          >
+class hot_cold_rtree_t
+{
+public:
+  using slot_type = std::uint32_t;
+  using tree_type = RTree<GeometryType,
+                          KeyType,
+                          slot_type,
+                          MinEntry,
+                          MaxEntry,
+                          Allocator,
+                          MinLeafEntry,
+                          MaxLeafEntry>;
+
+  using size_type = ::rtree::size_type;
+  using geometry_type = GeometryType;
+  using key_type = KeyType;
+  using mapped_type = MappedType;
+  using value_type = std::pair<key_type, mapped_type>;
+
+  // what search functors receive; `second` refers into the value array
+  using reference = std::pair<key_type const&, mapped_type&>;
+  using const_reference = std::pair<key_type const&, mapped_type const&>;
+
+  constexpr static slot_type INVALID_SLOT
+      = std::numeric_limits<slot_type>::max();
+
+protected:
+  tree_type _tree;
+  std::vector<mapped_type, Allocator<mapped_type>> _values;
+  std::vector<slot_type, Allocator<slot_type>> _free_slots;
+
+  slot_type acquire_slot(mapped_type value)
+  {
+    if (_free_slots.empty() == false)
+    {
+      const slot_type slot = _free_slots.back();
+      _free_slots.pop_back();
+      _values[slot] = std::move(value);
+      return slot;
+    }
+    assert(_values.size() < INVALID_SLOT);
+    _values.emplace_back(std::move(value));
+    return static_cast<slot_type>(_values.size() - 1);
+  }
+  void release_slot(slot_type slot)
+  {
+    if (slot + 1 == _values.size())
+    {
+      _values.pop_back();
+    }
+    else
+    {
+      // drop resources held by the value now instead of on reuse
+      _values[slot] = mapped_type();
+      _free_slots.push_back(slot);
+    }
+  }
+
+  // find the slot storing entrie.second; INVALID_SLOT if not found
+  slot_type find_slot(value_type const& entrie) const
+  {
+    slot_type found = INVALID_SLOT;
+    _tree.search_overlap(entrie.first,
+                         [&](typename tree_type::value_type const& c)
+                         {
+                           if (_values[c.second] == entrie.second)
+                           {
+                             found = c.second;
+                             return true;
+                           }
+                           return false;
+                         });
+    return found;
+  }
+
+public:
+  hot_cold_rtree_t() = default;
+  explicit hot_cold_rtree_t(Allocator<value_type> const& alloc)
+      : _tree(typename tree_type::template allocator_type<
+              typename tree_type::value_type>(alloc))
+      , _values(Allocator<mapped_type>(alloc))
+      , _free_slots(Allocator<slot_type>(alloc))
+  {
+  }
+
+  void insert(value_type new_val)
+  {
+    const slot_type slot = acquire_slot(std::move(new_val.second));
+    _tree.insert({ std::move(new_val.first), slot });
+  }
+  template <typename... Args>
+  void emplace(Args&&... args)
+  {
+    insert(value_type(std::forward<Args>(args)...));
+  }
+
+  // erase the entry with mapped value equal to entrie.second,
+  // searched among the entries overlapping entrie.first
+  void deleteEntrie(value_type const& entrie)
+  {
+    const slot_type slot = find_slot(entrie);
+    if (slot == INVALID_SLOT)
+    {
+      return;
+    }
+    _tree.deleteEntrie({ entrie.first, slot });
+    release_slot(slot);
+  }
+
+  size_type size() const
+  {
+    return static_cast<size_type>(_values.size() - _free_slots.size());
+  }
+  bool empty() const
+  {
+    return size() == 0;
+  }
+  void clear()
+  {
+    _tree.clear();
+    _values.clear();
+    _free_slots.clear();
+  }
+  // release the capacity of the value array
+  void shrink_to_fit()
+  {
+    _values.shrink_to_fit();
+    _free_slots.shrink_to_fit();
+  }
+
+  mapped_type& value(slot_type slot)
+  {
+    assert(slot < _values.size());
+    return _values[slot];
+  }
+  mapped_type const& value(slot_type slot) const
+  {
+    assert(slot < _values.size());
+    return _values[slot];
+  }
+
+  // underlying key-only tree
+  tree_type& tree()
+  {
+    return _tree;
+  }
+  tree_type const& tree() const
+  {
+    return _tree;
+  }
+
+  template <typename _GeometryType, typename Functor>
+  void search_inside(_GeometryType const& search_range, Functor functor)
+  {
+    _tree.search_inside(search_range,
+                        [&](typename tree_type::value_type const& c)
+                        { return functor(reference(c.first, _values[c.second])); });
+  }
+  template <typename _GeometryType, typename Functor>
+  void search_overlap(_GeometryType const& search_range, Functor functor)
+  {
+    _tree.search_overlap(search_range,
+                         [&](typename tree_type::value_type const& c)
+                         { return functor(reference(c.first, _values[c.second])); });
+  }
+  template <typename _GeometryType, typename Functor>
+  void search_inside(_GeometryType const& search_range, Functor functor) const
+  {
+    _tree.search_inside(search_range,
+                        [&](typename tree_type::value_type const& c)
+                        {
+                          return functor(
+                              const_reference(c.first, _values[c.second]));
+                        });
+  }
+  template <typename _GeometryType, typename Functor>
+  void search_overlap(_GeometryType const& search_range, Functor functor) const
+  {
+    _tree.search_overlap(search_range,
+                         [&](typename tree_type::value_type const& c)
+                         {
+                           return functor(
+                               const_reference(c.first, _values[c.second]));
+                         });
+  }
+
+  // visit every entry; stops when functor returns true
+  template <typename Functor>
+  void for_each(Functor functor)
+  {
+    for (auto& c : _tree)
+    {
+      if (functor(reference(c.first, _values[c.second])))
+      {
+        return;
+      }
+    }
+  }
+  template <typename Functor>
+  void for_each(Functor functor) const
+  {
+    for (auto const& c : _tree)
+    {
+      if (functor(const_reference(c.first, _values[c.second])))
+      {
+        return;
+      }
+    }
+  }
+};
+
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#include "Global.hpp"
+#include "PoolAllocator.hpp"
+
+namespace rtree {
+
+/*
+ * huge_page_arena_t is a slab source for node_pool_t that reserves node
+ * memory in huge-page sized regions, so a root-to-leaf descent touches few
+ * TLB entries.
+ * Each region is mmap'd either from the explicit huge page pool
+ * (MAP_HUGETLB, when `hugetlb` is set) or as ordinary anonymous memory
+ * aligned to `page_bytes` and marked with madvise(MADV_HUGEPAGE) for
+ * transparent huge pages. If explicit huge pages are unavailable it falls
+ * back to transparent ones, and if mmap fails altogether (or on non-Linux
+ * platforms) to operator new.
+ * Slabs are carved from the regions and all regions are unmapped when the
+ * arena is destroyed.
+ */
+class huge_page_arena_t {
+public:
+  constexpr static std::size_t PAGE_2M = std::size_t(1) << 21;
+  constexpr static std::size_t PAGE_1G = std::size_t(1) << 30;
+
+  struct options_type {
+    // huge page size; PAGE_2M or PAGE_1G
+    std::size_t page_bytes = PAGE_2M;
+    // use the reserved hugetlbfs pool instead of transparent huge pages
+    bool hugetlb = false;
+  };
+
+protected:
+  struct region_t {
+    void* addr;
+    std::size_t bytes;
+    bool mapped; // false when allocated with operator new
+  };
+
+  options_type _options;
+  std::vector<region_t> _regions;
+  char* _cursor = nullptr; // next free byte in the last region
+  char* _end = nullptr;
+  size_type _huge_regions = 0;
+
+public:
+  huge_page_arena_t() = default;
+  explicit huge_page_arena_t(options_type const& options)
+      : _options(options)
+  {
+  }
+  huge_page_arena_t(huge_page_arena_t const&) = delete;
+  huge_page_arena_t& operator=(huge_page_arena_t const&) = delete;
+  ~huge_page_arena_t() {
+    for (region_t const& r : _regions) {
+      release(r);
+    }
+  }
+
+  // `bytes` is a power of two; returned slab is aligned to `bytes`
+  void* allocate_slab(std::size_t bytes) {
+    if (bytes > _options.page_bytes) {
+      // slab larger than a page gets its own region
+      return reserve(bytes);
+    }
+    if (_cursor == _end) {
+      _cursor = static_cast<char*>(reserve(_options.page_bytes));
+      _end = _cursor + _options.page_bytes;
+    }
+    // regions are page aligned and pages are multiples of `bytes`
+    void* slab = _cursor;
+    _cursor += bytes;
+    return slab;
+  }
+  void deallocate_slab(void*, std::size_t) {
+    // memory is returned with the whole region on destruction
+  }
+
+  // number of regions reserved in total / backed by huge pages
+  size_type region_count() const {
+    return static_cast<size_type>(_regions.size());
+  }
+  size_type huge_region_count() const {
+    return _huge_regions;
+  }
+
+protected:
+  // reserve a region of `bytes`, aligned to `bytes`
+  void* reserve(std::size_t bytes) {
+#if defined(__linux__)
+#if defined(MAP_HUGETLB)
+    if (_options.hugetlb) {
+      int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+#if defined(MAP_HUGE_1GB) && defined(MAP_HUGE_2MB)
+      flags |= _options.page_bytes == PAGE_1G ? MAP_HUGE_1GB : MAP_HUGE_2MB;
+#endif
+      // mappings are only aligned to the huge page size; a region larger
+      // than a page is over-reserved and trimmed like below (the trimmed
+      // parts are whole huge pages, as `bytes` is a multiple of a page)
+      const std::size_t reserved
+          = bytes > _options.page_bytes ? bytes * 2 : bytes;
+      void* p = mmap(nullptr, reserved, PROT_READ | PROT_WRITE, flags, -1, 0);
+      if (p != MAP_FAILED) {
+        void* aligned = trim_to_alignment(p, reserved, bytes);
+        _regions.push_back({ aligned, bytes, true });
+        ++_huge_regions;
+        return aligned;
+      }
+    }
+#endif
+    // over-reserve so the region can be trimmed to its alignment
+    const std::size_t reserved = bytes * 2;
+    void* p = mmap(nullptr, reserved, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p != MAP_FAILED) {
+      void* aligned = trim_to_alignment(p, reserved, bytes);
+#if defined(MADV_HUGEPAGE)
+      if (madvise(aligned, bytes, MADV_HUGEPAGE) == 0) {
+        ++_huge_regions;
+      }
+#endif
+      _regions.push_back({ aligned, bytes, true });
+      return aligned;
+    }
+#endif
+    void* mem = ::operator new(bytes, std::align_val_t(bytes));
+    _regions.push_back({ mem, bytes, false });
+    return mem;
+  }
+#if defined(__linux__)
+  // unmap the parts of the mapping [p, p + reserved) outside of the
+  // `bytes` aligned block of `bytes` it contains
+  static void* trim_to_alignment(void* p, std::size_t reserved,
+                                 std::size_t bytes) {
+    char* begin = static_cast<char*>(p);
+    char* aligned = reinterpret_cast<char*>(
+        (reinterpret_cast<std::uintptr_t>(begin) + bytes - 1)
+        & ~(std::uintptr_t(bytes) - 1));
+    if (aligned != begin) {
+      munmap(begin, aligned - begin);
+    }
+    const std::size_t tail = (begin + reserved) - (aligned + bytes);
+    if (tail) {
+      munmap(aligned + bytes, tail);
+    }
+    return aligned;
+  }
+#endif
+  void release(region_t const& r) {
+#if defined(__linux__)
+    if (r.mapped) {
+      munmap(r.addr, r.bytes);
+      return;
+    }
+#endif
+    ::operator delete(r.addr, std::align_val_t(r.bytes));
+  }
+};
+
+// slab pool allocator whose slabs live in huge-page backed regions
+// e.g. RTree<..., rtree::huge_page_allocator>
+template <typename T>
+using huge_page_allocator = basic_pool_allocator<T, huge_page_arena_t>;
+
+}
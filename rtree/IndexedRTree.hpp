@@ -0,0 +1,249 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "GeometryTraits.hpp"
+#include "Global.hpp"
+
+namespace rtree
+{
+
+/*
+ * indexed_rtree_t is a read-only copy of an RTree whose nodes live in
+ * contiguous per-level vectors and refer to their children by 32-bit index
+ * instead of by pointer.
+ * Nothing in the structure depends on its address, so as long as
+ * geometry_type, key_type and mapped_type are trivially copyable, every
+ * buffer can be memcpy'd, written to disk or shared between processes as is.
+ * Nodes of one level are stored in breadth-first order, so siblings are
+ * adjacent in memory.
+ */
+template <typename TreeType>
+class indexed_rtree_t
+{
+public:
+  using tree_type = TreeType;
+  using size_type = ::rtree::size_type;
+  using index_type = std::uint32_t;
+  using geometry_type = typename TreeType::geometry_type;
+  using traits = geometry_traits<geometry_type>;
+  using key_type = typename TreeType::key_type;
+  using mapped_type = typename TreeType::mapped_type;
+  using value_type = typename TreeType::value_type;
+  using const_reference = std::pair<key_type const&, mapped_type const&>;
+
+  // range of a node's entries in the entry buffers of its level
+  struct node_t
+  {
+    index_type offset;
+    index_type size;
+  };
+  // one internal level; entry `i` of any node on this level has bound
+  // bounds[i] and child node children[i] on the next level
+  struct level_t
+  {
+    std::vector<node_t> nodes;
+    std::vector<geometry_type> bounds;
+    std::vector<index_type> children;
+  };
+
+protected:
+  // internal levels, root first; empty when the root is a leaf
+  std::vector<level_t> _levels;
+  // leaf level; entry `i` of any leaf is (keys[i], values[i])
+  std::vector<node_t> _leaves;
+  std::vector<key_type> _keys;
+  std::vector<mapped_type> _values;
+
+public:
+  indexed_rtree_t() = default;
+  explicit indexed_rtree_t(TreeType const& tree)
+  {
+    assign(tree);
+  }
+
+  void assign(TreeType const& tree)
+  {
+    using node_base_type = typename TreeType::node_base_type;
+
+    clear();
+    _levels.resize(tree.leaf_level());
+
+    std::vector<node_base_type const*> frontier, next;
+    frontier.push_back(tree.root());
+    for (int level = 0; level < tree.leaf_level(); ++level)
+    {
+      level_t& l = _levels[level];
+      l.nodes.reserve(frontier.size());
+      next.clear();
+      for (node_base_type const* n : frontier)
+      {
+        auto const* node = n->as_node();
+        l.nodes.push_back({ static_cast<index_type>(l.bounds.size()),
+                            static_cast<index_type>(node->size()) });
+        for (auto const& c : *node)
+        {
+          l.bounds.push_back(c.first);
+          l.children.push_back(static_cast<index_type>(next.size()));
+          next.push_back(c.second);
+        }
+      }
+      frontier.swap(next);
+    }
+
+    _leaves.reserve(frontier.size());
+    for (node_base_type const* n : frontier)
+    {
+      auto const* leaf = n->as_leaf();
+      _leaves.push_back({ static_cast<index_type>(_keys.size()),
+                          static_cast<index_type>(leaf->size()) });
+      for (auto const& c : *leaf)
+      {
+        _keys.push_back(c.first);
+        _values.push_back(c.second);
+      }
+    }
+  }
+
+  void clear()
+  {
+    _levels.clear();
+    _leaves.clear();
+    _keys.clear();
+    _values.clear();
+  }
+
+  size_type size() const
+  {
+    return static_cast<size_type>(_keys.size());
+  }
+  bool empty() const
+  {
+    return _keys.empty();
+  }
+  int leaf_level() const
+  {
+    return static_cast<int>(_levels.size());
+  }
+
+  std::vector<level_t> const& levels() const
+  {
+    return _levels;
+  }
+  std::vector<node_t> const& leaves() const
+  {
+    return _leaves;
+  }
+  std::vector<key_type> const& keys() const
+  {
+    return _keys;
+  }
+  std::vector<mapped_type> const& values() const
+  {
+    return _values;
+  }
+
+protected:
+  template <typename _GeometryType, typename Functor>
+  bool search_overlap_wrapper(index_type node,
+                              int level,
+                              _GeometryType const& search_range,
+                              Functor& functor) const
+  {
+    if (level == leaf_level())
+    {
+      node_t const& leaf = _leaves[node];
+      for (index_type i = leaf.offset; i < leaf.offset + leaf.size; ++i)
+      {
+        if (traits::is_overlap(_keys[i], search_range) == false)
+        {
+          continue;
+        }
+        if (functor(const_reference(_keys[i], _values[i])))
+        {
+          return true;
+        }
+      }
+      return false;
+    }
+    level_t const& l = _levels[level];
+    node_t const& n = l.nodes[node];
+    for (index_type i = n.offset; i < n.offset + n.size; ++i)
+    {
+      if (traits::is_overlap(l.bounds[i], search_range) == false)
+      {
+        continue;
+      }
+      if (search_overlap_wrapper(l.children[i], level + 1, search_range,
+                                 functor))
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  template <typename _GeometryType, typename Functor>
+  bool search_inside_wrapper(index_type node,
+                             int level,
+                             _GeometryType const& search_range,
+                             Functor& functor) const
+  {
+    if (level == leaf_level())
+    {
+      node_t const& leaf = _leaves[node];
+      for (index_type i = leaf.offset; i < leaf.offset + leaf.size; ++i)
+      {
+        if (traits::is_inside(search_range, _keys[i]) == false)
+        {
+          continue;
+        }
+        if (functor(const_reference(_keys[i], _values[i])))
+        {
+          return true;
+        }
+      }
+      return false;
+    }
+    level_t const& l = _levels[level];
+    node_t const& n = l.nodes[node];
+    for (index_type i = n.offset; i < n.offset + n.size; ++i)
+    {
+      if (traits::is_overlap(l.bounds[i], search_range) == false)
+      {
+        continue;
+      }
+      if (search_inside_wrapper(l.children[i], level + 1, search_range,
+                                functor))
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+public:
+  template <typename _GeometryType, typename Functor>
+  void search_overlap(_GeometryType const& search_range, Functor functor) const
+  {
+    if (_leaves.empty())
+    {
+      return;
+    }
+    search_overlap_wrapper(0, 0, search_range, functor);
+  }
+  template <typename _GeometryType, typename Functor>
+  void search_inside(_GeometryType const& search_range, Functor functor) const
+  {
+    if (_leaves.empty())
+    {
+      return;
+    }
+    search_inside_wrapper(0, 0, search_range, functor);
+  }
+};
+
+}
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+#endif
+
+#include "BufferPool.hpp"
+#include "Global.hpp"
+
+namespace rtree {
+
+/*
+ * io_uring_page_reader_t reads a batch of pages of a page_file_t through
+ * an io_uring: every read of the batch is queued before waiting, so they
+ * are in flight together instead of one pread after another.
+ * The ring is set up with raw syscalls (no liburing). Where io_uring is
+ * not available (other systems, old kernels, or disabled by policy) reads
+ * fall back to pread, as do reads the ring fails or returns short.
+ * Usable by one thread at a time; use one reader per thread.
+ */
+class io_uring_page_reader_t {
+public:
+  constexpr static unsigned DEFAULT_ENTRIES = 64;
+
+  struct stats_type {
+    std::uint64_t batches = 0;
+    std::uint64_t ring_reads = 0;
+    std::uint64_t fallback_reads = 0;
+  };
+
+protected:
+  int _ring_fd = -1;
+  unsigned _entries = 0;
+  std::vector<iovec> _iov;
+  stats_type _stats;
+
+#if defined(__linux__) && defined(IORING_OFF_SQES) \
+    && defined(__NR_io_uring_setup)
+  void* _sq_ring = MAP_FAILED;
+  std::size_t _sq_ring_bytes = 0;
+  void* _cq_ring = MAP_FAILED;
+  std::size_t _cq_ring_bytes = 0;
+  io_uring_sqe* _sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+  std::size_t _sqes_bytes = 0;
+  unsigned* _sq_head = nullptr;
+  unsigned* _sq_tail = nullptr;
+  unsigned* _sq_mask = nullptr;
+  unsigned* _sq_array = nullptr;
+  unsigned* _cq_head = nullptr;
+  unsigned* _cq_tail = nullptr;
+  unsigned* _cq_mask = nullptr;
+  io_uring_cqe* _cqes = nullptr;
+
+  void setup(unsigned entries) {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    _ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (_ring_fd < 0) {
+      return;
+    }
+    _sq_ring_bytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    _cq_ring_bytes
+        = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+      if (_cq_ring_bytes > _sq_ring_bytes) {
+        _sq_ring_bytes = _cq_ring_bytes;
+      }
+      _cq_ring_bytes = _sq_ring_bytes;
+    }
+    _sq_ring = mmap(nullptr, _sq_ring_bytes, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQ_RING);
+    if (_sq_ring != MAP_FAILED && single_mmap == false) {
+      _cq_ring = mmap(nullptr, _cq_ring_bytes, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_CQ_RING);
+    }
+    _sqes_bytes = params.sq_entries * sizeof(io_uring_sqe);
+    _sqes = static_cast<io_uring_sqe*>(
+        mmap(nullptr, _sqes_bytes, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQES));
+    if (_sq_ring == MAP_FAILED
+        || (single_mmap == false && _cq_ring == MAP_FAILED)
+        || _sqes == MAP_FAILED) {
+      teardown();
+      return;
+    }
+    unsigned char* sq = static_cast<unsigned char*>(_sq_ring);
+    unsigned char* cq
+        = static_cast<unsigned char*>(single_mmap ? _sq_ring : _cq_ring);
+    _sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    _sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    _sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    _sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    _cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    _cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    _cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    _cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    // the completion queue holds twice as many entries, so keeping at
+    // most sq_entries reads in flight never overflows it
+    _entries = params.sq_entries;
+  }
+  void teardown() {
+    if (_sqes != MAP_FAILED) {
+      munmap(_sqes, _sqes_bytes);
+      _sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    }
+    if (_cq_ring != MAP_FAILED) {
+      munmap(_cq_ring, _cq_ring_bytes);
+      _cq_ring = MAP_FAILED;
+    }
+    if (_sq_ring != MAP_FAILED) {
+      munmap(_sq_ring, _sq_ring_bytes);
+      _sq_ring = MAP_FAILED;
+    }
+    if (_ring_fd >= 0) {
+      ::close(_ring_fd);
+      _ring_fd = -1;
+    }
+  }
+
+  // take the completions posted so far
+  void reap(page_file_t const& file, page_read_t* first,
+            std::size_t& completed) {
+    unsigned head = *_cq_head;
+    const unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+      io_uring_cqe const& cqe = _cqes[head & *_cq_mask];
+      page_read_t& r = first[cqe.user_data];
+      if (cqe.res == static_cast<int>(file.page_size())) {
+        r.ok = true;
+        ++_stats.ring_reads;
+      }
+      else {
+        // failed, short (end of file) or unsupported: read it again
+        r.ok = file.read(r.page, r.data);
+        ++_stats.fallback_reads;
+      }
+      ++completed;
+    }
+    __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+  }
+
+  bool read_ring(page_file_t const& file, page_read_t* first,
+                 page_read_t* last) {
+    const std::size_t count = static_cast<std::size_t>(last - first);
+    _iov.resize(count);
+    std::size_t queued = 0;
+    std::size_t completed = 0;
+    bool broken = false;
+    while (completed < queued || (queued < count && broken == false)) {
+      unsigned tail = *_sq_tail;
+      while (broken == false && queued < count
+             && queued - completed < _entries) {
+        const unsigned index = tail & *_sq_mask;
+        io_uring_sqe& sqe = _sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        _iov[queued].iov_base = first[queued].data;
+        _iov[queued].iov_len = file.page_size();
+        sqe.opcode = IORING_OP_READV;
+        sqe.fd = file.fd();
+        sqe.addr = reinterpret_cast<std::uint64_t>(&_iov[queued]);
+        sqe.len = 1;
+        sqe.off = static_cast<std::uint64_t>(file.offset(first[queued].page));
+        sqe.user_data = queued;
+        _sq_array[index] = index;
+        ++tail;
+        ++queued;
+      }
+      __atomic_store_n(_sq_tail, tail, __ATOMIC_RELEASE);
+      if (broken) {
+        // completions still arrive without io_uring_enter
+        reap(file, first, completed);
+        continue;
+      }
+      const unsigned to_submit
+          = tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+      const long ret = syscall(__NR_io_uring_enter, _ring_fd, to_submit, 1u,
+                               IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        // take back what the kernel did not consume and wait for the rest
+        const unsigned head = __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+        queued -= tail - head;
+        __atomic_store_n(_sq_tail, head, __ATOMIC_RELEASE);
+        broken = true;
+      }
+      reap(file, first, completed);
+    }
+    if (broken) {
+      teardown();
+      _stats.fallback_reads += count - queued;
+      pread_page_reader_t().read(file, first + queued, last);
+    }
+    bool ok = true;
+    for (; first != last; ++first) {
+      ok = ok && first->ok;
+    }
+    return ok;
+  }
+#else
+  void teardown() {
+  }
+  bool read_ring(page_file_t const& file, page_read_t* first,
+                 page_read_t* last) {
+    return pread_page_reader_t().read(file, first, last);
+  }
+#endif
+
+public:
+  // `entries` is the most reads kept in flight
+  explicit io_uring_page_reader_t(unsigned entries = DEFAULT_ENTRIES) {
+#if defined(__linux__) && defined(IORING_OFF_SQES) \
+    && defined(__NR_io_uring_setup)
+    setup(entries);
+#else
+    (void)entries;
+#endif
+  }
+  io_uring_page_reader_t(io_uring_page_reader_t const&) = delete;
+  io_uring_page_reader_t& operator=(io_uring_page_reader_t const&) = delete;
+  ~io_uring_page_reader_t() {
+    teardown();
+  }
+
+  // false if reads go through pread
+  bool available() const {
+    return _ring_fd >= 0;
+  }
+
+  // read every page of [first, last); false if some read failed
+  bool read(page_file_t const& file, page_read_t* first, page_read_t* last) {
+    ++_stats.batches;
+    if (_ring_fd < 0) {
+      _stats.fallback_reads += static_cast<std::uint64_t>(last - first);
+      return pread_page_reader_t().read(file, first, last);
+    }
+    return read_ring(file, first, last);
+  }
+
+  stats_type const& stats() const {
+    return _stats;
+  }
+};
+
+}
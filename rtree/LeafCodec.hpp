@@ -0,0 +1,210 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include "Global.hpp"
+#include "Serialization.hpp"
+#include "StaticVector.hpp"
+
+namespace rtree {
+
+// LEB128: 7 bits per byte, high bit set on all but the last byte
+inline void write_varint(std::vector<unsigned char>& out, std::uint64_t v) {
+  while (v >= 0x80) {
+    out.push_back(static_cast<unsigned char>(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back(static_cast<unsigned char>(v));
+}
+inline bool read_varint(unsigned char const*& p, unsigned char const* end,
+                        std::uint64_t& v) {
+  // one byte values are the common case
+  if (p != end && *p < 0x80) {
+    v = *p++;
+    return true;
+  }
+  v = 0;
+  for (unsigned shift = 0; p != end && shift < 64; shift += 7) {
+    const unsigned char byte = *p++;
+    v |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+    if (byte < 0x80) {
+      return true;
+    }
+  }
+  return false;
+}
+// small magnitudes of either sign to small unsigned values
+inline std::uint64_t zigzag_encode(std::int64_t v) {
+  return (static_cast<std::uint64_t>(v) << 1)
+         ^ static_cast<std::uint64_t>(v >> 63);
+}
+inline std::int64_t zigzag_decode(std::uint64_t v) {
+  return static_cast<std::int64_t>(v >> 1)
+         ^ -static_cast<std::int64_t>(v & 1);
+}
+
+/*
+ * delta_leaf_codec_t packs the entries of a leaf against a reference
+ * point, normally the min corner of the leaf's bound in its parent.
+ * KeyType must be laid out as DIM scalars (a point) or 2 * DIM scalars
+ * (min corner then max corner, as aabb_t); SUPPORTED is false otherwise.
+ * Min corner scalars are coded against the reference, max corner scalars
+ * against the key's own min corner (the extent):
+ *  - integers as a zigzag varint of the difference
+ *  - floating point as the XOR of the bit patterns, stored as a header
+ *    byte (trailing zero bytes << 4 | significant bytes) and the
+ *    significant bytes; nearby and quantized values share their high and
+ *    low bytes with the reference, so most of the XOR is zero
+ * Integer mapped values are stored after the keys as zigzag varint
+ * differences to the previous entry's value, which makes sequential ids
+ * one byte each.
+ * Decoding is exact.
+ */
+template <typename KeyType, typename MappedType, typename ScalarType, int Dim>
+class delta_leaf_codec_t {
+public:
+  using key_type = KeyType;
+  using mapped_type = MappedType;
+  using scalar_type = ScalarType;
+  using reference_type = std::array<scalar_type, Dim>;
+
+  constexpr static int DIM = Dim;
+  constexpr static std::size_t SLOTS = sizeof(KeyType) / sizeof(ScalarType);
+  constexpr static bool SUPPORTED
+      = std::is_arithmetic<ScalarType>::value && sizeof(ScalarType) <= 8
+        && sizeof(KeyType) % sizeof(ScalarType) == 0
+        && (SLOTS == std::size_t(Dim) || SLOTS == 2 * std::size_t(Dim))
+        && is_bitwise_copyable<KeyType>::value;
+  constexpr static bool PACK_MAPPED = std::is_integral<MappedType>::value;
+  // upper bound of the packed size of an entry (a varint is at most 10)
+  constexpr static std::size_t MAX_ENTRY_BYTES = (SLOTS + 1) * 10;
+
+protected:
+  using bits_type = std::conditional_t<sizeof(ScalarType) <= 4,
+                                       std::uint32_t,
+                                       std::uint64_t>;
+
+  static bits_type bits_of(scalar_type x) {
+    bits_type b = 0;
+    std::memcpy(&b, &x, sizeof(x));
+    return b;
+  }
+  static scalar_type scalar_of(bits_type b) {
+    scalar_type x;
+    std::memcpy(&x, &b, sizeof(x));
+    return x;
+  }
+
+  static void encode_scalar(scalar_type x, scalar_type reference,
+                            std::vector<unsigned char>& out) {
+    if constexpr (std::is_floating_point<scalar_type>::value) {
+      bits_type v = bits_of(x) ^ bits_of(reference);
+      if (v == 0) {
+        out.push_back(0);
+        return;
+      }
+      unsigned trailing = 0;
+      while ((v & 0xff) == 0) {
+        v >>= 8;
+        ++trailing;
+      }
+      const std::size_t header = out.size();
+      out.push_back(0);
+      unsigned bytes = 0;
+      do {
+        out.push_back(static_cast<unsigned char>(v));
+        v >>= 8;
+        ++bytes;
+      } while (v != 0);
+      out[header] = static_cast<unsigned char>(trailing << 4 | bytes);
+    }
+    else {
+      // two's complement difference; exact for any pair of values
+      const std::uint64_t delta = static_cast<std::uint64_t>(x)
+                                  - static_cast<std::uint64_t>(reference);
+      write_varint(out, zigzag_encode(static_cast<std::int64_t>(delta)));
+    }
+  }
+  static bool decode_scalar(unsigned char const*& p, unsigned char const* end,
+                            scalar_type reference, scalar_type& x) {
+    if constexpr (std::is_floating_point<scalar_type>::value) {
+      if (p == end) {
+        return false;
+      }
+      const unsigned header = *p++;
+      const unsigned trailing = header >> 4;
+      const unsigned bytes = header & 0x0f;
+      if (trailing + bytes > sizeof(bits_type)
+          || static_cast<std::size_t>(end - p) < bytes) {
+        return false;
+      }
+      bits_type v = 0;
+      for (unsigned i = 0; i < bytes; ++i) {
+        v |= static_cast<bits_type>(p[i]) << (8 * (trailing + i));
+      }
+      p += bytes;
+      x = scalar_of(v ^ bits_of(reference));
+      return true;
+    }
+    else {
+      std::uint64_t v;
+      if (!read_varint(p, end, v)) {
+        return false;
+      }
+      x = static_cast<scalar_type>(static_cast<std::uint64_t>(reference)
+                                   + static_cast<std::uint64_t>(
+                                       zigzag_decode(v)));
+      return true;
+    }
+  }
+
+public:
+  static void encode_key(reference_type const& reference, key_type const& key,
+                         std::vector<unsigned char>& out) {
+    scalar_type slots[SLOTS];
+    std::memcpy(slots, &key, sizeof(key));
+    for (std::size_t i = 0; i < SLOTS; ++i) {
+      encode_scalar(
+          slots[i], i < std::size_t(Dim) ? reference[i] : slots[i - Dim], out);
+    }
+  }
+  static bool decode_key(reference_type const& reference,
+                         unsigned char const*& p, unsigned char const* end,
+                         raw_storage_t<key_type>& key) {
+    scalar_type slots[SLOTS];
+    for (std::size_t i = 0; i < SLOTS; ++i) {
+      if (!decode_scalar(p, end,
+                         i < std::size_t(Dim) ? reference[i] : slots[i - Dim],
+                         slots[i])) {
+        return false;
+      }
+    }
+    std::memcpy(key.bytes, slots, sizeof(slots));
+    return true;
+  }
+
+  // `previous` is the last value coded in the leaf, 0 at its start
+  static void encode_mapped(mapped_type previous, mapped_type value,
+                            std::vector<unsigned char>& out) {
+    const std::uint64_t delta = static_cast<std::uint64_t>(value)
+                                - static_cast<std::uint64_t>(previous);
+    write_varint(out, zigzag_encode(static_cast<std::int64_t>(delta)));
+  }
+  static bool decode_mapped(unsigned char const*& p, unsigned char const* end,
+                            mapped_type previous, mapped_type& value) {
+    std::uint64_t v;
+    if (!read_varint(p, end, v)) {
+      return false;
+    }
+    value = static_cast<mapped_type>(static_cast<std::uint64_t>(previous)
+                                     + static_cast<std::uint64_t>(
+                                         zigzag_decode(v)));
+    return true;
+  }
+};
+
+}
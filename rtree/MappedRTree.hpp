@@ -0,0 +1,485 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "GeometryTraits.hpp"
+#include "Global.hpp"
+#include "IndexedRTree.hpp"
+#include "StaticVector.hpp"
+
+namespace rtree
+{
+
+/*
+ * file layout read by mapped_rtree: a mapped_file_header_t, one
+ * mapped_level_t per internal level (root first), then the arrays of
+ * indexed_rtree_t (node ranges, bounds, child indices, leaf ranges, keys,
+ * mapped values) each at a SECTION_ALIGN aligned offset from the start of
+ * the file. All offsets are relative to the start of the file, so the
+ * bytes can be used wherever they are mapped.
+ */
+struct mapped_file_header_t
+{
+  constexpr static std::uint32_t MAGIC = 0x464d5452; // "RTMF" little endian
+  constexpr static std::uint32_t VERSION = 1;
+  constexpr static std::uint32_t ENDIAN_TAG = 0x01020304;
+  constexpr static std::uint64_t SECTION_ALIGN = 64;
+
+  std::uint32_t magic = MAGIC;
+  std::uint32_t version = VERSION;
+  std::uint32_t endian = ENDIAN_TAG;
+  std::uint32_t geometry_bytes = 0;
+  std::uint32_t key_bytes = 0;
+  std::uint32_t mapped_bytes = 0;
+  std::uint32_t leaf_level = 0;
+  std::uint32_t reserved = 0;
+  std::uint64_t leaf_count = 0;
+  std::uint64_t entry_count = 0;
+  std::uint64_t leaves = 0; // offset of the leaf node_t array
+  std::uint64_t keys = 0;
+  std::uint64_t values = 0;
+  std::uint64_t file_bytes = 0;
+};
+struct mapped_level_t
+{
+  std::uint64_t node_count = 0;
+  std::uint64_t entry_count = 0;
+  std::uint64_t nodes = 0; // offset of the node_t array
+  std::uint64_t bounds = 0;
+  std::uint64_t children = 0;
+};
+
+/*
+ * mapped_rtree is a read-only view of a file written by
+ * mapped_rtree::write, searched directly on the mapped bytes: open() maps
+ * the file and checks its header, nothing is deserialized, and processes
+ * mapping the same file share its pages through the page cache.
+ * The view has the same per-level layout as indexed_rtree_t, with the
+ * same requirement that geometry_type, key_type and mapped_type are
+ * bitwise copyable. open() only checks that the header matches this
+ * TreeType and that every array lies within the file; node contents are
+ * trusted.
+ * On non-Linux platforms the file is read into memory instead.
+ */
+template <typename TreeType>
+class mapped_rtree
+{
+public:
+  using tree_type = TreeType;
+  using size_type = ::rtree::size_type;
+  using indexed_type = indexed_rtree_t<TreeType>;
+  using index_type = typename indexed_type::index_type;
+  using node_t = typename indexed_type::node_t;
+  using geometry_type = typename TreeType::geometry_type;
+  using traits = geometry_traits<geometry_type>;
+  using key_type = typename TreeType::key_type;
+  using mapped_type = typename TreeType::mapped_type;
+  using const_reference = std::pair<key_type const&, mapped_type const&>;
+
+  static_assert(is_bitwise_copyable<geometry_type>::value
+                    && is_bitwise_copyable<key_type>::value
+                    && is_bitwise_copyable<mapped_type>::value,
+                "mapped_rtree stores bounds, keys and values as raw bytes");
+
+protected:
+  struct level_view_t
+  {
+    node_t const* nodes;
+    geometry_type const* bounds;
+    index_type const* children;
+  };
+
+  unsigned char const* _data = nullptr;
+  std::size_t _bytes = 0;
+  bool _mapped = false;
+  // used instead of a mapping on non-Linux platforms
+  std::vector<unsigned char> _buffer;
+
+  std::vector<level_view_t> _levels;
+  node_t const* _leaves = nullptr;
+  key_type const* _keys = nullptr;
+  mapped_type const* _values = nullptr;
+  size_type _leaf_count = 0;
+  size_type _size = 0;
+
+  static std::uint64_t align(std::uint64_t offset)
+  {
+    const std::uint64_t a = mapped_file_header_t::SECTION_ALIGN;
+    return (offset + a - 1) / a * a;
+  }
+  template <typename T>
+  static void write_section(std::ostream& out,
+                            std::uint64_t& at,
+                            std::uint64_t offset,
+                            T const* data,
+                            std::size_t count)
+  {
+    static const char zeros[mapped_file_header_t::SECTION_ALIGN] = {};
+    out.write(zeros, static_cast<std::streamsize>(offset - at));
+    out.write(reinterpret_cast<char const*>(data),
+              static_cast<std::streamsize>(sizeof(T) * count));
+    at = offset + sizeof(T) * count;
+  }
+  // pointer to `count` T at `offset`, or null if it is out of the file
+  template <typename T>
+  T const* section(std::uint64_t offset, std::uint64_t count) const
+  {
+    if (offset % alignof(T) != 0 || offset > _bytes
+        || count > (_bytes - offset) / sizeof(T))
+    {
+      return nullptr;
+    }
+    return reinterpret_cast<T const*>(_data + offset);
+  }
+
+  bool attach()
+  {
+    mapped_file_header_t header;
+    if (_bytes < sizeof(header))
+    {
+      return false;
+    }
+    std::memcpy(&header, _data, sizeof(header));
+    if (header.magic != mapped_file_header_t::MAGIC
+        || header.version != mapped_file_header_t::VERSION
+        || header.endian != mapped_file_header_t::ENDIAN_TAG
+        || header.geometry_bytes != sizeof(geometry_type)
+        || header.key_bytes != sizeof(key_type)
+        || header.mapped_bytes != sizeof(mapped_type)
+        || header.file_bytes != _bytes || header.leaf_level > 64)
+    {
+      return false;
+    }
+    mapped_level_t const* levels = section<mapped_level_t>(
+        sizeof(header), header.leaf_level);
+    if (levels == nullptr)
+    {
+      return false;
+    }
+    _levels.clear();
+    for (std::uint32_t i = 0; i < header.leaf_level; ++i)
+    {
+      level_view_t l;
+      l.nodes = section<node_t>(levels[i].nodes, levels[i].node_count);
+      l.bounds = section<geometry_type>(levels[i].bounds,
+                                        levels[i].entry_count);
+      l.children = section<index_type>(levels[i].children,
+                                       levels[i].entry_count);
+      if (l.nodes == nullptr || l.bounds == nullptr || l.children == nullptr)
+      {
+        return false;
+      }
+      _levels.push_back(l);
+    }
+    _leaves = section<node_t>(header.leaves, header.leaf_count);
+    _keys = section<key_type>(header.keys, header.entry_count);
+    _values = section<mapped_type>(header.values, header.entry_count);
+    if (_leaves == nullptr || _keys == nullptr || _values == nullptr)
+    {
+      return false;
+    }
+    _leaf_count = static_cast<size_type>(header.leaf_count);
+    _size = static_cast<size_type>(header.entry_count);
+    return true;
+  }
+
+public:
+  mapped_rtree() = default;
+  mapped_rtree(mapped_rtree const&) = delete;
+  mapped_rtree& operator=(mapped_rtree const&) = delete;
+  ~mapped_rtree()
+  {
+    close();
+  }
+
+  // write `tree` in the mapped format; returns false if the stream failed
+  static bool write(indexed_type const& tree, std::ostream& out)
+  {
+    mapped_file_header_t header;
+    header.geometry_bytes = sizeof(geometry_type);
+    header.key_bytes = sizeof(key_type);
+    header.mapped_bytes = sizeof(mapped_type);
+    header.leaf_level = static_cast<std::uint32_t>(tree.leaf_level());
+    header.leaf_count = tree.leaves().size();
+    header.entry_count = tree.keys().size();
+
+    std::vector<mapped_level_t> levels(tree.levels().size());
+    std::uint64_t offset
+        = sizeof(header) + sizeof(mapped_level_t) * levels.size();
+    for (std::size_t i = 0; i < levels.size(); ++i)
+    {
+      auto const& l = tree.levels()[i];
+      levels[i].node_count = l.nodes.size();
+      levels[i].entry_count = l.bounds.size();
+      levels[i].nodes = offset = align(offset);
+      offset += sizeof(node_t) * l.nodes.size();
+      levels[i].bounds = offset = align(offset);
+      offset += sizeof(geometry_type) * l.bounds.size();
+      levels[i].children = offset = align(offset);
+      offset += sizeof(index_type) * l.children.size();
+    }
+    header.leaves = offset = align(offset);
+    offset += sizeof(node_t) * tree.leaves().size();
+    header.keys = offset = align(offset);
+    offset += sizeof(key_type) * tree.keys().size();
+    header.values = offset = align(offset);
+    offset += sizeof(mapped_type) * tree.values().size();
+    header.file_bytes = offset;
+
+    std::uint64_t at = 0;
+    write_section(out, at, 0, &header, 1);
+    write_section(out, at, at, levels.data(), levels.size());
+    for (std::size_t i = 0; i < levels.size(); ++i)
+    {
+      auto const& l = tree.levels()[i];
+      write_section(out, at, levels[i].nodes, l.nodes.data(), l.nodes.size());
+      write_section(out, at, levels[i].bounds, l.bounds.data(),
+                    l.bounds.size());
+      write_section(out, at, levels[i].children, l.children.data(),
+                    l.children.size());
+    }
+    write_section(out, at, header.leaves, tree.leaves().data(),
+                  tree.leaves().size());
+    write_section(out, at, header.keys, tree.keys().data(),
+                  tree.keys().size());
+    write_section(out, at, header.values, tree.values().data(),
+                  tree.values().size());
+    return out.good();
+  }
+  static bool write(TreeType const& tree, std::ostream& out)
+  {
+    return write(indexed_type(tree), out);
+  }
+
+  // map the file at `path`; returns false if it can't be mapped or is not
+  // a file of this TreeType
+  bool open(std::string const& path)
+  {
+    close();
+#if defined(__linux__)
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0)
+    {
+      ::close(fd);
+      return false;
+    }
+    void* p = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ,
+                   MAP_SHARED, fd, 0);
+    // the mapping keeps the file alive
+    ::close(fd);
+    if (p == MAP_FAILED)
+    {
+      return false;
+    }
+    _data = static_cast<unsigned char const*>(p);
+    _bytes = static_cast<std::size_t>(st.st_size);
+    _mapped = true;
+#else
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+      return false;
+    }
+    _buffer.assign(std::istreambuf_iterator<char>(file),
+                   std::istreambuf_iterator<char>());
+    _data = _buffer.data();
+    _bytes = _buffer.size();
+#endif
+    if (attach() == false)
+    {
+      close();
+      return false;
+    }
+    return true;
+  }
+  // use `bytes` bytes at `data`, aligned to SECTION_ALIGN, as the file;
+  // they must outlive this view
+  bool open(void const* data, std::size_t bytes)
+  {
+    close();
+    _data = static_cast<unsigned char const*>(data);
+    _bytes = bytes;
+    if (attach() == false)
+    {
+      close();
+      return false;
+    }
+    return true;
+  }
+  void close()
+  {
+#if defined(__linux__)
+    if (_mapped)
+    {
+      munmap(const_cast<unsigned char*>(_data), _bytes);
+    }
+#endif
+    _mapped = false;
+    _buffer.clear();
+    _data = nullptr;
+    _bytes = 0;
+    _levels.clear();
+    _leaves = nullptr;
+    _keys = nullptr;
+    _values = nullptr;
+    _leaf_count = 0;
+    _size = 0;
+  }
+
+  bool is_open() const
+  {
+    return _data != nullptr;
+  }
+  size_type size() const
+  {
+    return _size;
+  }
+  bool empty() const
+  {
+    return _size == 0;
+  }
+  int leaf_level() const
+  {
+    return static_cast<int>(_levels.size());
+  }
+
+protected:
+  template <bool Inside, typename _GeometryType, typename Functor>
+  bool search_wrapper(index_type node,
+                      int level,
+                      _GeometryType const& search_range,
+                      Functor& functor) const
+  {
+    if (level == leaf_level())
+    {
+      node_t const& leaf = _leaves[node];
+      for (index_type i = leaf.offset; i < leaf.offset + leaf.size; ++i)
+      {
+        const bool match = Inside ? traits::is_inside(search_range, _keys[i])
+                                  : traits::is_overlap(_keys[i], search_range);
+        if (match && functor(const_reference(_keys[i], _values[i])))
+        {
+          return true;
+        }
+      }
+      return false;
+    }
+    level_view_t const& l = _levels[level];
+    node_t const& n = l.nodes[node];
+    for (index_type i = n.offset; i < n.offset + n.size; ++i)
+    {
+      if (traits::is_overlap(l.bounds[i], search_range) == false)
+      {
+        continue;
+      }
+      if (search_wrapper<Inside>(l.children[i], level + 1, search_range,
+                                 functor))
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+public:
+  template <typename _GeometryType, typename Functor>
+  void search_overlap(_GeometryType const& search_range, Functor functor) const
+  {
+    if (_leaf_count == 0)
+    {
+      return;
+    }
+    search_wrapper<false>(0, 0, search_range, functor);
+  }
+  template <typename _GeometryType, typename Functor>
+  void search_inside(_GeometryType const& search_range, Functor functor) const
+  {
+    if (_leaf_count == 0)
+    {
+      return;
+    }
+    search_wrapper<true>(0, 0, search_range, functor);
+  }
+
+  // same as RTree::search_nearest; `functor` takes a const_reference
+  template <typename QueryType, typename Functor>
+  void search_nearest(QueryType const& query, size_type k, Functor functor) const
+  {
+    using distance_type = decltype(traits::min_distance(
+        std::declval<geometry_type const&>(), query));
+    struct candidate_t
+    {
+      distance_type distance;
+      index_type index;
+      // level of node `index`, or -1 if it is entry `index`
+      int level;
+
+      bool operator<(candidate_t const& rhs) const
+      {
+        return rhs.distance < distance;
+      }
+    };
+
+    if (k == 0 || _leaf_count == 0)
+    {
+      return;
+    }
+    std::vector<candidate_t> heap;
+    heap.push_back({ distance_type {}, 0, 0 });
+    while (heap.empty() == false)
+    {
+      std::pop_heap(heap.begin(), heap.end());
+      const candidate_t top = heap.back();
+      heap.pop_back();
+      if (top.level < 0)
+      {
+        if (functor(const_reference(_keys[top.index], _values[top.index]))
+            || --k == 0)
+        {
+          return;
+        }
+      }
+      else if (top.level == leaf_level())
+      {
+        node_t const& leaf = _leaves[top.index];
+        for (index_type i = leaf.offset; i < leaf.offset + leaf.size; ++i)
+        {
+          heap.push_back({ traits::min_distance(_keys[i], query), i, -1 });
+          std::push_heap(heap.begin(), heap.end());
+        }
+      }
+      else
+      {
+        level_view_t const& l = _levels[top.level];
+        node_t const& n = l.nodes[top.index];
+        for (index_type i = n.offset; i < n.offset + n.size; ++i)
+        {
+          heap.push_back({ traits::min_distance(l.bounds[i], query),
+                           l.children[i], top.level + 1 });
+          std::push_heap(heap.begin(), heap.end());
+        }
+      }
+    }
+  }
+};
+
+}
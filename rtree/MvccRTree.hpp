@@ -0,0 +1,549 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Global.hpp"
+#include "QuadraticSplit.hpp"
+#include "StaticVector.hpp"
+
+namespace rtree
+{
+
+struct mvcc_node_base_t
+{
+};
+
+/*
+ * mvcc_node_t is a node of an mvcc_rtree version: up to MaxEntry entries
+ * and no parent pointer, so a node can be shared by every version that
+ * did not change it. It offers the subset of the static_node_t interface
+ * quadratic_split_t uses.
+ * Nodes are immutable once a version referring to them is published.
+ */
+template <typename Value, size_type MinEntry, size_type MaxEntry>
+struct mvcc_node_t : mvcc_node_base_t
+{
+  using value_type = Value;
+  using size_type = ::rtree::size_type;
+  constexpr static size_type MIN_ENTRIES = MinEntry;
+  constexpr static size_type MAX_ENTRIES = MaxEntry;
+
+  static_vector<Value, MaxEntry> entries;
+
+  Value* begin()
+  {
+    return entries.begin();
+  }
+  Value const* begin() const
+  {
+    return entries.begin();
+  }
+  Value* end()
+  {
+    return entries.end();
+  }
+  Value const* end() const
+  {
+    return entries.end();
+  }
+  size_type size() const
+  {
+    return entries.size();
+  }
+  Value& at(size_type i)
+  {
+    return entries.at(i);
+  }
+  Value const& at(size_type i) const
+  {
+    return entries.at(i);
+  }
+  Value& back()
+  {
+    return entries.back();
+  }
+  void pop_back()
+  {
+    entries.pop_back();
+  }
+  void insert(Value value)
+  {
+    entries.push_back(std::move(value));
+  }
+  void erase(Value* pos)
+  {
+    std::move(pos + 1, end(), pos);
+    entries.pop_back();
+  }
+  void swap(size_type i, size_type j)
+  {
+    std::swap(at(i), at(j));
+  }
+};
+
+/*
+ * mvcc_rtree hands out immutable snapshots of an R-tree shaped like
+ * TreeType (an RTree instantiation, for its bound / key / mapped types and
+ * fanouts) so long-running scans never hold up writers.
+ * Nodes are reference counted and have no parent pointers. A write copies
+ * only the nodes on its root-to-leaf path (and the nodes a split or a
+ * deletion's reinsertion touches), shares every other node with the
+ * previous version, and publishes the new root as the current version.
+ * snapshot() is O(1) and only waits for another snapshot() or for a
+ * writer swapping in its finished root, never for a write in progress.
+ * Old versions, and the nodes only they use, are freed when their last
+ * snapshot goes away.
+ * Insertion and deletion follow RTree: RTree::choose_subtree picks the
+ * subtree, full nodes are split with quadratic_split_t, and underflowing
+ * nodes are removed on deletion and their entries reinserted at their
+ * level.
+ * Writers are serialised among themselves.
+ */
+template <typename TreeType>
+class mvcc_rtree
+{
+public:
+  using tree_type = TreeType;
+  using size_type = ::rtree::size_type;
+  using geometry_type = typename TreeType::geometry_type;
+  using traits = typename TreeType::traits;
+  using key_type = typename TreeType::key_type;
+  using mapped_type = typename TreeType::mapped_type;
+  using value_type = typename TreeType::value_type;
+  using child_ptr = std::shared_ptr<mvcc_node_base_t const>;
+  using node_entry_type = std::pair<geometry_type, child_ptr>;
+  using node_type = mvcc_node_t<node_entry_type,
+                                TreeType::MIN_ENTRIES,
+                                TreeType::MAX_ENTRIES>;
+  using leaf_type = mvcc_node_t<value_type,
+                                TreeType::MIN_LEAF_ENTRIES,
+                                TreeType::MAX_LEAF_ENTRIES>;
+
+  // one version of the tree; never changes once published
+  class version_t
+  {
+    friend class mvcc_rtree;
+
+    child_ptr _root;
+    // levels above the leaves; 0 when the root is a leaf
+    int _height = 0;
+    size_type _size = 0;
+
+    template <bool Inside, typename _GeometryType, typename Functor>
+    static bool search_wrapper(mvcc_node_base_t const* node,
+                               int height,
+                               _GeometryType const& search_range,
+                               Functor& functor)
+    {
+      if (height == 0)
+      {
+        for (value_type const& c : *static_cast<leaf_type const*>(node))
+        {
+          const bool match = Inside
+                                 ? traits::is_inside(search_range, c.first)
+                                 : traits::is_overlap(c.first, search_range);
+          if (match && functor(c))
+          {
+            return true;
+          }
+        }
+        return false;
+      }
+      for (node_entry_type const& c : *static_cast<node_type const*>(node))
+      {
+        if (traits::is_overlap(c.first, search_range) == false)
+        {
+          continue;
+        }
+        if (search_wrapper<Inside>(c.second.get(), height - 1, search_range,
+                                   functor))
+        {
+          return true;
+        }
+      }
+      return false;
+    }
+    template <typename Functor>
+    static bool for_each_wrapper(mvcc_node_base_t const* node,
+                                 int height,
+                                 Functor& functor)
+    {
+      if (height == 0)
+      {
+        for (value_type const& c : *static_cast<leaf_type const*>(node))
+        {
+          if (functor(c))
+          {
+            return true;
+          }
+        }
+        return false;
+      }
+      for (node_entry_type const& c : *static_cast<node_type const*>(node))
+      {
+        if (for_each_wrapper(c.second.get(), height - 1, functor))
+        {
+          return true;
+        }
+      }
+      return false;
+    }
+
+  public:
+    template <typename _GeometryType, typename Functor>
+    void search_overlap(_GeometryType const& search_range,
+                        Functor functor) const
+    {
+      search_wrapper<false>(_root.get(), _height, search_range, functor);
+    }
+    template <typename _GeometryType, typename Functor>
+    void search_inside(_GeometryType const& search_range,
+                       Functor functor) const
+    {
+      search_wrapper<true>(_root.get(), _height, search_range, functor);
+    }
+    // `functor(value_type const&)` for every entry; returning true stops
+    template <typename Functor>
+    void for_each(Functor functor) const
+    {
+      for_each_wrapper(_root.get(), _height, functor);
+    }
+
+    size_type size() const
+    {
+      return _size;
+    }
+    bool empty() const
+    {
+      return _size == 0;
+    }
+    int leaf_level() const
+    {
+      return _height;
+    }
+  };
+  using snapshot_type = std::shared_ptr<version_t const>;
+
+protected:
+  // a node unlinked by a deletion, `height` levels above the leaves
+  struct orphan_t
+  {
+    child_ptr node;
+    int height;
+  };
+
+  snapshot_type _current;
+  // guards _current
+  mutable std::mutex _mutex;
+  // serialises writers
+  std::mutex _write_mutex;
+
+  static node_type const* as_node(mvcc_node_base_t const* node)
+  {
+    return static_cast<node_type const*>(node);
+  }
+  static leaf_type const* as_leaf(mvcc_node_base_t const* node)
+  {
+    return static_cast<leaf_type const*>(node);
+  }
+
+  template <typename NodeType>
+  static geometry_type bound_of(NodeType const& node)
+  {
+    geometry_type bound = node.at(0).first;
+    for (size_type i = 1; i < node.size(); ++i)
+    {
+      bound = traits::merge(bound, node.at(i).first);
+    }
+    return bound;
+  }
+  static geometry_type bound_of(child_ptr const& node, int height)
+  {
+    if (height == 0)
+    {
+      return bound_of(*as_leaf(node.get()));
+    }
+    return bound_of(*as_node(node.get()));
+  }
+
+  // add `entry` to `node`, splitting it into a new node if it is full;
+  // `bound` receives the new bound of `node`, `pair` the new sibling
+  template <typename NodeType>
+  static void add(NodeType& node,
+                  typename NodeType::value_type entry,
+                  geometry_type& bound,
+                  std::optional<node_entry_type>& pair)
+  {
+    if (node.size() < NodeType::MAX_ENTRIES)
+    {
+      node.insert(std::move(entry));
+      bound = bound_of(node);
+      pair.reset();
+      return;
+    }
+    auto sibling = std::make_shared<NodeType>();
+    quadratic_split_t<TreeType> splitter;
+    splitter(&node, std::move(entry), sibling.get());
+    bound = bound_of(node);
+    pair = node_entry_type(bound_of(*sibling), std::move(sibling));
+  }
+
+  // copy of the subtree `node`, `height` levels above the leaves, with
+  // `entry` added to a node `target` levels above the leaves
+  template <typename Entry>
+  static child_ptr insert_copy(mvcc_node_base_t const* node,
+                               int height,
+                               int target,
+                               Entry entry,
+                               geometry_type& bound,
+                               std::optional<node_entry_type>& pair)
+  {
+    if (height == target)
+    {
+      if constexpr (std::is_same<Entry, value_type>::value)
+      {
+        auto copy = std::make_shared<leaf_type>(*as_leaf(node));
+        add(*copy, std::move(entry), bound, pair);
+        return copy;
+      }
+      else
+      {
+        auto copy = std::make_shared<node_type>(*as_node(node));
+        add(*copy, std::move(entry), bound, pair);
+        return copy;
+      }
+    }
+    node_type const* n = as_node(node);
+    auto chosen = TreeType::choose_subtree(n->begin(), n->end(), entry.first);
+    const size_type index = static_cast<size_type>(chosen - n->begin());
+    geometry_type child_bound = entry.first;
+    std::optional<node_entry_type> child_pair;
+    child_ptr child = insert_copy(chosen->second.get(), height - 1, target,
+                                  std::move(entry), child_bound, child_pair);
+    auto copy = std::make_shared<node_type>(*n);
+    copy->at(index) = node_entry_type(child_bound, std::move(child));
+    if (child_pair)
+    {
+      add(*copy, std::move(*child_pair), bound, pair);
+    }
+    else
+    {
+      bound = bound_of(*copy);
+      pair.reset();
+    }
+    return copy;
+  }
+
+  // insert into `version`, which is not published yet
+  template <typename Entry>
+  static void insert_at(version_t& version, Entry entry, int target)
+  {
+    geometry_type bound = entry.first;
+    std::optional<node_entry_type> pair;
+    child_ptr root = insert_copy(version._root.get(), version._height, target,
+                                 std::move(entry), bound, pair);
+    if (pair)
+    {
+      // root split
+      auto grown = std::make_shared<node_type>();
+      grown->insert(node_entry_type(bound, std::move(root)));
+      grown->insert(std::move(*pair));
+      root = std::move(grown);
+      ++version._height;
+    }
+    version._root = std::move(root);
+  }
+
+  // copy of the subtree `node` without the entry whose mapped value equals
+  // `entrie`'s, searching the leaves `entrie.first` overlaps; false if
+  // there is none. `copy` is null if the copy underflowed and was moved to
+  // `orphans` instead
+  static bool erase_copy(mvcc_node_base_t const* node,
+                         int height,
+                         bool is_root,
+                         value_type const& entrie,
+                         child_ptr& copy,
+                         std::vector<orphan_t>& orphans)
+  {
+    if (height == 0)
+    {
+      leaf_type const* leaf = as_leaf(node);
+      for (size_type i = 0; i < leaf->size(); ++i)
+      {
+        if (leaf->at(i).second == entrie.second)
+        {
+          auto c = std::make_shared<leaf_type>(*leaf);
+          c->erase(c->begin() + i);
+          if (is_root == false && c->size() < leaf_type::MIN_ENTRIES)
+          {
+            orphans.push_back({ std::move(c), 0 });
+            copy.reset();
+          }
+          else
+          {
+            copy = std::move(c);
+          }
+          return true;
+        }
+      }
+      return false;
+    }
+    node_type const* n = as_node(node);
+    for (size_type i = 0; i < n->size(); ++i)
+    {
+      if (traits::is_overlap(n->at(i).first, entrie.first) == false)
+      {
+        continue;
+      }
+      child_ptr child;
+      if (erase_copy(n->at(i).second.get(), height - 1, false, entrie, child,
+                     orphans)
+          == false)
+      {
+        continue;
+      }
+      auto c = std::make_shared<node_type>(*n);
+      if (child)
+      {
+        const geometry_type bound = bound_of(child, height - 1);
+        c->at(i) = node_entry_type(bound, std::move(child));
+      }
+      else
+      {
+        c->erase(c->begin() + i);
+      }
+      if (is_root == false && c->size() < node_type::MIN_ENTRIES)
+      {
+        orphans.push_back({ std::move(c), height });
+        copy.reset();
+      }
+      else
+      {
+        copy = std::move(c);
+      }
+      return true;
+    }
+    return false;
+  }
+
+  // publish `next` as the current version; the replaced one is released
+  // outside of the lock
+  void publish(snapshot_type next)
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _current.swap(next);
+    }
+  }
+
+  static snapshot_type empty_version()
+  {
+    auto version = std::make_shared<version_t>();
+    version->_root = std::make_shared<leaf_type>();
+    return version;
+  }
+
+public:
+  mvcc_rtree()
+      : _current(empty_version())
+  {
+  }
+  // start from the entries of `tree`
+  explicit mvcc_rtree(TreeType const& tree)
+  {
+    auto version = std::make_shared<version_t>(*empty_version());
+    for (value_type const& v : tree)
+    {
+      insert_at(*version, v, 0);
+      ++version->_size;
+    }
+    _current = std::move(version);
+  }
+  mvcc_rtree(mvcc_rtree const&) = delete;
+  mvcc_rtree& operator=(mvcc_rtree const&) = delete;
+
+  // immutable view of the current version; stays valid and unchanged
+  // for as long as it is held
+  snapshot_type snapshot() const
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _current;
+  }
+
+  void insert(value_type new_val)
+  {
+    std::lock_guard<std::mutex> write_lock(_write_mutex);
+    // only writers replace _current, and they are serialised
+    auto next = std::make_shared<version_t>(*_current);
+    insert_at(*next, std::move(new_val), 0);
+    ++next->_size;
+    publish(std::move(next));
+  }
+  template <typename... Args>
+  void emplace(Args&&... args)
+  {
+    insert(value_type(std::forward<Args>(args)...));
+  }
+  // erase the entry whose mapped value equals `entrie`'s, searching the
+  // leaves `entrie.first` overlaps
+  void deleteEntrie(value_type const& entrie)
+  {
+    std::lock_guard<std::mutex> write_lock(_write_mutex);
+    auto next = std::make_shared<version_t>(*_current);
+    std::vector<orphan_t> orphans;
+    child_ptr root;
+    if (erase_copy(next->_root.get(), next->_height, true, entrie, root,
+                   orphans)
+        == false)
+    {
+      return;
+    }
+    next->_root = std::move(root);
+    --next->_size;
+    // a root left with a single child is replaced by that child
+    if (next->_height > 0 && as_node(next->_root.get())->size() == 1)
+    {
+      child_ptr child = as_node(next->_root.get())->at(0).second;
+      next->_root = std::move(child);
+      --next->_height;
+    }
+    // reinsert the entries of the unlinked nodes at their level; the
+    // subtrees they point to are shared, not copied
+    for (orphan_t const& orphan : orphans)
+    {
+      if (orphan.height == 0)
+      {
+        for (value_type const& v : *as_leaf(orphan.node.get()))
+        {
+          insert_at(*next, v, 0);
+        }
+      }
+      else
+      {
+        for (node_entry_type const& c : *as_node(orphan.node.get()))
+        {
+          insert_at(*next, c, orphan.height);
+        }
+      }
+    }
+    publish(std::move(next));
+  }
+  void clear()
+  {
+    std::lock_guard<std::mutex> write_lock(_write_mutex);
+    publish(empty_version());
+  }
+
+  size_type size() const
+  {
+    return snapshot()->size();
+  }
+};
+
+}
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <cstddef>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "Global.hpp"
+#include "HugePageAllocator.hpp"
+#include "PoolAllocator.hpp"
+
+namespace rtree {
+
+/*
+ * numa_topology_t maps cpus to NUMA nodes.
+ * detect() reads /sys/devices/system/node on Linux and falls back to a
+ * single node elsewhere. simulated() splits the cpus of this machine into
+ * `nodes` equal blocks, so NUMA code paths can be exercised on a single
+ * node box.
+ * node_of_current_thread() can be overridden per thread with bind_thread().
+ */
+class numa_topology_t {
+protected:
+  size_type _nodes = 1;
+  // node of every cpu
+  std::vector<int> _cpu_node;
+
+  static int& thread_override() {
+    thread_local int node = -1;
+    return node;
+  }
+  // "0-3,8,10-11" -> callback for every cpu
+  template <typename Functor>
+  static void parse_cpulist(std::string const& list, Functor functor) {
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+      if (range.empty()) {
+        continue;
+      }
+      const std::size_t dash = range.find('-');
+      const int first = std::stoi(range.substr(0, dash));
+      const int last
+          = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+      for (int cpu = first; cpu <= last; ++cpu) {
+        functor(cpu);
+      }
+    }
+  }
+  static int current_cpu() {
+#if defined(__linux__)
+    return sched_getcpu();
+#else
+    return -1;
+#endif
+  }
+
+public:
+  numa_topology_t() = default;
+
+  static numa_topology_t detect() {
+    numa_topology_t ret;
+#if defined(__linux__)
+    for (int node = 0;; ++node) {
+      std::ifstream file("/sys/devices/system/node/node" + std::to_string(node)
+                         + "/cpulist");
+      if (!file) {
+        break;
+      }
+      std::string list;
+      std::getline(file, list);
+      parse_cpulist(list, [&](int cpu) {
+        if (cpu >= static_cast<int>(ret._cpu_node.size())) {
+          ret._cpu_node.resize(cpu + 1, 0);
+        }
+        ret._cpu_node[cpu] = node;
+      });
+      ret._nodes = static_cast<size_type>(node + 1);
+    }
+#endif
+    return ret;
+  }
+  // `nodes` nodes, each owning an equal block of `cpus` cpus
+  static numa_topology_t simulated(size_type nodes, size_type cpus) {
+    numa_topology_t ret;
+    ret._nodes = nodes > 0 ? nodes : 1;
+    const size_type per_node = (cpus + ret._nodes - 1) / ret._nodes;
+    for (size_type cpu = 0; cpu < cpus; ++cpu) {
+      ret._cpu_node.push_back(static_cast<int>(cpu / (per_node ? per_node : 1)));
+    }
+    return ret;
+  }
+
+  size_type node_count() const {
+    return _nodes;
+  }
+  int node_of_cpu(int cpu) const {
+    if (cpu < 0 || cpu >= static_cast<int>(_cpu_node.size())) {
+      return 0;
+    }
+    return _cpu_node[cpu];
+  }
+  // node the calling thread runs on, or the one it is bound to
+  int node_of_current_thread() const {
+    const int bound = thread_override();
+    if (bound >= 0) {
+      return bound % static_cast<int>(_nodes);
+    }
+    return node_of_cpu(current_cpu());
+  }
+  // treat the calling thread as running on `node`; -1 to undo
+  static void bind_thread(int node) {
+    thread_override() = node;
+  }
+};
+
+/*
+ * numa_arena_t is a huge_page_arena_t whose regions are bound to one NUMA
+ * node with mbind(MPOL_PREFERRED), issued as a raw syscall so libnuma is
+ * not needed. Regions are bound before any of their pages is touched.
+ * If the kernel refuses (no such node, no NUMA support, non-Linux) the
+ * region keeps the default first-touch policy; bound_region_count() tells
+ * how many regions were bound.
+ */
+class numa_arena_t : public huge_page_arena_t {
+public:
+  struct options_type {
+    // NUMA node to bind to; -1 leaves the default policy
+    int node = -1;
+    huge_page_arena_t::options_type pages;
+  };
+
+protected:
+  int _node = -1;
+  size_type _bound_regions = 0;
+
+  void bind(region_t const& r) {
+#if defined(__linux__) && defined(SYS_mbind)
+    if (_node < 0 || r.mapped == false) {
+      return;
+    }
+    // from <linux/mempolicy.h>
+    constexpr int MPOL_PREFERRED_ = 1;
+    constexpr std::size_t MASK_BITS = 8 * sizeof(unsigned long);
+    unsigned long mask[1024 / MASK_BITS] = {};
+    if (static_cast<std::size_t>(_node) >= 1024) {
+      return;
+    }
+    mask[_node / MASK_BITS] = 1ul << (_node % MASK_BITS);
+    if (syscall(SYS_mbind, r.addr, r.bytes, MPOL_PREFERRED_, mask,
+                static_cast<unsigned long>(1024), 0u) == 0) {
+      ++_bound_regions;
+    }
+#else
+    (void)r;
+#endif
+  }
+
+public:
+  numa_arena_t() = default;
+  explicit numa_arena_t(options_type const& options)
+      : huge_page_arena_t(options.pages)
+      , _node(options.node)
+  {
+  }
+
+  void* allocate_slab(std::size_t bytes) {
+    const std::size_t regions = _regions.size();
+    void* slab = huge_page_arena_t::allocate_slab(bytes);
+    if (_regions.size() != regions) {
+      bind(_regions.back());
+    }
+    return slab;
+  }
+
+  int node() const {
+    return _node;
+  }
+  size_type bound_region_count() const {
+    return _bound_regions;
+  }
+};
+
+// slab pool allocator whose slabs live on one NUMA node
+// e.g. RTree<..., rtree::numa_allocator>, constructed with
+// numa_allocator<T>(slab_size, { node })
+template <typename T>
+using numa_allocator = basic_pool_allocator<T, numa_arena_t>;
+
+// allocator of type `Alloc` placing its memory on `node`, if it can
+template <typename Alloc>
+struct numa_local_allocator {
+  static Alloc make(int) {
+    return Alloc();
+  }
+};
+template <typename T>
+struct numa_local_allocator<numa_allocator<T>> {
+  static numa_allocator<T> make(int node) {
+    numa_arena_t::options_type options;
+    options.node = node;
+    return numa_allocator<T>(numa_allocator<T>::DEFAULT_SLAB_SIZE, options);
+  }
+};
+
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <utility>
+#include <vector>
+
+#include "ConcurrentRTree.hpp"
+#include "Global.hpp"
+#include "NumaAllocator.hpp"
+
+namespace rtree
+{
+
+/*
+ * numa_replicated_rtree keeps one replica of a TreeType (an RTree
+ * instantiation) per NUMA node, so queries never cross the socket
+ * interconnect.
+ * Each replica is cloned with an allocator from
+ * numa_local_allocator<TreeType::allocator_type<value_type>>::make(node);
+ * with rtree::numa_allocator its nodes live on that node, with other
+ * allocators replicas are plain copies.
+ * Queries go to the replica of the node the calling thread runs on
+ * (numa_topology_t::node_of_current_thread). Writes are queued and applied
+ * to every replica in batches of `batch_size`, or on flush(); queries see
+ * a write only once its batch has been applied.
+ * Functors passed to the queries run while a replica lock is held and must
+ * not call back into this object.
+ */
+template <typename TreeType, typename MutexType = distributed_shared_mutex>
+class numa_replicated_rtree
+{
+public:
+  using tree_type = TreeType;
+  using mutex_type = MutexType;
+  using size_type = typename TreeType::size_type;
+  using value_type = typename TreeType::value_type;
+  using allocator_type =
+      typename TreeType::template allocator_type<value_type>;
+
+  constexpr static size_type DEFAULT_BATCH_SIZE = 1024;
+
+protected:
+  struct replica_t
+  {
+    TreeType tree;
+    mutable MutexType mutex;
+
+    replica_t(TreeType const& source, allocator_type const& alloc)
+        : tree(source, alloc)
+    {
+    }
+  };
+  struct op_t
+  {
+    bool insert;
+    value_type value;
+  };
+
+  numa_topology_t _topology;
+  std::vector<std::unique_ptr<replica_t>> _replicas;
+  size_type _batch_size;
+
+  // writes not yet applied to the replicas
+  std::vector<op_t> _pending;
+  std::mutex _pending_mutex;
+  // serialises batches so replicas see them in the same order
+  std::mutex _flush_mutex;
+
+  replica_t const& local() const
+  {
+    return *_replicas[static_cast<size_type>(
+                          _topology.node_of_current_thread())
+                      % _replicas.size()];
+  }
+  void push(bool insert, value_type value)
+  {
+    bool full;
+    {
+      std::lock_guard<std::mutex> lock(_pending_mutex);
+      _pending.push_back({ insert, std::move(value) });
+      full = _pending.size() >= _batch_size;
+    }
+    if (full)
+    {
+      flush();
+    }
+  }
+
+public:
+  explicit numa_replicated_rtree(
+      TreeType const& source,
+      numa_topology_t topology = numa_topology_t::detect(),
+      size_type batch_size = DEFAULT_BATCH_SIZE)
+      : _topology(std::move(topology))
+      , _batch_size(batch_size > 0 ? batch_size : 1)
+  {
+    for (size_type node = 0; node < _topology.node_count(); ++node)
+    {
+      _replicas.emplace_back(new replica_t(
+          source,
+          numa_local_allocator<allocator_type>::make(static_cast<int>(node))));
+    }
+  }
+  numa_replicated_rtree(numa_replicated_rtree const&) = delete;
+  numa_replicated_rtree& operator=(numa_replicated_rtree const&) = delete;
+
+  void insert(value_type new_val)
+  {
+    push(true, std::move(new_val));
+  }
+  template <typename... Args>
+  void emplace(Args&&... args)
+  {
+    insert(value_type(std::forward<Args>(args)...));
+  }
+  void deleteEntrie(value_type const& entrie)
+  {
+    push(false, entrie);
+  }
+  // apply every queued write to all replicas
+  void flush()
+  {
+    std::lock_guard<std::mutex> flush_lock(_flush_mutex);
+    std::vector<op_t> batch;
+    {
+      std::lock_guard<std::mutex> lock(_pending_mutex);
+      batch.swap(_pending);
+    }
+    if (batch.empty())
+    {
+      return;
+    }
+    for (auto& replica : _replicas)
+    {
+      std::unique_lock<MutexType> lock(replica->mutex);
+      for (op_t const& op : batch)
+      {
+        if (op.insert)
+        {
+          replica->tree.insert(op.value);
+        }
+        else
+        {
+          replica->tree.deleteEntrie(op.value);
+        }
+      }
+    }
+  }
+
+  template <typename _GeometryType, typename Functor>
+  void search_inside(_GeometryType const& search_range, Functor functor) const
+  {
+    replica_t const& r = local();
+    std::shared_lock<MutexType> lock(r.mutex);
+    r.tree.search_inside(search_range, functor);
+  }
+  template <typename _GeometryType, typename Functor>
+  void search_overlap(_GeometryType const& search_range, Functor functor) const
+  {
+    replica_t const& r = local();
+    std::shared_lock<MutexType> lock(r.mutex);
+    r.tree.search_overlap(search_range, functor);
+  }
+  size_type size() const
+  {
+    replica_t const& r = local();
+    std::shared_lock<MutexType> lock(r.mutex);
+    return r.tree.size();
+  }
+
+  numa_topology_t const& topology() const
+  {
+    return _topology;
+  }
+  size_type replica_count() const
+  {
+    return static_cast<size_type>(_replicas.size());
+  }
+  // run `functor(tree_type const&)` on the replica of `node` under its
+  // shared lock
+  template <typename Functor>
+  decltype(auto) read(size_type node, Functor functor) const
+  {
+    replica_t const& r = *_replicas[node];
+    std::shared_lock<MutexType> lock(r.mutex);
+    return functor(static_cast<TreeType const&>(r.tree));
+  }
+};
+
+}
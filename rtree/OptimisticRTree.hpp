@@ -0,0 +1,635 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "ConcurrentRTree.hpp"
+#include "Global.hpp"
+#include "StaticVector.hpp"
+
+namespace rtree
+{
+
+/*
+ * version_lock_t is a version counter whose lowest bit is a lock bit.
+ * Optimistic readers remember the version, read the protected data and
+ * validate that the version is unchanged afterwards. Writers lock by moving
+ * the version they read to the locked state, so locking fails if anything
+ * was written since; unlock publishes the next version.
+ */
+class version_lock_t
+{
+public:
+  using version_type = std::uint64_t;
+
+protected:
+  std::atomic<version_type> _word { 0 };
+
+public:
+  // wait until unlocked and return the current version
+  version_type read_begin() const
+  {
+    version_type v = _word.load(std::memory_order_acquire);
+    while (v & 1)
+    {
+      std::this_thread::yield();
+      v = _word.load(std::memory_order_acquire);
+    }
+    return v;
+  }
+  // true if nothing was written since read_begin() returned `v`
+  bool validate(version_type v) const
+  {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return _word.load(std::memory_order_relaxed) == v;
+  }
+  // lock if the version is still `v`
+  bool try_lock(version_type v)
+  {
+    if (_word.compare_exchange_strong(v, v | 1, std::memory_order_acquire))
+    {
+      std::atomic_thread_fence(std::memory_order_release);
+      return true;
+    }
+    return false;
+  }
+  void unlock()
+  {
+    _word.fetch_add(1, std::memory_order_release);
+  }
+};
+
+/*
+ * version_table_t is a striped table of version locks indexed by object
+ * address, for guarding objects (tree nodes) that have no room for a lock
+ * of their own. Objects sharing a stripe share a lock.
+ */
+class version_table_t
+{
+public:
+  constexpr static int STRIPE_BITS = 12;
+  constexpr static size_type STRIPES = size_type(1) << STRIPE_BITS;
+
+protected:
+  std::unique_ptr<version_lock_t[]> _locks;
+
+public:
+  version_table_t()
+      : _locks(new version_lock_t[STRIPES])
+  {
+  }
+
+  // multiplicative hash of an address; the high bits are well mixed
+  static std::uint64_t hash(void const* p)
+  {
+    return static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(p))
+           * 0x9E3779B97F4A7C15ull;
+  }
+
+  version_lock_t& operator()(void const* p) const
+  {
+    return _locks[hash(p) >> (64 - STRIPE_BITS)];
+  }
+};
+
+/*
+ * version_lock_set_t holds the version locks taken by one optimistic write,
+ * at most N of them. Acquiring a lock that is already held (two nodes
+ * sharing a stripe) succeeds if it was read at the version it was locked at.
+ */
+template <size_type N>
+struct version_lock_set_t
+{
+  using version_type = version_lock_t::version_type;
+
+  version_lock_t* locks[N];
+  version_type versions[N];
+  int count = 0;
+
+  // lock `lock` if it is still at version `v`
+  bool acquire(version_lock_t& lock, version_type v)
+  {
+    for (int i = 0; i < count; ++i)
+    {
+      if (locks[i] == &lock)
+      {
+        return versions[i] == v;
+      }
+    }
+    assert(count < int(N));
+    if (lock.try_lock(v) == false)
+    {
+      return false;
+    }
+    locks[count] = &lock;
+    versions[count] = v;
+    ++count;
+    return true;
+  }
+  // lock `lock`, waiting for other writers
+  void acquire(version_lock_t& lock)
+  {
+    for (int i = 0; i < count; ++i)
+    {
+      if (locks[i] == &lock)
+      {
+        return;
+      }
+    }
+    assert(count < int(N));
+    version_type v = lock.read_begin();
+    while (lock.try_lock(v) == false)
+    {
+      std::this_thread::yield();
+      v = lock.read_begin();
+    }
+    locks[count] = &lock;
+    versions[count] = v;
+    ++count;
+  }
+  bool validate(version_lock_t const& lock, version_type v) const
+  {
+    for (int i = 0; i < count; ++i)
+    {
+      if (locks[i] == &lock)
+      {
+        return versions[i] == v;
+      }
+    }
+    return lock.validate(v);
+  }
+  void release()
+  {
+    for (int i = 0; i < count; ++i)
+    {
+      locks[i]->unlock();
+    }
+    count = 0;
+  }
+};
+
+/*
+ * olc_rtree lets several writer threads insert and erase concurrently,
+ * using optimistic lock coupling on top of a TreeType (an RTree
+ * instantiation).
+ * Every node is guarded by a version_lock_t. The locks live in a striped
+ * table indexed by node address rather than in the nodes themselves, so
+ * RTree's node layout is unchanged; two nodes sharing a stripe only cause
+ * spurious retries.
+ * - Queries never lock nodes: they copy each node, validate its version and
+ *   start over if a write got in between. Matches are collected and handed
+ *   to the functor once the whole search has validated.
+ * - insert descends optimistically with choose_subtree and locks only the
+ *   leaf, plus the ancestors whose entry has to grow to cover the new key.
+ *   A leaf split also locks the parent, if the parent has room for the new
+ *   sibling.
+ * - deleteEntrie locks only the leaf, if it does not underflow. Bounds of
+ *   the ancestors are left as they are (still covering, maybe not tight).
+ * Anything else (root or internal splits, condensing after an underflow)
+ * falls back to RTree's own insert_node / deleteEntrie while holding the
+ * structure lock exclusively, as does any operation that keeps failing
+ * validation. Optimistic operations hold the structure lock shared, which
+ * also keeps nodes from being freed under an optimistic reader.
+ * Entries are read while they may be written, so value_type must be
+ * bitwise copyable; store large payloads through hot_cold_rtree_t or by id.
+ */
+template <typename TreeType, typename MutexType = distributed_shared_mutex>
+class olc_rtree : protected TreeType
+{
+  using base_type = TreeType;
+
+public:
+  using tree_type = TreeType;
+  using mutex_type = MutexType;
+  using size_type = typename TreeType::size_type;
+  using geometry_type = typename TreeType::geometry_type;
+  using traits = typename TreeType::traits;
+  using key_type = typename TreeType::key_type;
+  using mapped_type = typename TreeType::mapped_type;
+  using value_type = typename TreeType::value_type;
+  using node_base_type = typename TreeType::node_base_type;
+  using node_type = typename TreeType::node_type;
+  using leaf_type = typename TreeType::leaf_type;
+  using version_type = version_lock_t::version_type;
+
+  // optimistic attempts before an operation takes the exclusive path
+  constexpr static int MAX_RETRIES = 8;
+  constexpr static int MAX_DEPTH = 64;
+
+  static_assert(is_bitwise_copyable<value_type>::value,
+                "olc_rtree requires bitwise copyable key and mapped types");
+
+protected:
+  using node_entries_type
+      = static_vector<typename node_type::value_type, node_type::MAX_ENTRIES>;
+  using leaf_entries_type
+      = static_vector<typename leaf_type::value_type, leaf_type::MAX_ENTRIES>;
+
+  enum class attempt_t
+  {
+    done,
+    retry,
+    exclusive
+  };
+
+  // internal node visited by an optimistic insert
+  struct path_entry_t
+  {
+    node_base_type* node;
+    version_type version;
+    // chosen child and its bound, as read
+    size_type index;
+    geometry_type bound;
+  };
+
+  // leaf entry found by an optimistic lookup
+  struct found_t
+  {
+    leaf_type* leaf = nullptr;
+    version_type version = 0;
+    size_type index = 0;
+  };
+
+  version_table_t _versions;
+  // shared for optimistic operations, exclusive for the fallback path
+  mutable MutexType _structure;
+  // guards the node allocators during optimistic splits
+  std::mutex _alloc_mutex;
+
+  version_lock_t& version_of(node_base_type const* node) const
+  {
+    return _versions(node);
+  }
+
+  // append the entries below `node` that match `search_range` to `out`
+  // returns false if a concurrent write was detected
+  template <bool Inside, typename _GeometryType>
+  bool collect(node_base_type const* node,
+               int level,
+               _GeometryType const& search_range,
+               std::vector<value_type>& out) const
+  {
+    version_lock_t const& lock = version_of(node);
+    const version_type v = lock.read_begin();
+    if (level == this->_leaf_level)
+    {
+      const leaf_entries_type entries(node->as_leaf()->_children);
+      if (lock.validate(v) == false)
+      {
+        return false;
+      }
+      for (size_type i = 0; i < entries.size(); ++i)
+      {
+        value_type const& c = entries[i];
+        if (Inside ? traits::is_inside(search_range, c.first)
+                   : traits::is_overlap(c.first, search_range))
+        {
+          out.push_back(c);
+        }
+      }
+      return true;
+    }
+    const node_entries_type entries(node->as_node()->_children);
+    if (lock.validate(v) == false)
+    {
+      return false;
+    }
+    for (size_type i = 0; i < entries.size(); ++i)
+    {
+      if (traits::is_overlap(entries[i].first, search_range) == false)
+      {
+        continue;
+      }
+      if (collect<Inside>(entries[i].second, level + 1, search_range, out)
+          == false)
+      {
+        return false;
+      }
+    }
+    // a leaf split below moves entries to a new entry of this node
+    return lock.validate(v);
+  }
+
+  template <bool Inside, typename _GeometryType>
+  void collect_all(_GeometryType const& search_range,
+                   std::vector<value_type>& out) const
+  {
+    {
+      std::shared_lock<MutexType> lock(_structure);
+      for (int attempt = 0; attempt < MAX_RETRIES; ++attempt)
+      {
+        out.clear();
+        if (collect<Inside>(this->_root, 0, search_range, out))
+        {
+          return;
+        }
+      }
+    }
+    std::unique_lock<MutexType> lock(_structure);
+    out.clear();
+    const bool validated
+        = collect<Inside>(this->_root, 0, search_range, out);
+    assert(validated);
+    (void)validated;
+  }
+
+  template <bool Inside, typename _GeometryType, typename Functor>
+  void search(_GeometryType const& search_range, Functor& functor) const
+  {
+    std::vector<value_type> found;
+    collect_all<Inside>(search_range, found);
+    for (value_type const& c : found)
+    {
+      if (functor(c))
+      {
+        return;
+      }
+    }
+  }
+
+  attempt_t try_insert(value_type const& new_val)
+  {
+    const int leaf_level = this->_leaf_level;
+    assert(leaf_level < MAX_DEPTH);
+    static_vector<path_entry_t, MAX_DEPTH> path;
+
+    node_base_type* node = this->_root;
+    for (int level = 0; level < leaf_level; ++level)
+    {
+      version_lock_t const& lock = version_of(node);
+      const version_type v = lock.read_begin();
+      const node_entries_type entries(node->as_node()->_children);
+      if (lock.validate(v) == false)
+      {
+        return attempt_t::retry;
+      }
+      auto chosen = base_type::choose_subtree(entries.begin(), entries.end(),
+                                              new_val.first);
+      if (chosen == entries.end())
+      {
+        return attempt_t::retry;
+      }
+      path.emplace_back(path_entry_t {
+          node, v, static_cast<size_type>(chosen - entries.begin()),
+          chosen->first });
+      node = chosen->second;
+    }
+
+    leaf_type* leaf = node->as_leaf();
+    version_lock_t& leaf_lock = version_of(leaf);
+    version_lock_set_t<MAX_DEPTH + 1> locks;
+    if (locks.acquire(leaf_lock, leaf_lock.read_begin()) == false)
+    {
+      return attempt_t::retry;
+    }
+    // the parent's entry for the leaf is what was read, and can not shrink
+    // while the leaf is locked
+    if (leaf_level > 0
+        && locks.validate(version_of(path[leaf_level - 1].node),
+                          path[leaf_level - 1].version)
+               == false)
+    {
+      locks.release();
+      return attempt_t::retry;
+    }
+
+    const bool split = leaf->size() == leaf_type::MAX_ENTRIES;
+    if (split)
+    {
+      if (leaf_level == 0)
+      {
+        locks.release();
+        return attempt_t::exclusive;
+      }
+      path_entry_t const& p = path[leaf_level - 1];
+      if (locks.acquire(version_of(p.node), p.version) == false)
+      {
+        locks.release();
+        return attempt_t::retry;
+      }
+      if (p.node->as_node()->size() == node_type::MAX_ENTRIES)
+      {
+        locks.release();
+        return attempt_t::exclusive;
+      }
+    }
+
+    // lock ancestors whose entry does not cover the new key yet
+    // (entries above the leaf's parent only grow in optimistic mode)
+    const int first_grown = split ? leaf_level - 2 : leaf_level - 1;
+    int covered = first_grown;
+    for (; covered >= 0; --covered)
+    {
+      path_entry_t const& p = path[covered];
+      if (traits::is_inside(p.bound, new_val.first))
+      {
+        break;
+      }
+      if (locks.acquire(version_of(p.node), p.version) == false)
+      {
+        locks.release();
+        return attempt_t::retry;
+      }
+    }
+
+    if (split)
+    {
+      leaf_type* pair;
+      {
+        std::lock_guard<std::mutex> alloc_lock(_alloc_mutex);
+        pair = this->template construct_node<leaf_type>(leaf);
+      }
+      base_type::split(leaf, new_val, pair);
+      path_entry_t const& p = path[leaf_level - 1];
+      node_type* parent = p.node->as_node();
+      parent->at(p.index).first = leaf->calculate_bound();
+      parent->insert({ pair->calculate_bound(), pair });
+    }
+    else
+    {
+      leaf->insert(new_val);
+    }
+    for (int level = first_grown; level > covered; --level)
+    {
+      auto& entry = path[level].node->as_node()->at(path[level].index);
+      entry.first = traits::merge(entry.first, new_val.first);
+    }
+    locks.release();
+    return attempt_t::done;
+  }
+
+  // optimistic findLeaf
+  // returns false if a concurrent write was detected
+  bool find(node_base_type* node,
+            int level,
+            value_type const& entrie,
+            found_t& found) const
+  {
+    version_lock_t const& lock = version_of(node);
+    const version_type v = lock.read_begin();
+    if (level == this->_leaf_level)
+    {
+      const leaf_entries_type entries(node->as_leaf()->_children);
+      if (lock.validate(v) == false)
+      {
+        return false;
+      }
+      for (size_type i = 0; i < entries.size(); ++i)
+      {
+        if (entries[i].second == entrie.second)
+        {
+          found.leaf = node->as_leaf();
+          found.version = v;
+          found.index = i;
+          break;
+        }
+      }
+      return true;
+    }
+    const node_entries_type entries(node->as_node()->_children);
+    if (lock.validate(v) == false)
+    {
+      return false;
+    }
+    for (size_type i = 0; i < entries.size(); ++i)
+    {
+      if (traits::is_overlap(entries[i].first, entrie.first) == false)
+      {
+        continue;
+      }
+      if (find(entries[i].second, level + 1, entrie, found) == false)
+      {
+        return false;
+      }
+      if (found.leaf)
+      {
+        return true;
+      }
+    }
+    return lock.validate(v);
+  }
+
+  attempt_t try_erase(value_type const& entrie)
+  {
+    found_t found;
+    if (find(this->_root, 0, entrie, found) == false)
+    {
+      return attempt_t::retry;
+    }
+    if (found.leaf == nullptr)
+    {
+      return attempt_t::done;
+    }
+    version_lock_set_t<MAX_DEPTH + 1> locks;
+    if (locks.acquire(version_of(found.leaf), found.version) == false)
+    {
+      return attempt_t::retry;
+    }
+    if (this->_leaf_level > 0
+        && found.leaf->size() <= leaf_type::MIN_ENTRIES)
+    {
+      // condensing the tree is left to RTree::deleteEntrie
+      locks.release();
+      return attempt_t::exclusive;
+    }
+    found.leaf->erase(found.leaf->begin() + found.index);
+    locks.release();
+    return attempt_t::done;
+  }
+
+public:
+  olc_rtree() = default;
+  explicit olc_rtree(TreeType tree)
+      : TreeType(std::move(tree))
+  {
+  }
+  olc_rtree(olc_rtree const&) = delete;
+  olc_rtree& operator=(olc_rtree const&) = delete;
+
+  void insert(value_type new_val)
+  {
+    {
+      std::shared_lock<MutexType> lock(_structure);
+      for (int attempt = 0; attempt < MAX_RETRIES; ++attempt)
+      {
+        const attempt_t result = try_insert(new_val);
+        if (result == attempt_t::done)
+        {
+          return;
+        }
+        if (result == attempt_t::exclusive)
+        {
+          break;
+        }
+      }
+    }
+    std::unique_lock<MutexType> lock(_structure);
+    base_type::insert(std::move(new_val));
+  }
+  template <typename... Args>
+  void emplace(Args&&... args)
+  {
+    insert(value_type(std::forward<Args>(args)...));
+  }
+  void deleteEntrie(value_type const& entrie)
+  {
+    {
+      std::shared_lock<MutexType> lock(_structure);
+      for (int attempt = 0; attempt < MAX_RETRIES; ++attempt)
+      {
+        const attempt_t result = try_erase(entrie);
+        if (result == attempt_t::done)
+        {
+          return;
+        }
+        if (result == attempt_t::exclusive)
+        {
+          break;
+        }
+      }
+    }
+    std::unique_lock<MutexType> lock(_structure);
+    base_type::deleteEntrie(entrie);
+  }
+  void clear()
+  {
+    std::unique_lock<MutexType> lock(_structure);
+    base_type::clear();
+  }
+
+  // functors run after the search has finished, without any lock held,
+  // and receive a copy of each matching value
+  template <typename _GeometryType, typename Functor>
+  void search_inside(_GeometryType const& search_range, Functor functor) const
+  {
+    search<true>(search_range, functor);
+  }
+  template <typename _GeometryType, typename Functor>
+  void search_overlap(_GeometryType const& search_range, Functor functor) const
+  {
+    search<false>(search_range, functor);
+  }
+
+  // these run exclusively
+  size_type size() const
+  {
+    std::unique_lock<MutexType> lock(_structure);
+    return base_type::size();
+  }
+  // run `functor(tree_type&)` under the exclusive lock
+  template <typename Functor>
+  decltype(auto) write(Functor functor)
+  {
+    std::unique_lock<MutexType> lock(_structure);
+    return functor(static_cast<TreeType&>(*this));
+  }
+};
+
+}
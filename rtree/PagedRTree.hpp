@@ -0,0 +1,833 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "BufferPool.hpp"
+#include "GeometryTraits.hpp"
+#include "Global.hpp"
+#include "QuadraticSplit.hpp"
+#include "StaticVector.hpp"
+
+namespace rtree
+{
+
+/*
+ * page_node_t is the in-page image of a node: a small header followed by
+ * up to MaxEntry entries stored in place. It offers the subset of the
+ * static_node_t interface the split algorithms use, so
+ * quadratic_split_t runs on pages unchanged.
+ * Value must be bitwise copyable.
+ */
+template <typename Value, size_type MinEntry, size_type MaxEntry>
+struct page_node_t
+{
+  using value_type = Value;
+  using size_type = ::rtree::size_type;
+  constexpr static size_type MIN_ENTRIES = MinEntry;
+  constexpr static size_type MAX_ENTRIES = MaxEntry;
+
+  std::uint32_t count;
+  std::uint32_t reserved;
+  alignas(Value) unsigned char storage[sizeof(Value) * MaxEntry];
+
+  Value* begin()
+  {
+    return reinterpret_cast<Value*>(storage);
+  }
+  Value const* begin() const
+  {
+    return reinterpret_cast<Value const*>(storage);
+  }
+  Value* end()
+  {
+    return begin() + count;
+  }
+  Value const* end() const
+  {
+    return begin() + count;
+  }
+  size_type size() const
+  {
+    return count;
+  }
+  Value& at(size_type i)
+  {
+    return begin()[i];
+  }
+  Value const& at(size_type i) const
+  {
+    return begin()[i];
+  }
+  Value& back()
+  {
+    return begin()[count - 1];
+  }
+  void pop_back()
+  {
+    --count;
+  }
+  void insert(Value value)
+  {
+    assert(count < MaxEntry);
+    std::memcpy(static_cast<void*>(begin() + count), &value, sizeof(Value));
+    ++count;
+  }
+  void erase(Value* pos)
+  {
+    std::memmove(static_cast<void*>(pos), pos + 1,
+                 sizeof(Value) * (end() - pos - 1));
+    --count;
+  }
+  void swap(size_type i, size_type j)
+  {
+    std::swap(at(i), at(j));
+  }
+};
+
+/*
+ * paged_rtree keeps the nodes of a TreeType-shaped tree (an RTree
+ * instantiation, for its bound / key / mapped types and fanouts) in
+ * fixed-size pages of a file, cached by a buffer_pool_t of `frames`
+ * pages, so the tree can grow past memory.
+ * Nodes refer to their children by page number and have no parent
+ * pointers; operations remember the path they descended instead.
+ * Insertion and deletion follow RTree: RTree::choose_subtree picks the
+ * subtree, full nodes are split with quadratic_split_t, and underflowing
+ * nodes are removed on deletion and their entries reinserted at their
+ * level.
+ * Page 0 holds the tree's meta data; freed pages are chained in a free
+ * list. Changes reach the file when pages are evicted and on flush() or
+ * destruction. Operations return false on I/O errors. Not thread-safe.
+ */
+template <typename TreeType>
+class paged_rtree
+{
+public:
+  using tree_type = TreeType;
+  using size_type = ::rtree::size_type;
+  using geometry_type = typename TreeType::geometry_type;
+  using traits = typename TreeType::traits;
+  using key_type = typename TreeType::key_type;
+  using mapped_type = typename TreeType::mapped_type;
+  using value_type = typename TreeType::value_type;
+  using node_entry_type = std::pair<geometry_type, page_id_type>;
+  using node_page_type = page_node_t<node_entry_type,
+                                     TreeType::MIN_ENTRIES,
+                                     TreeType::MAX_ENTRIES>;
+  using leaf_page_type = page_node_t<value_type,
+                                     TreeType::MIN_LEAF_ENTRIES,
+                                     TreeType::MAX_LEAF_ENTRIES>;
+  using page_ref_type = buffer_pool_t::page_ref_t;
+
+  constexpr static std::uint32_t DEFAULT_PAGE_SIZE = 4096;
+  constexpr static size_type DEFAULT_FRAMES = 1024;
+
+  static_assert(is_bitwise_copyable<value_type>::value
+                    && is_bitwise_copyable<geometry_type>::value,
+                "paged_rtree stores entries as raw bytes");
+
+protected:
+  struct meta_t
+  {
+    constexpr static std::uint32_t MAGIC = 0x50525452; // "RTRP"
+    constexpr static std::uint32_t VERSION = 1;
+
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint32_t page_size;
+    std::uint32_t node_bytes;
+    std::uint32_t leaf_bytes;
+    // levels above the leaves; 0 when the root is a leaf
+    std::int32_t height;
+    page_id_type root;
+    page_id_type page_count;
+    page_id_type free_head;
+    std::uint32_t reserved;
+    std::uint64_t size;
+  };
+  // a step of a descent: internal node `page` and the entry taken
+  struct path_entry_t
+  {
+    page_id_type page;
+    size_type index;
+  };
+  using path_type = std::vector<path_entry_t>;
+
+  page_file_t _file;
+  mutable std::optional<buffer_pool_t> _pool;
+  meta_t _meta {};
+
+  static geometry_type bound_of(node_page_type const& node)
+  {
+    geometry_type bound = node.at(0).first;
+    for (size_type i = 1; i < node.size(); ++i)
+    {
+      bound = traits::merge(bound, node.at(i).first);
+    }
+    return bound;
+  }
+  static geometry_type bound_of(leaf_page_type const& leaf)
+  {
+    geometry_type bound = leaf.at(0).first;
+    for (size_type i = 1; i < leaf.size(); ++i)
+    {
+      bound = traits::merge(bound, leaf.at(i).first);
+    }
+    return bound;
+  }
+  // bound of the node in `page`, `height` levels above the leaves
+  std::optional<geometry_type> bound_of(page_id_type page, int height) const
+  {
+    page_ref_type ref = _pool->fetch(page);
+    if (!ref)
+    {
+      return std::nullopt;
+    }
+    if (height == 0)
+    {
+      return bound_of(*ref.as<leaf_page_type>());
+    }
+    return bound_of(*ref.as<node_page_type>());
+  }
+
+  page_ref_type allocate_page()
+  {
+    page_id_type page;
+    if (_meta.free_head != INVALID_PAGE)
+    {
+      page = _meta.free_head;
+      page_ref_type ref = _pool->fetch(page);
+      if (!ref)
+      {
+        return {};
+      }
+      std::memcpy(&_meta.free_head, ref.data(), sizeof(page_id_type));
+    }
+    else
+    {
+      page = _meta.page_count++;
+    }
+    return _pool->create(page);
+  }
+  bool free_page(page_id_type page)
+  {
+    page_ref_type ref = _pool->create(page);
+    if (!ref)
+    {
+      return false;
+    }
+    std::memcpy(ref.data(), &_meta.free_head, sizeof(page_id_type));
+    _meta.free_head = page;
+    return true;
+  }
+  bool write_meta()
+  {
+    page_ref_type ref = _pool->create(0);
+    if (!ref)
+    {
+      return false;
+    }
+    std::memcpy(ref.data(), &_meta, sizeof(_meta));
+    return true;
+  }
+
+  // add `entry` to `page`, splitting it into a new page if it is full;
+  // `bound` receives the new bound of `page`, `pair` the new sibling
+  template <typename PageType>
+  bool add(page_id_type page,
+           typename PageType::value_type entry,
+           geometry_type& bound,
+           std::optional<node_entry_type>& pair)
+  {
+    page_ref_type ref = _pool->fetch(page);
+    if (!ref)
+    {
+      return false;
+    }
+    PageType* node = ref.as<PageType>();
+    ref.mark_dirty();
+    if (node->size() < PageType::MAX_ENTRIES)
+    {
+      node->insert(std::move(entry));
+      bound = bound_of(*node);
+      pair.reset();
+      return true;
+    }
+    page_ref_type pair_ref = allocate_page();
+    if (!pair_ref)
+    {
+      return false;
+    }
+    PageType* pair_node = pair_ref.as<PageType>();
+    quadratic_split_t<TreeType> splitter;
+    splitter(node, std::move(entry), pair_node);
+    bound = bound_of(*node);
+    pair = node_entry_type(bound_of(*pair_node), pair_ref.page());
+    return true;
+  }
+
+  // insert `entry` into a node `height` levels above the leaves
+  template <typename Entry>
+  bool insert_at(Entry entry, int height)
+  {
+    path_type path;
+    page_id_type page = _meta.root;
+    for (int h = _meta.height; h > height; --h)
+    {
+      page_ref_type ref = _pool->fetch(page);
+      if (!ref)
+      {
+        return false;
+      }
+      node_page_type const* node = ref.as<node_page_type>();
+      auto chosen
+          = TreeType::choose_subtree(node->begin(), node->end(), entry.first);
+      path.push_back(
+          { page, static_cast<size_type>(chosen - node->begin()) });
+      page = chosen->second;
+    }
+
+    geometry_type bound = entry.first;
+    std::optional<node_entry_type> pair;
+    bool ok;
+    if constexpr (std::is_same<Entry, value_type>::value)
+    {
+      ok = add<leaf_page_type>(page, std::move(entry), bound, pair);
+    }
+    else
+    {
+      ok = add<node_page_type>(page, std::move(entry), bound, pair);
+    }
+    if (!ok)
+    {
+      return false;
+    }
+    return propagate(path, bound, pair);
+  }
+
+  // walk `path` up: refresh the bound of the child taken at every step and
+  // add the sibling of a split child, growing a new root if needed
+  bool propagate(path_type const& path,
+                 geometry_type bound,
+                 std::optional<node_entry_type> pair)
+  {
+    page_id_type child = path.empty() ? _meta.root : INVALID_PAGE;
+    for (size_type i = static_cast<size_type>(path.size()); i > 0; --i)
+    {
+      path_entry_t const& step = path[i - 1];
+      {
+        page_ref_type ref = _pool->fetch(step.page);
+        if (!ref)
+        {
+          return false;
+        }
+        ref.as<node_page_type>()->at(step.index).first = bound;
+        ref.mark_dirty();
+        if (!pair)
+        {
+          bound = bound_of(*ref.as<node_page_type>());
+          continue;
+        }
+      }
+      node_entry_type sibling = *pair;
+      if (!add<node_page_type>(step.page, sibling, bound, pair))
+      {
+        return false;
+      }
+    }
+    if (pair)
+    {
+      // root split
+      page_ref_type ref = allocate_page();
+      if (!ref)
+      {
+        return false;
+      }
+      node_page_type* root = ref.as<node_page_type>();
+      root->insert({ bound, path.empty() ? child : path.front().page });
+      root->insert(*pair);
+      _meta.root = ref.page();
+      ++_meta.height;
+    }
+    return true;
+  }
+
+  // find the leaf holding an entry whose mapped value equals `entrie`'s;
+  // on success `path` leads to `leaf` and `index` is the entry
+  bool find_leaf(page_id_type page,
+                 int height,
+                 value_type const& entrie,
+                 path_type& path,
+                 page_id_type& leaf,
+                 size_type& index) const
+  {
+    page_ref_type ref = _pool->fetch(page);
+    if (!ref)
+    {
+      return false;
+    }
+    if (height == 0)
+    {
+      leaf_page_type const* node = ref.as<leaf_page_type>();
+      for (size_type i = 0; i < node->size(); ++i)
+      {
+        if (node->at(i).second == entrie.second)
+        {
+          leaf = page;
+          index = i;
+          return true;
+        }
+      }
+      return false;
+    }
+    // copy the candidates so only one page per level stays pinned
+    std::vector<path_entry_t> children;
+    node_page_type const* node = ref.as<node_page_type>();
+    for (size_type i = 0; i < node->size(); ++i)
+    {
+      if (traits::is_overlap(node->at(i).first, entrie.first))
+      {
+        children.push_back({ node->at(i).second, i });
+      }
+    }
+    ref.release();
+    for (path_entry_t const& c : children)
+    {
+      path.push_back({ page, c.index });
+      if (find_leaf(c.page, height - 1, entrie, path, leaf, index))
+      {
+        return true;
+      }
+      path.pop_back();
+    }
+    return false;
+  }
+
+  // returns true once the search ends early, because `functor` stopped
+  // it or because a page could not be read (`failed` is then set)
+  template <bool Inside, typename _GeometryType, typename Functor>
+  bool search_wrapper(page_id_type page,
+                      int height,
+                      _GeometryType const& search_range,
+                      Functor& functor,
+                      bool& failed) const
+  {
+    page_ref_type ref = _pool->fetch(page);
+    if (!ref)
+    {
+      failed = true;
+      return true;
+    }
+    if (height == 0)
+    {
+      for (value_type const& c : *ref.as<leaf_page_type>())
+      {
+        const bool match = Inside ? traits::is_inside(search_range, c.first)
+                                  : traits::is_overlap(c.first, search_range);
+        if (match && functor(c))
+        {
+          return true;
+        }
+      }
+      return false;
+    }
+    for (node_entry_type const& c : *ref.as<node_page_type>())
+    {
+      if (traits::is_overlap(c.first, search_range) == false)
+      {
+        continue;
+      }
+      if (search_wrapper<Inside>(c.second, height - 1, search_range, functor,
+                                 failed))
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // queries of a batch walk the tree together, level by level; the pages
+  // a level needs are prefetched through `reader` before any is visited.
+  // returns false if some page could not be read
+  template <bool Inside, typename _GeometryType, typename Functor,
+            typename Reader>
+  bool search_level_order(_GeometryType const* first,
+                          _GeometryType const* last,
+                          Functor& functor,
+                          Reader& reader) const
+  {
+    // (page, query) pairs of the current and of the next level
+    std::vector<std::pair<page_id_type, size_type>> frontier, next;
+    std::vector<page_id_type> pages;
+    const size_type queries = static_cast<size_type>(last - first);
+    std::vector<bool> stopped(queries, false);
+    bool ok = true;
+    for (size_type q = 0; q < queries; ++q)
+    {
+      frontier.push_back({ _meta.root, q });
+    }
+    // prefetch at most half of the pool at a time so a chunk is not
+    // evicted before it is visited
+    const std::size_t chunk = _pool->frame_count() / 2;
+    for (int height = _meta.height; height >= 0 && frontier.empty() == false;
+         --height)
+    {
+      next.clear();
+      for (std::size_t begin = 0; begin < frontier.size(); begin += chunk)
+      {
+        const std::size_t end = std::min(frontier.size(), begin + chunk);
+        pages.clear();
+        for (std::size_t i = begin; i < end; ++i)
+        {
+          pages.push_back(frontier[i].first);
+        }
+        _pool->prefetch(pages.data(), pages.data() + pages.size(), reader);
+
+        for (std::size_t i = begin; i < end; ++i)
+        {
+          const size_type q = frontier[i].second;
+          if (stopped[q])
+          {
+            continue;
+          }
+          page_ref_type ref = _pool->fetch(frontier[i].first);
+          if (!ref)
+          {
+            // the query can not be completed; the others go on
+            stopped[q] = true;
+            ok = false;
+            continue;
+          }
+          _GeometryType const& range = first[q];
+          if (height == 0)
+          {
+            for (value_type const& c : *ref.as<leaf_page_type>())
+            {
+              const bool match = Inside ? traits::is_inside(range, c.first)
+                                        : traits::is_overlap(c.first, range);
+              if (match && functor(q, c))
+              {
+                stopped[q] = true;
+                break;
+              }
+            }
+            continue;
+          }
+          for (node_entry_type const& c : *ref.as<node_page_type>())
+          {
+            if (traits::is_overlap(c.first, range))
+            {
+              next.push_back({ c.second, q });
+            }
+          }
+        }
+      }
+      frontier.swap(next);
+    }
+    return ok;
+  }
+
+public:
+  // open the tree in `path`, creating an empty one if the file is empty
+  explicit paged_rtree(std::string const& path,
+                       size_type frames = DEFAULT_FRAMES,
+                       std::uint32_t page_size = DEFAULT_PAGE_SIZE)
+  {
+    if (page_size < sizeof(meta_t) || page_size < sizeof(node_page_type)
+        || page_size < sizeof(leaf_page_type)
+        || _file.open(path, page_size) == false)
+    {
+      _file.close();
+      return;
+    }
+    // a descent pins a page per level plus the pages of a split
+    _pool.emplace(_file, frames < 16 ? 16 : frames);
+    if (_file.page_count() == 0)
+    {
+      _meta.magic = meta_t::MAGIC;
+      _meta.version = meta_t::VERSION;
+      _meta.page_size = page_size;
+      _meta.node_bytes = sizeof(node_page_type);
+      _meta.leaf_bytes = sizeof(leaf_page_type);
+      _meta.height = 0;
+      _meta.page_count = 1;
+      _meta.free_head = INVALID_PAGE;
+      _meta.size = 0;
+      page_ref_type root = allocate_page();
+      _meta.root = root.page();
+      root.release();
+      if (write_meta() == false || flush() == false)
+      {
+        _file.close();
+      }
+      return;
+    }
+    page_ref_type ref = _pool->fetch(0);
+    if (ref)
+    {
+      std::memcpy(&_meta, ref.data(), sizeof(_meta));
+    }
+    if (!ref || _meta.magic != meta_t::MAGIC
+        || _meta.version != meta_t::VERSION || _meta.page_size != page_size
+        || _meta.node_bytes != sizeof(node_page_type)
+        || _meta.leaf_bytes != sizeof(leaf_page_type))
+    {
+      ref.release();
+      _pool->discard_all();
+      _file.close();
+    }
+  }
+  paged_rtree(paged_rtree const&) = delete;
+  paged_rtree& operator=(paged_rtree const&) = delete;
+  ~paged_rtree()
+  {
+    flush();
+  }
+
+  // false if the file could not be opened or holds another kind of tree
+  bool is_open() const
+  {
+    return _file.is_open();
+  }
+
+  bool insert(value_type new_val)
+  {
+    if (insert_at(std::move(new_val), 0) == false)
+    {
+      return false;
+    }
+    ++_meta.size;
+    return true;
+  }
+  template <typename... Args>
+  bool emplace(Args&&... args)
+  {
+    return insert(value_type(std::forward<Args>(args)...));
+  }
+
+  // erase the entry whose mapped value equals `entrie`'s, searching the
+  // leaves `entrie.first` overlaps; false if there is none
+  bool deleteEntrie(value_type const& entrie)
+  {
+    path_type path;
+    page_id_type leaf;
+    size_type index;
+    if (find_leaf(_meta.root, _meta.height, entrie, path, leaf, index)
+        == false)
+    {
+      return false;
+    }
+    {
+      page_ref_type ref = _pool->fetch(leaf);
+      if (!ref)
+      {
+        return false;
+      }
+      leaf_page_type* node = ref.as<leaf_page_type>();
+      node->erase(node->begin() + index);
+      ref.mark_dirty();
+    }
+    --_meta.size;
+
+    // condense: unlink underflowing nodes, remember them for reinsertion
+    struct orphan_t
+    {
+      page_id_type page;
+      int height;
+    };
+    std::vector<orphan_t> orphans;
+    page_id_type child = leaf;
+    for (size_type i = static_cast<size_type>(path.size()); i > 0; --i)
+    {
+      path_entry_t const& step = path[i - 1];
+      const int height = static_cast<int>(path.size() - i);
+      size_type count;
+      {
+        page_ref_type ref = _pool->fetch(child);
+        if (!ref)
+        {
+          return false;
+        }
+        count = height == 0 ? ref.as<leaf_page_type>()->size()
+                            : ref.as<node_page_type>()->size();
+      }
+      const size_type min_entries = height == 0 ? leaf_page_type::MIN_ENTRIES
+                                                : node_page_type::MIN_ENTRIES;
+      std::optional<geometry_type> bound;
+      if (count >= min_entries)
+      {
+        bound = bound_of(child, height);
+        if (!bound)
+        {
+          return false;
+        }
+      }
+      page_ref_type ref = _pool->fetch(step.page);
+      if (!ref)
+      {
+        return false;
+      }
+      node_page_type* parent = ref.as<node_page_type>();
+      if (bound)
+      {
+        parent->at(step.index).first = *bound;
+      }
+      else
+      {
+        parent->erase(parent->begin() + step.index);
+        orphans.push_back({ child, height });
+      }
+      ref.mark_dirty();
+      child = step.page;
+    }
+
+    // a root left with a single child is replaced by that child
+    if (_meta.height > 0)
+    {
+      page_ref_type ref = _pool->fetch(_meta.root);
+      if (!ref)
+      {
+        return false;
+      }
+      node_page_type const* root = ref.as<node_page_type>();
+      if (root->size() == 1)
+      {
+        const page_id_type old_root = _meta.root;
+        _meta.root = root->at(0).second;
+        --_meta.height;
+        ref.release();
+        if (free_page(old_root) == false)
+        {
+          return false;
+        }
+      }
+    }
+
+    // reinsert the entries of the unlinked nodes at their level
+    for (orphan_t const& orphan : orphans)
+    {
+      std::vector<value_type> values;
+      std::vector<node_entry_type> entries;
+      {
+        page_ref_type ref = _pool->fetch(orphan.page);
+        if (!ref)
+        {
+          return false;
+        }
+        if (orphan.height == 0)
+        {
+          leaf_page_type const* node = ref.as<leaf_page_type>();
+          values.assign(node->begin(), node->end());
+        }
+        else
+        {
+          node_page_type const* node = ref.as<node_page_type>();
+          entries.assign(node->begin(), node->end());
+        }
+      }
+      if (free_page(orphan.page) == false)
+      {
+        return false;
+      }
+      for (value_type const& v : values)
+      {
+        if (insert_at(v, 0) == false)
+        {
+          return false;
+        }
+      }
+      for (node_entry_type const& e : entries)
+      {
+        if (insert_at(e, orphan.height) == false)
+        {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  // return false if a page could not be read, leaving the results
+  // incomplete; a search stopped by `functor` returns true
+  template <typename _GeometryType, typename Functor>
+  bool search_overlap(_GeometryType const& search_range, Functor functor) const
+  {
+    bool failed = false;
+    search_wrapper<false>(_meta.root, _meta.height, search_range, functor,
+                          failed);
+    return failed == false;
+  }
+  template <typename _GeometryType, typename Functor>
+  bool search_inside(_GeometryType const& search_range, Functor functor) const
+  {
+    bool failed = false;
+    search_wrapper<true>(_meta.root, _meta.height, search_range, functor,
+                         failed);
+    return failed == false;
+  }
+
+  /*
+   * search_overlap / search_inside for the queries in [first, last) at
+   * once, level by level: the child pages all the queries need from a
+   * level are read as one batch through `reader` (io_uring_page_reader_t,
+   * or pread_page_reader_t) before any of them is visited, so reads
+   * overlap across siblings and across queries instead of waiting on one
+   * page at a time.
+   * functor(query index, value_type const&); returning true stops that
+   * query only. Results of a query come in level order, not depth first.
+   * returns false if a page could not be read; the queries that needed it
+   * are cut short, the others complete.
+   */
+  template <typename _GeometryType, typename Functor, typename Reader>
+  bool search_overlap_batch(_GeometryType const* first,
+                            _GeometryType const* last,
+                            Functor functor,
+                            Reader& reader) const
+  {
+    return search_level_order<false>(first, last, functor, reader);
+  }
+  template <typename _GeometryType, typename Functor, typename Reader>
+  bool search_inside_batch(_GeometryType const* first,
+                           _GeometryType const* last,
+                           Functor functor,
+                           Reader& reader) const
+  {
+    return search_level_order<true>(first, last, functor, reader);
+  }
+
+  size_type size() const
+  {
+    return static_cast<size_type>(_meta.size);
+  }
+  int leaf_level() const
+  {
+    return _meta.height;
+  }
+  page_id_type page_count() const
+  {
+    return _meta.page_count;
+  }
+  buffer_pool_t::stats_type const& pool_stats() const
+  {
+    return _pool->stats();
+  }
+
+  // write the meta data and every dirty page back and sync the file
+  bool flush()
+  {
+    if (is_open() == false)
+    {
+      return false;
+    }
+    return write_meta() && _pool->flush() && _file.sync();
+  }
+};
+
+}
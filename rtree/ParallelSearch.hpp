@@ -0,0 +1,168 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+#include "Global.hpp"
+#include "ThreadPool.hpp"
+
+namespace rtree
+{
+
+// subtrees collected per worker before a parallel search starts its tasks
+constexpr size_type PARALLEL_SEARCH_TASKS_PER_WORKER = 4;
+
+// search the subtree `height` levels above the leaves, giving up as soon as
+// `stop` is set; returns true if the search was stopped
+template <bool Inside,
+          typename TreeType,
+          typename _NodeType,
+          typename _GeometryType,
+          typename Functor>
+bool search_subtree_until(_NodeType const* node,
+                          int height,
+                          _GeometryType const& search_range,
+                          Functor& functor,
+                          std::atomic<bool>& stop)
+{
+  using traits = typename TreeType::traits;
+
+  if (stop.load(std::memory_order_relaxed))
+  {
+    return true;
+  }
+  if (height == 0)
+  {
+    for (auto const& c : *node->as_leaf())
+    {
+      const bool match = Inside ? traits::is_inside(search_range, c.first)
+                                : traits::is_overlap(c.first, search_range);
+      if (match && functor(c))
+      {
+        stop.store(true, std::memory_order_relaxed);
+        return true;
+      }
+    }
+    return false;
+  }
+  for (auto const& c : *node->as_node())
+  {
+    if (traits::is_overlap(c.first, search_range) == false)
+    {
+      continue;
+    }
+    if (search_subtree_until<Inside, TreeType>(
+            c.second->as_node(), height - 1, search_range, functor, stop))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+template <bool Inside, typename TreeType, typename _GeometryType,
+          typename Functor>
+std::vector<Functor> search_parallel(TreeType const& tree,
+                                     _GeometryType const& search_range,
+                                     Functor functor,
+                                     thread_pool_t& pool,
+                                     size_type parallel_threshold)
+{
+  using traits = typename TreeType::traits;
+  using node_base_type = typename TreeType::node_base_type;
+
+  std::vector<Functor> sinks;
+  if (tree.estimate_overlap(search_range) < parallel_threshold)
+  {
+    sinks.push_back(std::move(functor));
+    Functor& f = sinks.front();
+    auto sink = [&f](auto const& c) { return f(c); };
+    if constexpr (Inside)
+    {
+      tree.search_inside(search_range, sink);
+    }
+    else
+    {
+      tree.search_overlap(search_range, sink);
+    }
+    return sinks;
+  }
+
+  // overlapping subtrees, all `height` levels above the leaves
+  std::vector<node_base_type const*> subtrees, next;
+  subtrees.push_back(tree.root());
+  int height = tree.leaf_level();
+  while (height > 0
+         && subtrees.size() < pool.size() * PARALLEL_SEARCH_TASKS_PER_WORKER)
+  {
+    next.clear();
+    for (node_base_type const* n : subtrees)
+    {
+      for (auto const& c : *n->as_node())
+      {
+        if (traits::is_overlap(c.first, search_range))
+        {
+          next.push_back(c.second);
+        }
+      }
+    }
+    subtrees.swap(next);
+    --height;
+  }
+
+  // copy constructed only; lambdas are not copy assignable
+  sinks.reserve(subtrees.size());
+  for (size_type i = 0; i < subtrees.size(); ++i)
+  {
+    sinks.push_back(functor);
+  }
+  std::atomic<bool> stop { false };
+  task_group_t tasks(pool);
+  for (size_type i = 0; i < subtrees.size(); ++i)
+  {
+    tasks.run([&, i] {
+      search_subtree_until<Inside, TreeType>(
+          subtrees[i]->as_node(), height, search_range, sinks[i], stop);
+    });
+  }
+  tasks.wait();
+  return sinks;
+}
+
+/*
+ * search_overlap / search_inside of `tree` spread over the workers of
+ * `pool`.
+ * If tree.estimate_overlap(search_range) is below `parallel_threshold` this
+ * is the sequential search. Otherwise overlapping subtrees are collected
+ * top down until there are PARALLEL_SEARCH_TASKS_PER_WORKER per worker,
+ * and each is searched as a task with its own copy of `functor`; the
+ * copies are returned in tree order. If no copy returns true, their
+ * results concatenated are the sequential search's.
+ * Once a copy returns true the other tasks stop at the next node they
+ * visit; which entries each copy saw by then is unspecified, so the
+ * returned copies need not match a sequential search stopped at the same
+ * entry.
+ * The tree must not be modified until the call returns.
+ */
+template <typename TreeType, typename _GeometryType, typename Functor>
+std::vector<Functor> parallel_search_overlap(TreeType const& tree,
+                                             _GeometryType const& search_range,
+                                             Functor functor,
+                                             thread_pool_t& pool,
+                                             size_type parallel_threshold)
+{
+  return search_parallel<false>(tree, search_range, std::move(functor), pool,
+                                parallel_threshold);
+}
+template <typename TreeType, typename _GeometryType, typename Functor>
+std::vector<Functor> parallel_search_inside(TreeType const& tree,
+                                            _GeometryType const& search_range,
+                                            Functor functor,
+                                            thread_pool_t& pool,
+                                            size_type parallel_threshold)
+{
+  return search_parallel<true>(tree, search_range, std::move(functor), pool,
+                               parallel_threshold);
+}
+
+}
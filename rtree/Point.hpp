@@ -18,12 +18,9 @@ namespace rtree {
 	public:
 		// default constructor
 		point_t() = default;
-		// copy constructor
-		point_t(point_t const& rhs) {
-			for (size_type i = 0; i < size(); ++i) {
-				_data[i] = rhs._data[i];
-			}
-		}
+		// copy constructor; defaulted so point_t (and aabb_t of it) stay
+		// trivially copyable and node entries can be moved with memcpy
+		point_t(point_t const& rhs) = default;
 		// constructor with variadic arguments
 		template <typename T0, typename... Ts>
 		point_t(T0 arg0, Ts... args) {
@@ -47,12 +44,7 @@ namespace rtree {
 			}
 		}
 		// copy assignment operator
-		point_t& operator=(point_t const& rhs) {
-			for (size_type i = 0; i < size(); ++i) {
-				_data[i] = rhs._data[i];
-			}
-			return *this;
-		}
+		point_t& operator=(point_t const& rhs) = default;
 		// dimensionality of point
 		constexpr static size_type size() {
 			return Dim;
@@ -0,0 +1,334 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "Global.hpp"
+
+namespace rtree {
+
+// slab memory from the global operator new
+// a slab source hands out blocks of `bytes` (a power of two) aligned to
+// `bytes`; slabs are returned only when the owning pool is destroyed
+struct heap_slab_source_t {
+  struct options_type {};
+
+  heap_slab_source_t() = default;
+  explicit heap_slab_source_t(options_type) {}
+
+  void* allocate_slab(std::size_t bytes) {
+    return ::operator new(bytes, std::align_val_t(bytes));
+  }
+  void deallocate_slab(void* slab, std::size_t bytes) {
+    ::operator delete(slab, std::align_val_t(bytes));
+  }
+};
+
+/*
+ * node_pool_t hands out fixed-size blocks for objects of type T.
+ * Memory is reserved in slabs of at least `slab_size` objects, and freed
+ * blocks are kept on a per-slab intrusive free list so the next allocation
+ * reuses them without going back to the system allocator.
+ * Slabs are aligned to their (power of two) byte size, so the slab owning
+ * any block is found by masking its address; this lets allocate() honour a
+ * placement hint and put a new object in the same slab as the hint.
+ * Slab memory comes from `SlabSource` (see heap_slab_source_t), and slabs
+ * are only released when the pool itself is destroyed.
+ * Not thread-safe; one pool is meant to be owned by a single tree.
+ */
+template <typename T, typename SlabSource = heap_slab_source_t>
+class node_pool_t {
+  union slot_t {
+    slot_t* next;
+    alignas(T) char storage[sizeof(T)];
+  };
+  struct slab_t {
+    slot_t* free = nullptr; // head of recycled blocks in this slab
+    // doubly linked list of slabs having recycled blocks
+    slab_t* prev_partial = nullptr;
+    slab_t* next_partial = nullptr;
+    bool partial = false;
+    slab_t* next_slab = nullptr; // list of all slabs
+  };
+  constexpr static std::size_t HEADER_BYTES
+      = (sizeof(slab_t) + alignof(slot_t) - 1) / alignof(slot_t)
+        * alignof(slot_t);
+
+  slab_t* _slabs = nullptr;
+  slab_t* _partial = nullptr;
+  slab_t* _current = nullptr; // slab being bump-allocated
+  slot_t* _bump = nullptr; // first never-used block in the current slab
+  slot_t* _bump_end = nullptr;
+  std::size_t _slab_bytes;
+  size_type _slab_size;
+  size_type _slab_count = 0;
+  SlabSource _source;
+
+public:
+  using options_type = typename SlabSource::options_type;
+
+  explicit node_pool_t(size_type slab_size,
+                       options_type const& options = options_type())
+      : _source(options)
+  {
+    assert(slab_size > 0);
+    const std::size_t min_bytes = HEADER_BYTES + sizeof(slot_t) * slab_size;
+    _slab_bytes = alignof(slot_t) > alignof(slab_t) ? alignof(slot_t)
+                                                    : alignof(slab_t);
+    while (_slab_bytes < min_bytes) {
+      _slab_bytes *= 2;
+    }
+    _slab_size
+        = static_cast<size_type>((_slab_bytes - HEADER_BYTES) / sizeof(slot_t));
+  }
+  node_pool_t(node_pool_t const&) = delete;
+  node_pool_t& operator=(node_pool_t const&) = delete;
+  ~node_pool_t() {
+    while (_slabs) {
+      slab_t* next = _slabs->next_slab;
+      _slabs->~slab_t();
+      _source.deallocate_slab(_slabs, _slab_bytes);
+      _slabs = next;
+    }
+  }
+
+  T* allocate() {
+    if (_partial) {
+      return pop_free(_partial);
+    }
+    if (_bump == _bump_end) {
+      grow();
+    }
+    return reinterpret_cast<T*>((_bump++)->storage);
+  }
+  // allocate in the slab holding `hint` if it has room
+  // `hint` must be null or a block allocated from this pool
+  T* allocate(void const* hint) {
+    if (hint) {
+      slab_t* s = slab_of(hint);
+      if (s->free) {
+        return pop_free(s);
+      }
+      if (s == _current && _bump != _bump_end) {
+        return reinterpret_cast<T*>((_bump++)->storage);
+      }
+    }
+    return allocate();
+  }
+  void deallocate(T* p) {
+    slab_t* s = slab_of(p);
+    slot_t* slot = reinterpret_cast<slot_t*>(p);
+    slot->next = s->free;
+    s->free = slot;
+    if (s->partial == false) {
+      s->partial = true;
+      s->prev_partial = nullptr;
+      s->next_partial = _partial;
+      if (_partial) {
+        _partial->prev_partial = s;
+      }
+      _partial = s;
+    }
+  }
+
+  // objects per slab; may be larger than requested to fill the slab
+  size_type slab_size() const {
+    return _slab_size;
+  }
+  size_type slab_count() const {
+    return _slab_count;
+  }
+  SlabSource const& source() const {
+    return _source;
+  }
+
+protected:
+  slab_t* slab_of(void const* p) const {
+    return reinterpret_cast<slab_t*>(reinterpret_cast<std::uintptr_t>(p)
+                                     & ~(std::uintptr_t(_slab_bytes) - 1));
+  }
+  T* pop_free(slab_t* s) {
+    slot_t* slot = s->free;
+    s->free = slot->next;
+    if (s->free == nullptr) {
+      // unlink from partial list
+      s->partial = false;
+      if (s->prev_partial) {
+        s->prev_partial->next_partial = s->next_partial;
+      }
+      else {
+        _partial = s->next_partial;
+      }
+      if (s->next_partial) {
+        s->next_partial->prev_partial = s->prev_partial;
+      }
+    }
+    return reinterpret_cast<T*>(slot->storage);
+  }
+  void grow() {
+    void* mem = _source.allocate_slab(_slab_bytes);
+    slab_t* slab = new (mem) slab_t;
+    slab->next_slab = _slabs;
+    _slabs = slab;
+    ++_slab_count;
+    _current = slab;
+    _bump = reinterpret_cast<slot_t*>(static_cast<char*>(mem) + HEADER_BYTES);
+    _bump_end = _bump + _slab_size;
+  }
+};
+
+// storage of a pool block; types of the same size and alignment share a pool
+template <std::size_t Bytes, std::size_t Align>
+struct pool_block_t {
+  alignas(Align) unsigned char bytes[Bytes];
+};
+
+/*
+ * node_pool_set_t owns one node_pool_t per block size and alignment, each
+ * created on first use with the same slab size and slab source options.
+ * An allocator, its copies and its rebound copies all share one set.
+ */
+template <typename SlabSource = heap_slab_source_t>
+class node_pool_set_t {
+public:
+  using options_type = typename SlabSource::options_type;
+  template <typename T>
+  using pool_type
+      = node_pool_t<pool_block_t<sizeof(T), alignof(T)>, SlabSource>;
+
+protected:
+  struct entry_t {
+    std::size_t bytes;
+    std::size_t align;
+    std::shared_ptr<void> pool;
+  };
+
+  // guards _pools only; the pools themselves are not thread-safe
+  std::mutex _mutex;
+  std::vector<entry_t> _pools;
+  size_type _slab_size;
+  options_type _options;
+
+public:
+  explicit node_pool_set_t(size_type slab_size,
+                           options_type const& options = options_type())
+      : _slab_size(slab_size)
+      , _options(options)
+  {
+  }
+  node_pool_set_t(node_pool_set_t const&) = delete;
+  node_pool_set_t& operator=(node_pool_set_t const&) = delete;
+
+  // the pool for blocks of T, created if there is none yet
+  template <typename T>
+  pool_type<T>& get() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (entry_t const& e : _pools) {
+      if (e.bytes == sizeof(T) && e.align == alignof(T)) {
+        return *static_cast<pool_type<T>*>(e.pool.get());
+      }
+    }
+    auto pool = std::make_shared<pool_type<T>>(_slab_size, _options);
+    _pools.push_back({ sizeof(T), alignof(T), pool });
+    return *pool;
+  }
+};
+
+/*
+ * basic_pool_allocator can be plugged into RTree's `Allocator` parameter
+ * through an alias template such as pool_allocator below.
+ * RTree instantiates it once for node_type and once for leaf_type; each
+ * block size gets its own pool and free list.
+ * Copies and rebound copies share the same node_pool_set_t and compare
+ * equal, so an allocator rebound to another type and back still frees
+ * what the original allocated.
+ * Single-object requests go through the pool, array requests fall back to
+ * operator new.
+ */
+template <typename T, typename SlabSource = heap_slab_source_t>
+class basic_pool_allocator {
+public:
+  using value_type = T;
+  using pool_set_type = node_pool_set_t<SlabSource>;
+  using pool_type = typename pool_set_type::template pool_type<T>;
+  using options_type = typename SlabSource::options_type;
+
+  // number of objects reserved per slab
+  constexpr static size_type DEFAULT_SLAB_SIZE = 256;
+
+protected:
+  using block_type = pool_block_t<sizeof(T), alignof(T)>;
+
+  std::shared_ptr<pool_set_type> _pools;
+  pool_type* _pool;
+
+  template <typename U, typename S>
+  friend class basic_pool_allocator;
+
+public:
+  basic_pool_allocator()
+      : basic_pool_allocator(DEFAULT_SLAB_SIZE)
+  {
+  }
+  explicit basic_pool_allocator(size_type slab_size,
+                                options_type const& options = options_type())
+      : _pools(std::make_shared<pool_set_type>(slab_size, options))
+      , _pool(&_pools->template get<T>())
+  {
+  }
+  template <typename U>
+  basic_pool_allocator(basic_pool_allocator<U, SlabSource> const& rhs)
+      : _pools(rhs._pools)
+      , _pool(&_pools->template get<T>())
+  {
+  }
+
+  T* allocate(std::size_t n) {
+    if (n == 1) {
+      return reinterpret_cast<T*>(_pool->allocate());
+    }
+    return static_cast<T*>(
+        ::operator new(sizeof(T) * n, std::align_val_t(alignof(T))));
+  }
+  // `hint` is a neighbouring object from this allocator's pool; the new
+  // one is placed in its slab if possible.
+  // used by std::allocator_traits::allocate(a, n, hint)
+  T* allocate(std::size_t n, void const* hint) {
+    if (n == 1) {
+      return reinterpret_cast<T*>(_pool->allocate(hint));
+    }
+    return allocate(n);
+  }
+  void deallocate(T* p, std::size_t n) {
+    if (n == 1) {
+      _pool->deallocate(reinterpret_cast<block_type*>(p));
+    }
+    else {
+      ::operator delete(p, std::align_val_t(alignof(T)));
+    }
+  }
+
+  pool_type& pool() const {
+    return *_pool;
+  }
+
+  template <typename U>
+  bool operator==(basic_pool_allocator<U, SlabSource> const& rhs) const {
+    return _pools == rhs._pools;
+  }
+  template <typename U>
+  bool operator!=(basic_pool_allocator<U, SlabSource> const& rhs) const {
+    return _pools != rhs._pools;
+  }
+};
+
+// slab pool allocator backed by the global operator new
+template <typename T>
+using pool_allocator = basic_pool_allocator<T, heap_slab_source_t>;
+
+}
@@ -19,9 +19,6 @@ struct quadratic_split_t {
   constexpr static area_type LOWEST_AREA
       = std::numeric_limits<area_type>::lowest();
 
-  constexpr static unsigned int MIN_ENTRIES = TreeType::MIN_ENTRIES;
-  constexpr static unsigned int MAX_ENTRIES = TreeType::MAX_ENTRIES;
-
   /**
    * Pick the first two entries to be the first elements of the groups.
    * @param node node to split
@@ -112,6 +109,10 @@ struct quadratic_split_t {
                        typename NodeType::value_type new_child,
                        NodeType* node_pair) const
   {
+    // capacity of the node kind being split (leaf or internal)
+    constexpr unsigned int MIN_ENTRIES = NodeType::MIN_ENTRIES;
+    constexpr unsigned int MAX_ENTRIES = NodeType::MAX_ENTRIES;
+
     assert(node->size() == MAX_ENTRIES);
     assert(node_pair);
     assert(node_pair->size() == 0);
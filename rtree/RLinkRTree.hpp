@@ -0,0 +1,591 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <utility>
+#include <vector>
+
+#include "ConcurrentRTree.hpp"
+#include "Global.hpp"
+#include "OptimisticRTree.hpp"
+#include "StaticVector.hpp"
+
+namespace rtree
+{
+
+/*
+ * rlink_rtree is an alternative to olc_rtree in which a leaf split does not
+ * lock the leaf's parent, following the R-link tree.
+ * A leaf is split while holding only its own lock (plus those of ancestors
+ * whose entry grows to cover the new key), and the new sibling is linked to
+ * the right of the split leaf. Its entry is posted to the parent afterwards,
+ * as a separate step. Until then the parent's entry for the split leaf keeps
+ * covering both halves, since entries never shrink in this mode.
+ * A search that copied a parent before the new sibling was posted finds it
+ * by following the right-links of the leaves it visits, up to the first
+ * sibling that is already in its copy of the parent. Right-links are
+ * dropped whenever the structure lock is held exclusively, so a chain never
+ * leaves its parent and this comparison replaces the sequence numbers of
+ * the original scheme. As a result searches never start over: they only
+ * re-read a node that was being written.
+ * Root and internal splits, condensing after an underflow, and postings to
+ * a full parent fall back to RTree's insert_node / deleteEntrie while
+ * holding the structure lock exclusively.
+ * Nodes are guarded by a version_table_t; right-links live in a fixed-size
+ * open addressing table (`link_capacity`, a power of two), and a split that
+ * would fill it more than half takes the exclusive path instead.
+ * Entries are read while they may be written, so value_type must be
+ * bitwise copyable. Search functors run while the structure lock is held
+ * shared and must not call back into this object.
+ */
+template <typename TreeType, typename MutexType = distributed_shared_mutex>
+class rlink_rtree : protected TreeType
+{
+  using base_type = TreeType;
+
+public:
+  using tree_type = TreeType;
+  using mutex_type = MutexType;
+  using size_type = typename TreeType::size_type;
+  using geometry_type = typename TreeType::geometry_type;
+  using traits = typename TreeType::traits;
+  using key_type = typename TreeType::key_type;
+  using mapped_type = typename TreeType::mapped_type;
+  using value_type = typename TreeType::value_type;
+  using node_base_type = typename TreeType::node_base_type;
+  using node_type = typename TreeType::node_type;
+  using leaf_type = typename TreeType::leaf_type;
+  using version_type = version_lock_t::version_type;
+
+  constexpr static size_type DEFAULT_LINK_CAPACITY = size_type(1) << 14;
+  constexpr static int MAX_RETRIES = 8;
+  constexpr static int MAX_DEPTH = 64;
+
+  static_assert(is_bitwise_copyable<value_type>::value,
+                "rlink_rtree requires bitwise copyable key and mapped types");
+
+protected:
+  using node_entries_type
+      = static_vector<typename node_type::value_type, node_type::MAX_ENTRIES>;
+  using leaf_entries_type
+      = static_vector<typename leaf_type::value_type, leaf_type::MAX_ENTRIES>;
+
+  enum class attempt_t
+  {
+    done,
+    retry,
+    exclusive,
+    // done, but a split could not be posted
+    settle
+  };
+
+  struct path_entry_t
+  {
+    node_base_type* node;
+    version_type version;
+    size_type index;
+    geometry_type bound;
+  };
+
+  struct found_t
+  {
+    leaf_type* leaf = nullptr;
+    version_type version = 0;
+    size_type index = 0;
+  };
+
+  struct link_slot_t
+  {
+    std::atomic<node_base_type const*> node { nullptr };
+    std::atomic<node_base_type*> right { nullptr };
+  };
+
+  // split-off leaf whose entry waits for the exclusive path
+  struct pending_split_t
+  {
+    node_type* parent;
+    leaf_type* node;
+  };
+
+  version_table_t _versions;
+  std::unique_ptr<link_slot_t[]> _links;
+  size_type _link_capacity;
+  std::atomic<size_type> _link_count { 0 };
+  std::vector<pending_split_t> _pending;
+  std::mutex _pending_mutex;
+  // shared for optimistic operations, exclusive for the fallback path
+  mutable MutexType _structure;
+  // guards the node allocators during optimistic splits
+  std::mutex _alloc_mutex;
+
+  version_lock_t& version_of(node_base_type const* node) const
+  {
+    return _versions(node);
+  }
+
+  node_base_type* right_link(node_base_type const* node) const
+  {
+    const size_type mask = _link_capacity - 1;
+    for (size_type i = version_table_t::hash(node) >> 32 & mask;;
+         i = (i + 1) & mask)
+    {
+      node_base_type const* key
+          = _links[i].node.load(std::memory_order_acquire);
+      if (key == node)
+      {
+        return _links[i].right.load(std::memory_order_acquire);
+      }
+      if (key == nullptr)
+      {
+        return nullptr;
+      }
+    }
+  }
+  // `node` is locked, or not yet reachable
+  void set_right_link(node_base_type const* node, node_base_type* right)
+  {
+    const size_type mask = _link_capacity - 1;
+    for (size_type i = version_table_t::hash(node) >> 32 & mask;;
+         i = (i + 1) & mask)
+    {
+      node_base_type const* key
+          = _links[i].node.load(std::memory_order_acquire);
+      if (key == nullptr
+          && _links[i].node.compare_exchange_strong(
+              key, node, std::memory_order_acq_rel))
+      {
+        key = node;
+      }
+      if (key == node)
+      {
+        _links[i].right.store(right, std::memory_order_release);
+        return;
+      }
+    }
+  }
+  // room for the two links of one split
+  bool reserve_links()
+  {
+    if (_link_count.fetch_add(2, std::memory_order_relaxed) + 2
+        > _link_capacity / 2)
+    {
+      _link_count.fetch_sub(2, std::memory_order_relaxed);
+      return false;
+    }
+    return true;
+  }
+
+  // post deferred splits and drop all right-links
+  // the structure lock must be held exclusively
+  void settle()
+  {
+    for (pending_split_t const& p : _pending)
+    {
+      base_type::insert_node(p.parent, { p.node->calculate_bound(), p.node });
+    }
+    _pending.clear();
+    if (_link_count.load(std::memory_order_relaxed))
+    {
+      for (size_type i = 0; i < _link_capacity; ++i)
+      {
+        _links[i].node.store(nullptr, std::memory_order_relaxed);
+        _links[i].right.store(nullptr, std::memory_order_relaxed);
+      }
+      _link_count.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  // consistent copies of a node, waiting out concurrent writes
+  version_type read_node(node_base_type const* node,
+                         node_entries_type& entries) const
+  {
+    version_lock_t const& lock = version_of(node);
+    for (;;)
+    {
+      const version_type v = lock.read_begin();
+      entries = node->as_node()->_children;
+      if (lock.validate(v))
+      {
+        return v;
+      }
+    }
+  }
+  version_type read_leaf(node_base_type const* node,
+                         leaf_entries_type& entries,
+                         node_base_type*& right) const
+  {
+    version_lock_t const& lock = version_of(node);
+    for (;;)
+    {
+      const version_type v = lock.read_begin();
+      entries = node->as_leaf()->_children;
+      right = right_link(node);
+      if (lock.validate(v))
+      {
+        return v;
+      }
+    }
+  }
+  static bool contains(node_entries_type const& entries,
+                       node_base_type const* node)
+  {
+    for (size_type i = 0; i < entries.size(); ++i)
+    {
+      if (entries[i].second == node)
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // visit `leaf` and the leaves split off it that are missing from
+  // `parent`, a copy of its parent (null if `leaf` is the root)
+  // returns true if the functor asked to stop
+  template <bool Inside, typename _GeometryType, typename Functor>
+  bool search_chain(node_base_type const* leaf,
+                    node_entries_type const* parent,
+                    _GeometryType const& search_range,
+                    Functor& functor) const
+  {
+    leaf_entries_type entries;
+    node_base_type* right;
+    while (leaf)
+    {
+      read_leaf(leaf, entries, right);
+      for (size_type i = 0; i < entries.size(); ++i)
+      {
+        value_type const& c = entries[i];
+        if (Inside ? traits::is_inside(search_range, c.first) == false
+                   : traits::is_overlap(c.first, search_range) == false)
+        {
+          continue;
+        }
+        if (functor(c))
+        {
+          return true;
+        }
+      }
+      if (parent == nullptr || contains(*parent, right))
+      {
+        break;
+      }
+      leaf = right;
+    }
+    return false;
+  }
+  template <bool Inside, typename _GeometryType, typename Functor>
+  bool search_wrapper(node_base_type const* node,
+                      int level,
+                      _GeometryType const& search_range,
+                      Functor& functor) const
+  {
+    if (level == this->_leaf_level)
+    {
+      return search_chain<Inside>(node, nullptr, search_range, functor);
+    }
+    node_entries_type entries;
+    read_node(node, entries);
+    for (size_type i = 0; i < entries.size(); ++i)
+    {
+      if (traits::is_overlap(entries[i].first, search_range) == false)
+      {
+        continue;
+      }
+      if (level + 1 == this->_leaf_level
+              ? search_chain<Inside>(entries[i].second, &entries,
+                                     search_range, functor)
+              : search_wrapper<Inside>(entries[i].second, level + 1,
+                                       search_range, functor))
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // optimistic findLeaf, following right-links like search_chain
+  bool find_chain(node_base_type* leaf,
+                  node_entries_type const* parent,
+                  value_type const& entrie,
+                  found_t& found) const
+  {
+    leaf_entries_type entries;
+    node_base_type* right;
+    while (leaf)
+    {
+      const version_type v = read_leaf(leaf, entries, right);
+      for (size_type i = 0; i < entries.size(); ++i)
+      {
+        if (entries[i].second == entrie.second)
+        {
+          found.leaf = leaf->as_leaf();
+          found.version = v;
+          found.index = i;
+          return true;
+        }
+      }
+      if (parent == nullptr || contains(*parent, right))
+      {
+        break;
+      }
+      leaf = right;
+    }
+    return false;
+  }
+  bool find(node_base_type* node,
+            int level,
+            value_type const& entrie,
+            found_t& found) const
+  {
+    if (level == this->_leaf_level)
+    {
+      return find_chain(node, nullptr, entrie, found);
+    }
+    node_entries_type entries;
+    read_node(node, entries);
+    for (size_type i = 0; i < entries.size(); ++i)
+    {
+      if (traits::is_overlap(entries[i].first, entrie.first) == false)
+      {
+        continue;
+      }
+      if (level + 1 == this->_leaf_level
+              ? find_chain(entries[i].second, &entries, entrie, found)
+              : find(entries[i].second, level + 1, entrie, found))
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // insert the entry of split-off leaf `pair` into `parent`
+  // returns false if `parent` is full and the posting was deferred
+  bool post(node_type* parent, leaf_type* pair)
+  {
+    version_lock_set_t<1> locks;
+    // deletes may still shrink the new leaf, never empty it
+    locks.acquire(version_of(pair));
+    const geometry_type bound = pair->calculate_bound();
+    locks.release();
+
+    locks.acquire(version_of(parent));
+    if (parent->size() < node_type::MAX_ENTRIES)
+    {
+      parent->insert({ bound, pair });
+      locks.release();
+      return true;
+    }
+    locks.release();
+    std::lock_guard<std::mutex> lock(_pending_mutex);
+    _pending.push_back({ parent, pair });
+    return false;
+  }
+
+  attempt_t try_insert(value_type const& new_val)
+  {
+    const int leaf_level = this->_leaf_level;
+    assert(leaf_level < MAX_DEPTH);
+    static_vector<path_entry_t, MAX_DEPTH> path;
+
+    node_base_type* node = this->_root;
+    node_entries_type entries;
+    for (int level = 0; level < leaf_level; ++level)
+    {
+      const version_type v = read_node(node, entries);
+      auto chosen = base_type::choose_subtree(entries.begin(), entries.end(),
+                                              new_val.first);
+      if (chosen == entries.end())
+      {
+        return attempt_t::retry;
+      }
+      path.emplace_back(path_entry_t {
+          node, v, static_cast<size_type>(chosen - entries.begin()),
+          chosen->first });
+      node = chosen->second;
+    }
+
+    leaf_type* leaf = node->as_leaf();
+    version_lock_set_t<MAX_DEPTH + 1> locks;
+    locks.acquire(version_of(leaf));
+
+    // lock ancestors whose entry does not cover the new key yet
+    // entries only grow in this mode, so one that covers it stays covering
+    int covered = leaf_level - 1;
+    for (; covered >= 0; --covered)
+    {
+      path_entry_t const& p = path[covered];
+      if (traits::is_inside(p.bound, new_val.first))
+      {
+        break;
+      }
+      if (locks.acquire(version_of(p.node), p.version) == false)
+      {
+        locks.release();
+        return attempt_t::retry;
+      }
+    }
+
+    leaf_type* pair = nullptr;
+    if (leaf->size() == leaf_type::MAX_ENTRIES)
+    {
+      if (leaf_level == 0 || reserve_links() == false)
+      {
+        locks.release();
+        return attempt_t::exclusive;
+      }
+      {
+        std::lock_guard<std::mutex> alloc_lock(_alloc_mutex);
+        pair = this->template construct_node<leaf_type>(leaf);
+      }
+      base_type::split(leaf, new_val, pair);
+      set_right_link(pair, right_link(leaf));
+      set_right_link(leaf, pair);
+    }
+    else
+    {
+      leaf->insert(new_val);
+    }
+    for (int level = leaf_level - 1; level > covered; --level)
+    {
+      auto& entry = path[level].node->as_node()->at(path[level].index);
+      entry.first = traits::merge(entry.first, new_val.first);
+    }
+    locks.release();
+
+    if (pair && post(path[leaf_level - 1].node->as_node(), pair) == false)
+    {
+      return attempt_t::settle;
+    }
+    return attempt_t::done;
+  }
+
+  attempt_t try_erase(value_type const& entrie)
+  {
+    found_t found;
+    if (find(this->_root, 0, entrie, found) == false)
+    {
+      return attempt_t::done;
+    }
+    version_lock_set_t<1> locks;
+    if (locks.acquire(version_of(found.leaf), found.version) == false)
+    {
+      return attempt_t::retry;
+    }
+    if (this->_leaf_level > 0
+        && found.leaf->size() <= leaf_type::MIN_ENTRIES)
+    {
+      locks.release();
+      return attempt_t::exclusive;
+    }
+    found.leaf->erase(found.leaf->begin() + found.index);
+    locks.release();
+    return attempt_t::done;
+  }
+
+  // run `attempt` optimistically, then exclusively if it did not finish
+  template <typename Attempt, typename Exclusive>
+  void run(Attempt attempt, Exclusive exclusive)
+  {
+    attempt_t result = attempt_t::retry;
+    {
+      std::shared_lock<MutexType> lock(_structure);
+      for (int i = 0; i < MAX_RETRIES && result == attempt_t::retry; ++i)
+      {
+        result = attempt();
+      }
+    }
+    if (result == attempt_t::done)
+    {
+      return;
+    }
+    std::unique_lock<MutexType> lock(_structure);
+    settle();
+    if (result != attempt_t::settle)
+    {
+      exclusive();
+    }
+  }
+
+public:
+  explicit rlink_rtree(size_type link_capacity = DEFAULT_LINK_CAPACITY)
+      : _links(new link_slot_t[link_capacity])
+      , _link_capacity(link_capacity)
+  {
+    assert((link_capacity & (link_capacity - 1)) == 0);
+  }
+  explicit rlink_rtree(TreeType tree,
+                       size_type link_capacity = DEFAULT_LINK_CAPACITY)
+      : TreeType(std::move(tree))
+      , _links(new link_slot_t[link_capacity])
+      , _link_capacity(link_capacity)
+  {
+    assert((link_capacity & (link_capacity - 1)) == 0);
+  }
+  rlink_rtree(rlink_rtree const&) = delete;
+  rlink_rtree& operator=(rlink_rtree const&) = delete;
+
+  void insert(value_type new_val)
+  {
+    run([&] { return try_insert(new_val); },
+        [&] { base_type::insert(std::move(new_val)); });
+  }
+  template <typename... Args>
+  void emplace(Args&&... args)
+  {
+    insert(value_type(std::forward<Args>(args)...));
+  }
+  void deleteEntrie(value_type const& entrie)
+  {
+    run([&] { return try_erase(entrie); },
+        [&] { base_type::deleteEntrie(entrie); });
+  }
+  void clear()
+  {
+    std::unique_lock<MutexType> lock(_structure);
+    settle();
+    base_type::clear();
+  }
+
+  template <typename _GeometryType, typename Functor>
+  void search_inside(_GeometryType const& search_range, Functor functor) const
+  {
+    std::shared_lock<MutexType> lock(_structure);
+    search_wrapper<true>(this->_root, 0, search_range, functor);
+  }
+  template <typename _GeometryType, typename Functor>
+  void search_overlap(_GeometryType const& search_range, Functor functor) const
+  {
+    std::shared_lock<MutexType> lock(_structure);
+    search_wrapper<false>(this->_root, 0, search_range, functor);
+  }
+
+  // these run exclusively
+  // split-off leaves not posted to their parent yet are counted where they
+  // wait, so the tree is not settled and size() can stay const
+  size_type size() const
+  {
+    std::unique_lock<MutexType> lock(_structure);
+    size_type ret = base_type::size();
+    for (pending_split_t const& p : _pending)
+    {
+      ret += p.node->size();
+    }
+    return ret;
+  }
+  // run `functor(tree_type&)` under the exclusive lock
+  template <typename Functor>
+  decltype(auto) write(Functor functor)
+  {
+    std::unique_lock<MutexType> lock(_structure);
+    settle();
+    return functor(static_cast<TreeType&>(*this));
+  }
+};
+
+}
@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <limits>
 #include <memory>
 #include <type_traits>
@@ -11,20 +12,27 @@
 #include "GeometryTraits.hpp"
 #include "Global.hpp"
 #include "Iterator.hpp"
+#include "LeafCodec.hpp"
 #include "StaticNode.hpp"
 #include <fstream>
 #include "QuadraticSplit.hpp"
 #include "RStarSplit.hpp"
+#include "Serialization.hpp"
 
 namespace rtree
 {
 
+template <typename TreeType, typename MutexType>
+class rebuilding_rtree;
+
 template <typename GeometryType, // bounding box representation
           typename KeyType, // key type, either bounding box or point
           typename MappedType, // mapped type, user defined
           size_type MinEntry = 8u, // m
           size_type MaxEntry = 16u, // M
-          template <typename _T> class Allocator = std::allocator // allocator
+          template <typename _T> class Allocator = std::allocator, // allocator
+          size_type MinLeafEntry = MinEntry, // m of leaf nodes
+          size_type MaxLeafEntry = MaxEntry // M of leaf nodes
           >
 class RTree
 {
@@ -32,20 +40,34 @@ class RTree
   using splitter_t = quadratic_split_t<RTree>;
   //using splitter_t = rstar_split_t<RTree>;
 
+  // rebuilds through build_packed
+  template <typename, typename>
+  friend class rebuilding_rtree;
+
 public:
   // using stack memory for MaxEntries child nodes. instead of std::vector
   using node_base_type = static_node_base_t<GeometryType,
                                             KeyType,
                                             MappedType,
                                             MinEntry,
-                                            MaxEntry>;
+                                            MaxEntry,
+                                            MinLeafEntry,
+                                            MaxLeafEntry>;
   using node_type
-      = static_node_t<GeometryType, KeyType, MappedType, MinEntry, MaxEntry>;
+      = static_node_t<GeometryType,
+                      KeyType,
+                      MappedType,
+                      MinEntry,
+                      MaxEntry,
+                      MinLeafEntry,
+                      MaxLeafEntry>;
   using leaf_type = static_leaf_node_t<GeometryType,
                                        KeyType,
                                        MappedType,
                                        MinEntry,
-                                       MaxEntry>;
+                                       MaxEntry,
+                                       MinLeafEntry,
+                                       MaxLeafEntry>;
 
   using size_type = ::rtree::size_type;
 
@@ -57,6 +79,8 @@ public:
 
   template <typename __T>
   using allocator_type = Allocator<__T>;
+  using node_alloc_traits = std::allocator_traits<allocator_type<node_type>>;
+  using leaf_alloc_traits = std::allocator_traits<allocator_type<leaf_type>>;
 
   // type for area
   using area_type = typename geometry_traits<geometry_type>::area_type;
@@ -70,6 +94,12 @@ public:
   constexpr static size_type MIN_ENTRIES = MinEntry;
   static_assert(MIN_ENTRIES <= MAX_ENTRIES / 2, "Invalid MIN_ENTRIES count");
   static_assert(MIN_ENTRIES >= 1, "Invalid MIN_ENTRIES count");
+  // leaf nodes can be sized independently from internal nodes
+  constexpr static size_type MAX_LEAF_ENTRIES = MaxLeafEntry;
+  constexpr static size_type MIN_LEAF_ENTRIES = MinLeafEntry;
+  static_assert(MIN_LEAF_ENTRIES <= MAX_LEAF_ENTRIES / 2,
+                "Invalid MIN_LEAF_ENTRIES count");
+  static_assert(MIN_LEAF_ENTRIES >= 1, "Invalid MIN_LEAF_ENTRIES count");
 
   using iterator = iterator_t<leaf_type>;
   using const_iterator = iterator_t<leaf_type const>;
@@ -80,6 +110,13 @@ public:
   using leaf_iterator = node_iterator_t<leaf_type>;
   using const_leaf_iterator = node_iterator_t<leaf_type const>;
 
+  // order in which defragment() lays out the nodes
+  enum class node_order
+  {
+    depth_first,
+    breadth_first
+  };
+
   template <typename TA, typename TB>
   static bool is_overlap(TA const& a, TB const& b) {
     return traits::is_overlap(a, b);
@@ -126,8 +163,9 @@ protected:
     std::stringstream ss;
     ss << "N" << leaf << " [label = \"";
     for (const auto& child : *leaf) {
-      ss << "R" << id++ <<": ("<<child.first.min_[0]<<", "<<child.first.min_[1]<<
-            ", "<<child.first.max_[0]<<", "<<child.first.max_[1]<<")"<<"|";
+      // key may be a point; read its extent through the traits
+      ss << "R" << id++ <<": ("<<traits::min_point(child.first, 0)<<", "<<traits::min_point(child.first, 1)<<
+            ", "<<traits::max_point(child.first, 0)<<", "<<traits::max_point(child.first, 1)<<")"<<"|";
     }
     ss << "\"];\n";
     file << ss.str();
@@ -164,6 +202,138 @@ protected:
       }
     }
   }
+  // nodes built for a tree that replaces the current one (load,
+  // build_packed); released again unless `keep` is set, also when a codec
+  // or an allocation throws
+  struct built_nodes_t
+  {
+    RTree* tree;
+    std::vector<node_type*> nodes;
+    std::vector<leaf_type*> leaves;
+    bool keep = false;
+
+    explicit built_nodes_t(RTree* tree_)
+        : tree(tree_)
+    {
+    }
+    ~built_nodes_t()
+    {
+      if (keep)
+      {
+        return;
+      }
+      // a null slot is one whose allocation threw
+      for (leaf_type* leaf : leaves)
+      {
+        if (leaf)
+        {
+          tree->destroy_node(leaf);
+        }
+      }
+      for (node_type* node : nodes)
+      {
+        if (node)
+        {
+          tree->destroy_node(node);
+        }
+      }
+    }
+  };
+
+  /*
+   * replace the contents with the entries of [first, last), moved out,
+   * packing them in that order into full leaves and the leaves into full
+   * parents level by level up to a single root. The order should keep near
+   * entries together, e.g. sort-tile-recursive.
+   * When the last node of a level would underflow it shares the entries of
+   * the one before it, so every node but the root holds at least the
+   * minimum.
+   */
+  template <typename Iterator>
+  void build_packed(Iterator first, Iterator last)
+  {
+    // sizes of the nodes `count` entries are cut into
+    auto cut = [](size_type count, size_type max_entries,
+                  size_type min_entries) {
+      std::vector<size_type> sizes(count / max_entries, max_entries);
+      size_type rest = count % max_entries;
+      if (rest > 0)
+      {
+        if (rest < min_entries && sizes.empty() == false)
+        {
+          const size_type both = sizes.back() + rest;
+          sizes.back() = both - both / 2;
+          rest = both / 2;
+        }
+        sizes.push_back(rest);
+      }
+      return sizes;
+    };
+
+    built_nodes_t built(this);
+    std::vector<std::pair<geometry_type, node_base_type*>> level, next;
+    const auto count = static_cast<size_type>(std::distance(first, last));
+    for (size_type size : cut(count, MAX_LEAF_ENTRIES, MIN_LEAF_ENTRIES))
+    {
+      leaf_type* hint = built.leaves.empty() ? nullptr : built.leaves.back();
+      built.leaves.push_back(nullptr);
+      leaf_type* leaf = construct_node<leaf_type>(hint);
+      built.leaves.back() = leaf;
+      for (size_type i = 0; i < size; ++i, ++first)
+      {
+        leaf->insert(std::move(*first));
+      }
+      level.emplace_back(leaf->calculate_bound(), leaf);
+    }
+    if (level.empty())
+    {
+      clear();
+      return;
+    }
+
+    int height = 0;
+    while (level.size() > 1)
+    {
+      next.clear();
+      auto child = level.begin();
+      for (size_type size : cut(static_cast<size_type>(level.size()),
+                                MAX_ENTRIES, MIN_ENTRIES))
+      {
+        node_type* hint = built.nodes.empty() ? nullptr : built.nodes.back();
+        built.nodes.push_back(nullptr);
+        node_type* node = construct_node<node_type>(hint);
+        built.nodes.back() = node;
+        for (size_type i = 0; i < size; ++i, ++child)
+        {
+          node->insert(*child);
+        }
+        next.emplace_back(node->calculate_bound(), node);
+      }
+      level.swap(next);
+      ++height;
+    }
+
+    built.keep = true;
+    delete_if();
+    _root = level.front().second;
+    _leaf_level = height;
+  }
+
+  // clone the nodes of `rhs` with this tree's allocators
+  // this tree must be empty (set_null) before calling
+  void clone_from(RTree const& rhs)
+  {
+    if (rhs._leaf_level == 0)
+    {
+      _root = rhs._root->as_leaf()->clone_recursive(*this);
+      _leaf_level = 0;
+    }
+    else
+    {
+      _root = rhs._root->as_node()->clone_recursive(rhs._leaf_level, *this);
+      _leaf_level = rhs._leaf_level;
+    }
+  }
   void set_null()
   {
     _root = nullptr;
@@ -179,26 +349,41 @@ protected:
     }
   }
 
+public:
+  // entry in [first, last) whose bound needs the least area enlargement to
+  // cover `bound`; ties go to the entry with the smaller area
+  // also used by trees keeping their nodes elsewhere (paged_rtree)
+  template <typename EntryIterator, typename BoundType>
+  static EntryIterator choose_subtree(EntryIterator first,
+                                      EntryIterator last,
+                                      BoundType const& bound) {
+    area_type min_area_enlarge = MAX_AREA;
+    EntryIterator chosen = last;
+    for (auto ci = first; ci != last; ++ci) {
+      const auto area_enlarge = traits::area(traits::merge(ci->first, bound))
+                              - traits::area(ci->first);
+      if (area_enlarge < min_area_enlarge) {
+        min_area_enlarge = area_enlarge;
+        chosen = ci;
+      }
+      else if (area_enlarge == min_area_enlarge) {
+        if (traits::area(ci->first) < traits::area(chosen->first)) {
+          chosen = ci;
+        }
+      }
+    }
+    return chosen;
+  }
+
+protected:
   // search for appropriate node in target_level to insert bound
-  node_type* choose_insert_target(geometry_type const& bound, int target_level) {
+  // bound is either a geometry_type or a key_type
+  template <typename BoundType>
+  node_type* choose_insert_target(BoundType const& bound, int target_level) {
     assert(target_level <= _leaf_level);
     node_type* n = _root->as_node();
     for (int level = 0; level < target_level; ++level) {
-      area_type min_area_enlarge = MAX_AREA;
-      typename node_type::iterator chosen = n->end();
-      for (auto ci = n->begin(); ci != n->end(); ++ci) {
-        const auto area_enlarge = traits::area(traits::merge(ci->first, bound))
-                                - traits::area(ci->first);
-        if (area_enlarge < min_area_enlarge) {
-          min_area_enlarge = area_enlarge;
-          chosen = ci;
-        }
-        else if (area_enlarge == min_area_enlarge) {
-          if (traits::area(ci->first) < traits::area(chosen->first)) {
-            chosen = ci;
-          }
-        }
-      }
+      auto chosen = choose_subtree(n->begin(), n->end(), bound);
       assert(chosen != n->end());
       n = chosen->second->as_node();
     }
@@ -225,7 +410,7 @@ protected:
                    typename NodeType::value_type new_child)
   {
     NodeType* pair = nullptr;
-    if (parent->size() == MAX_ENTRIES) {
+    if (parent->size() == NodeType::MAX_ENTRIES) {
       pair = split(parent, std::move(new_child));
     }
     else {
@@ -251,10 +436,18 @@ protected:
 
   template <typename NodeType>
   NodeType* split(NodeType* node, typename NodeType::value_type child) {
-    NodeType* pair = construct_node<NodeType>();
+    // place the new sibling next to the node being split
+    NodeType* pair = construct_node<NodeType>(node);
+    split(node, std::move(child), pair);
+    return pair;
+  }
+  // distribute the entries of `node` and `child` over `node` and the empty
+  // node `pair`
+  template <typename NodeType>
+  void split(NodeType* node, typename NodeType::value_type child,
+             NodeType* pair) {
     splitter_t spliter;
     spliter(node, std::move(child), pair);
-    return pair;
   }
 
   void reinsert(node_type* node, typename node_type::value_type child)
@@ -297,12 +490,13 @@ protected:
   }
   void reinsert(leaf_type* node, typename leaf_type::value_type child)
   {
-    const size_type reinsert_count = _reinsert_nodes;
+    const size_type reinsert_count
+        = std::min(_reinsert_nodes, MAX_LEAF_ENTRIES - MIN_LEAF_ENTRIES + 1);
 
     geometry_type node_bound = node->calculate_bound();
     node_bound = traits::merge(node_bound, child.first);
     std::vector<typename leaf_type::value_type> children;
-    children.reserve(MAX_ENTRIES + 1);
+    children.reserve(MAX_LEAF_ENTRIES + 1);
     for (auto& c : *node)
     {
       children.emplace_back(std::move(c));
@@ -317,12 +511,12 @@ protected:
                 return traits::distance_center(node_bound, a.first)
                        < traits::distance_center(node_bound, b.first);
               });
-    for (size_type i = 0; i < MAX_ENTRIES + 1 - reinsert_count; ++i)
+    for (size_type i = 0; i < MAX_LEAF_ENTRIES + 1 - reinsert_count; ++i)
     {
       node->insert(std::move(children[i]));
     }
     broadcast_new_bound(node);
-    for (size_type i = MAX_ENTRIES + 1 - reinsert_count; i <= MAX_ENTRIES; ++i)
+    for (size_type i = MAX_LEAF_ENTRIES + 1 - reinsert_count; i <= MAX_LEAF_ENTRIES; ++i)
     {
       auto& c = children[i];
       leaf_type* chosen
@@ -333,6 +527,7 @@ protected:
 
 public:
   // set the number of reinserted nodes
+  // leaf reinsertion additionally clamps it to the leaf capacity
   //@todo miau
   void reinsert_nodes(size_type count)
   {
@@ -393,7 +588,7 @@ public:
     std::vector<erase_reinsert_node_info_t> reinsert_nodes;
 
     node_type* node = leaf->parent();
-    if (leaf->size() < MIN_ENTRIES) {
+    if (leaf->size() < MIN_LEAF_ENTRIES) {
       // delete node from node's parent
       node->erase(leaf);
 
@@ -465,7 +660,7 @@ public:
     std::vector<erase_reinsert_node_info_t> reinsert_nodes;
 
     node_type* node = leaf->parent();
-    if (leaf->size() < MIN_ENTRIES) {
+    if (leaf->size() < MIN_LEAF_ENTRIES) {
       // delete node from node's parent
       node->erase(leaf);
 
@@ -540,47 +735,517 @@ public:
     init_root();
   }
 
+  // move every node into a newly allocated block, visiting nodes in `order`
+  // and passing the previously moved node as placement hint, so with a
+  // hint-aware allocator (e.g. pool_allocator) nodes that are close in that
+  // order end up close in memory.
+  // all iterators are invalidated.
+  void defragment(node_order order = node_order::depth_first)
+  {
+    struct visit_t
+    {
+      node_base_type* node;
+      int level;
+    };
+    // parents always come before their children
+    std::vector<visit_t> nodes;
+    if (order == node_order::breadth_first)
+    {
+      nodes.push_back({ _root, 0 });
+      for (std::size_t i = 0; i < nodes.size(); ++i)
+      {
+        if (nodes[i].level < _leaf_level)
+        {
+          for (auto& c : *nodes[i].node->as_node())
+          {
+            nodes.push_back({ c.second, nodes[i].level + 1 });
+          }
+        }
+      }
+    }
+    else
+    {
+      std::vector<visit_t> stack;
+      stack.push_back({ _root, 0 });
+      while (stack.empty() == false)
+      {
+        const visit_t v = stack.back();
+        stack.pop_back();
+        nodes.push_back(v);
+        if (v.level < _leaf_level)
+        {
+          node_type* n = v.node->as_node();
+          for (size_type i = n->size(); i > 0; --i)
+          {
+            stack.push_back({ n->at(i - 1).second, v.level + 1 });
+          }
+        }
+      }
+    }
+
+    // allocate every new node before releasing any old one,
+    // so freed blocks are not scattered into the new layout
+    std::vector<node_base_type*> moved(nodes.size());
+    node_type* node_hint = nullptr;
+    leaf_type* leaf_hint = nullptr;
+    for (std::size_t i = 0; i < nodes.size(); ++i)
+    {
+      if (nodes[i].level < _leaf_level)
+      {
+        node_hint = construct_node<node_type>(node_hint);
+        moved[i] = node_hint;
+      }
+      else
+      {
+        leaf_hint = construct_node<leaf_type>(leaf_hint);
+        moved[i] = leaf_hint;
+      }
+    }
+
+    for (std::size_t i = 0; i < nodes.size(); ++i)
+    {
+      node_base_type* from = nodes[i].node;
+      node_base_type* to = moved[i];
+      // parent is already moved and has set from->_parent to its new block
+      to->_parent = from->_parent;
+      to->_index_on_parent = from->_index_on_parent;
+      if (to->_parent)
+      {
+        to->_parent->at(to->_index_on_parent).second = to;
+      }
+      if (nodes[i].level < _leaf_level)
+      {
+        to->as_node()->_children = std::move(from->as_node()->_children);
+        for (auto& c : *to->as_node())
+        {
+          c.second->_parent = to->as_node();
+        }
+      }
+      else
+      {
+        to->as_leaf()->_children = std::move(from->as_leaf()->_children);
+      }
+    }
+    _root = moved[0];
+
+    for (std::size_t i = 0; i < nodes.size(); ++i)
+    {
+      if (nodes[i].level < _leaf_level)
+      {
+        destroy_node(nodes[i].node->as_node());
+      }
+      else
+      {
+        destroy_node(nodes[i].node->as_leaf());
+      }
+    }
+  }
+
+  using scalar_type = std::decay_t<decltype(traits::min_point(
+      std::declval<geometry_type const&>(), 0))>;
+  // packs leaves for leaf_encoding::delta
+  using leaf_codec_type = delta_leaf_codec_t<key_type,
+                                             mapped_type,
+                                             scalar_type,
+                                             traits::DIM>;
+
+protected:
+  // leaves are delta coded against the min corner of their bound
+  static typename leaf_codec_type::reference_type
+  leaf_reference(leaf_type const* leaf)
+  {
+    typename leaf_codec_type::reference_type reference {};
+    if (leaf->parent())
+    {
+      for (int axis = 0; axis < traits::DIM; ++axis)
+      {
+        reference[axis] = traits::min_point(leaf->entry().first, axis);
+      }
+    }
+    return reference;
+  }
+  template <typename Codec>
+  constexpr static bool pack_mapped()
+  {
+    return leaf_codec_type::PACK_MAPPED
+           && std::is_same<Codec, raw_codec_t<mapped_type>>::value;
+  }
+  template <typename Codec>
+  static void write_packed_leaf(binary_writer_t& writer,
+                                leaf_type const* leaf,
+                                Codec const& codec,
+                                std::vector<unsigned char>& packed)
+  {
+    if constexpr (leaf_codec_type::SUPPORTED)
+    {
+      const auto reference = leaf_reference(leaf);
+      packed.clear();
+      for (auto const& c : *leaf)
+      {
+        leaf_codec_type::encode_key(reference, c.first, packed);
+      }
+      if constexpr (pack_mapped<Codec>())
+      {
+        mapped_type previous = 0;
+        for (auto const& c : *leaf)
+        {
+          leaf_codec_type::encode_mapped(previous, c.second, packed);
+          previous = c.second;
+        }
+      }
+      const std::uint32_t count = leaf->size();
+      const std::uint32_t bytes = static_cast<std::uint32_t>(packed.size());
+      writer.write(count);
+      writer.write(bytes);
+      writer.write_bytes(packed.data(), packed.size());
+      if constexpr (pack_mapped<Codec>() == false)
+      {
+        for (auto const& c : *leaf)
+        {
+          codec.write(writer, c.second);
+        }
+      }
+    }
+  }
+  template <typename Codec>
+  bool read_packed_leaf(binary_reader_t& reader,
+                        leaf_type* leaf,
+                        std::uint32_t count,
+                        Codec const& codec,
+                        std::vector<unsigned char>& packed)
+  {
+    if constexpr (leaf_codec_type::SUPPORTED)
+    {
+      std::uint32_t bytes;
+      if (!reader.read(bytes)
+          || bytes > count * leaf_codec_type::MAX_ENTRY_BYTES)
+      {
+        return false;
+      }
+      packed.resize(bytes);
+      if (!reader.read_bytes(packed.data(), bytes))
+      {
+        return false;
+      }
+      const auto reference = leaf_reference(leaf);
+      unsigned char const* p = packed.data();
+      unsigned char const* const end = p + packed.size();
+      std::vector<raw_storage_t<key_type>> keys(count);
+      std::vector<mapped_type> mapped(count);
+      for (std::uint32_t i = 0; i < count; ++i)
+      {
+        if (!leaf_codec_type::decode_key(reference, p, end, keys[i]))
+        {
+          return false;
+        }
+      }
+      if constexpr (pack_mapped<Codec>())
+      {
+        mapped_type previous = 0;
+        for (std::uint32_t i = 0; i < count; ++i)
+        {
+          if (!leaf_codec_type::decode_mapped(p, end, previous, mapped[i]))
+          {
+            return false;
+          }
+          previous = mapped[i];
+        }
+      }
+      if (p != end)
+      {
+        return false;
+      }
+      if constexpr (pack_mapped<Codec>() == false)
+      {
+        for (std::uint32_t i = 0; i < count; ++i)
+        {
+          if (!codec.read(reader, mapped[i]))
+          {
+            return false;
+          }
+        }
+      }
+      for (std::uint32_t i = 0; i < count; ++i)
+      {
+        leaf->insert(value_type(keys[i].get(), std::move(mapped[i])));
+      }
+      return true;
+    }
+    return false;
+  }
+
+public:
+  /*
+   * write the tree to `out` in the binary format of serialized_header_t:
+   * nodes level by level from the root, mapped values through `codec`
+   * (see raw_codec_t), then a checksum of everything written.
+   * bounds and keys are written raw, so files are only readable by the
+   * same RTree instantiation on a machine of the same byte order.
+   * leaf_encoding::delta packs leaves with leaf_codec_type instead, which
+   * needs leaf_codec_type::SUPPORTED.
+   * returns false if the stream failed or the encoding is not supported.
+   */
+  template <typename Codec = raw_codec_t<mapped_type>>
+  bool save(std::ostream& out,
+            Codec const& codec = Codec(),
+            leaf_encoding encoding = leaf_encoding::raw) const
+  {
+    if (encoding == leaf_encoding::delta
+        && leaf_codec_type::SUPPORTED == false)
+    {
+      return false;
+    }
+    binary_writer_t writer(out);
+    std::vector<unsigned char> packed;
+    serialized_header_t header;
+    header.encoding = encoding;
+    header.geometry_bytes = sizeof(geometry_type);
+    header.key_bytes = sizeof(key_type);
+    header.max_entries = MAX_ENTRIES;
+    header.max_leaf_entries = MAX_LEAF_ENTRIES;
+    header.leaf_level = _leaf_level;
+    header.size = size();
+    writer.write(header);
+
+    std::vector<node_base_type const*> level, next;
+    level.push_back(_root);
+    for (int l = 0; l <= _leaf_level; ++l)
+    {
+      next.clear();
+      for (node_base_type const* n : level)
+      {
+        if (l < _leaf_level)
+        {
+          const std::uint32_t count = n->as_node()->size();
+          writer.write(count);
+          for (auto const& c : *n->as_node())
+          {
+            writer.write(c.first);
+            next.push_back(c.second);
+          }
+        }
+        else if (encoding == leaf_encoding::delta)
+        {
+          write_packed_leaf(writer, n->as_leaf(), codec, packed);
+        }
+        else
+        {
+          const std::uint32_t count = n->as_leaf()->size();
+          writer.write(count);
+          for (auto const& c : *n->as_leaf())
+          {
+            writer.write(c.first);
+            codec.write(writer, c.second);
+          }
+        }
+      }
+      level.swap(next);
+    }
+    const std::uint64_t checksum = writer.checksum();
+    writer.write(checksum);
+    return writer.good();
+  }
+
+  /*
+   * replace the contents of this tree with a tree written by save().
+   * nodes are rebuilt directly, level by level, each allocated next to the
+   * previous one of its kind; mapped values are read into default
+   * constructed mapped_type through `codec`.
+   * returns false, leaving the tree unchanged, if the input is truncated,
+   * corrupt (checksum), or from another format version, byte order or
+   * key / bound type, or has nodes larger than this tree's fanout.
+   */
+  template <typename Codec = raw_codec_t<mapped_type>>
+  bool load(std::istream& in, Codec const& codec = Codec())
+  {
+    binary_reader_t reader(in);
+    serialized_header_t header;
+    if (!reader.read_bytes(&header, serialized_header_t::V1_BYTES)
+        || header.magic != serialized_header_t::MAGIC || header.version < 1
+        || header.version > serialized_header_t::VERSION
+        || (header.version >= 2
+            && !reader.read_bytes(reinterpret_cast<unsigned char*>(&header)
+                                      + serialized_header_t::V1_BYTES,
+                                  sizeof(header)
+                                      - serialized_header_t::V1_BYTES))
+        || (header.encoding != leaf_encoding::raw
+            && (header.encoding != leaf_encoding::delta
+                || leaf_codec_type::SUPPORTED == false))
+        || header.endian != serialized_header_t::ENDIAN_TAG
+        || header.geometry_bytes != sizeof(geometry_type)
+        || header.key_bytes != sizeof(key_type) || header.leaf_level < 0
+        || header.leaf_level > 64)
+    {
+      return false;
+    }
+
+    // every node built so far; released again unless the load completes,
+    // also when a codec or an allocation throws
+    built_nodes_t built(this);
+    std::vector<node_type*>& nodes = built.nodes;
+    std::vector<leaf_type*>& leaves = built.leaves;
+    auto fail = [] { return false; };
+    auto new_node = [&](int level) -> node_base_type* {
+      if (level < header.leaf_level)
+      {
+        // the slot first, so a node is never allocated without an owner
+        node_type* hint = nodes.empty() ? nullptr : nodes.back();
+        nodes.push_back(nullptr);
+        nodes.back() = construct_node<node_type>(hint);
+        return nodes.back();
+      }
+      leaf_type* hint = leaves.empty() ? nullptr : leaves.back();
+      leaves.push_back(nullptr);
+      leaves.back() = construct_node<leaf_type>(hint);
+      return leaves.back();
+    };
+
+    node_base_type* root = new_node(0);
+    std::vector<node_base_type*> level, next;
+    std::vector<unsigned char> packed;
+    level.push_back(root);
+    std::uint64_t entries = 0;
+    for (int l = 0; l <= header.leaf_level; ++l)
+    {
+      next.clear();
+      for (node_base_type* n : level)
+      {
+        std::uint32_t count;
+        if (!reader.read(count))
+        {
+          return fail();
+        }
+        if (l < header.leaf_level)
+        {
+          if (count == 0 || count > MAX_ENTRIES)
+          {
+            return fail();
+          }
+          for (std::uint32_t i = 0; i < count; ++i)
+          {
+            raw_storage_t<geometry_type> bound;
+            if (!bound.read(reader))
+            {
+              return fail();
+            }
+            node_base_type* child = new_node(l + 1);
+            n->as_node()->insert({ bound.get(), child });
+            next.push_back(child);
+          }
+        }
+        else
+        {
+          if (count > MAX_LEAF_ENTRIES)
+          {
+            return fail();
+          }
+          if (header.encoding == leaf_encoding::delta)
+          {
+            if (!read_packed_leaf(reader, n->as_leaf(), count, codec, packed))
+            {
+              return fail();
+            }
+            entries += count;
+            continue;
+          }
+          for (std::uint32_t i = 0; i < count; ++i)
+          {
+            raw_storage_t<key_type> key;
+            mapped_type mapped;
+            if (!key.read(reader) || !codec.read(reader, mapped))
+            {
+              return fail();
+            }
+            n->as_leaf()->insert(value_type(key.get(), std::move(mapped)));
+            ++entries;
+          }
+        }
+      }
+      level.swap(next);
+    }
+    const std::uint64_t expected = reader.checksum();
+    std::uint64_t checksum;
+    if (!reader.read(checksum) || checksum != expected
+        || entries != header.size)
+    {
+      return fail();
+    }
+
+    built.keep = true;
+    delete_if();
+    _root = root;
+    _leaf_level = header.leaf_level;
+    return true;
+  }
+
   RTree()
   {
     init_root();
     reinsert_nodes(static_cast<size_type>(0.3 * MAX_ENTRIES));
   }
+  // all nodes are allocated from (copies of) `alloc`;
+  // e.g. a std::pmr::polymorphic_allocator bound to a memory resource
+  explicit RTree(allocator_type<value_type> const& alloc)
+      : _node_allocator(alloc)
+      , _leaf_allocator(alloc)
+  {
+    init_root();
+    reinsert_nodes(static_cast<size_type>(0.3 * MAX_ENTRIES));
+  }
+  RTree(allocator_type<node_type> const& node_alloc,
+        allocator_type<leaf_type> const& leaf_alloc)
+      : _node_allocator(node_alloc)
+      , _leaf_allocator(leaf_alloc)
+  {
+    init_root();
+    reinsert_nodes(static_cast<size_type>(0.3 * MAX_ENTRIES));
+  }
 
   // @TODO
   // mapped_type copy-assignable
   RTree(RTree const& rhs)
+      : _node_allocator(node_alloc_traits::select_on_container_copy_construction(
+          rhs._node_allocator))
+      , _leaf_allocator(leaf_alloc_traits::select_on_container_copy_construction(
+          rhs._leaf_allocator))
   {
     _reinsert_nodes = rhs._reinsert_nodes;
-    if (rhs._leaf_level == 0)
-    {
-      _root = rhs._root->as_leaf()->clone_recursive(*this);
-      _leaf_level = 0;
-    }
-    else
-    {
-      _root = rhs._root->as_node()->clone_recursive(rhs._leaf_level, *this);
-      _leaf_level = rhs._leaf_level;
-    }
+    clone_from(rhs);
+  }
+  RTree(RTree const& rhs, allocator_type<value_type> const& alloc)
+      : _node_allocator(alloc)
+      , _leaf_allocator(alloc)
+  {
+    _reinsert_nodes = rhs._reinsert_nodes;
+    clone_from(rhs);
   }
   // @TODO
   // mapped_type copy-assignable
   RTree& operator=(RTree const& rhs)
   {
+    if (this == &rhs)
+    {
+      return *this;
+    }
     delete_if();
-    if (rhs._leaf_level == 0)
+    set_null();
+    if constexpr (node_alloc_traits::propagate_on_container_copy_assignment::value)
     {
-      _root = rhs._root->as_leaf()->clone_recursive(*this);
-      _leaf_level = 0;
+      _node_allocator = rhs._node_allocator;
     }
-    else
+    if constexpr (leaf_alloc_traits::propagate_on_container_copy_assignment::value)
     {
-      _root = rhs._root->as_node()->clone_recursive(rhs._leaf_level, *this);
-      _leaf_level = rhs._leaf_level;
+      _leaf_allocator = rhs._leaf_allocator;
     }
+    clone_from(rhs);
     _reinsert_nodes = rhs._reinsert_nodes;
     return *this;
   }
+  // allocators are copied rather than moved, since `rhs` keeps allocating
+  // its new empty root from them
   RTree(RTree&& rhs)
+      : _node_allocator(rhs._node_allocator)
+      , _leaf_allocator(rhs._leaf_allocator)
   {
     _reinsert_nodes = rhs._reinsert_nodes;
     _root = rhs._root;
@@ -590,7 +1255,31 @@ public:
   }
   RTree& operator=(RTree&& rhs)
   {
+    if (this == &rhs)
+    {
+      return *this;
+    }
     delete_if();
+    set_null();
+    if constexpr (node_alloc_traits::propagate_on_container_move_assignment::value
+                  && leaf_alloc_traits::propagate_on_container_move_assignment::value)
+    {
+      _node_allocator = rhs._node_allocator;
+      _leaf_allocator = rhs._leaf_allocator;
+    }
+    else
+    {
+      // nodes of `rhs` can not be released by our allocators;
+      // fall back to copying them
+      if (!(_node_allocator == rhs._node_allocator)
+          || !(_leaf_allocator == rhs._leaf_allocator))
+      {
+        clone_from(rhs);
+        _reinsert_nodes = rhs._reinsert_nodes;
+        rhs.clear();
+        return *this;
+      }
+    }
     _root = rhs._root;
     _leaf_level = rhs._leaf_level;
     _reinsert_nodes = rhs._reinsert_nodes;
@@ -748,30 +1437,46 @@ public:
   {
     return _leaf_allocator;
   }
+  auto const& node_allocator() const
+  {
+    return _node_allocator;
+  }
+  auto const& leaf_allocator() const
+  {
+    return _leaf_allocator;
+  }
+  allocator_type<value_type> get_allocator() const
+  {
+    return allocator_type<value_type>(_leaf_allocator);
+  }
 
+  // `hint` is an existing node of the same kind that the new node should be
+  // placed close to; it is forwarded to the allocator and may be ignored
   template <typename NodeType>
   typename std::enable_if<std::is_same<NodeType, node_type>::value,
                           NodeType*>::type
-  construct_node()
+  construct_node(NodeType const* hint = nullptr)
   {
-    return new (node_allocator().allocate(1)) NodeType;
+    return new (node_alloc_traits::allocate(node_allocator(), 1, hint))
+        NodeType;
   }
   template <typename NodeType>
   typename std::enable_if<std::is_same<NodeType, leaf_type>::value,
                           NodeType*>::type
-  construct_node()
+  construct_node(NodeType const* hint = nullptr)
   {
-    return new (leaf_allocator().allocate(1)) NodeType;
+    return new (leaf_alloc_traits::allocate(leaf_allocator(), 1, hint))
+        NodeType;
   }
   void destroy_node(node_type* node)
   {
     node->~node_type();
-    node_allocator().deallocate(node, 1);
+    node_alloc_traits::deallocate(node_allocator(), node, 1);
   }
   void destroy_node(leaf_type* node)
   {
     node->~leaf_type();
-    leaf_allocator().deallocate(node, 1);
+    leaf_alloc_traits::deallocate(leaf_allocator(), node, 1);
   }
 
 protected:
@@ -900,6 +1605,106 @@ public:
                            functor);
   }
 
+  // rough number of entries a search of `search_range` visits: for every
+  // overlapping entry of the root, the overlapping fraction of its area
+  // times the size of a subtree filled to (m+M)/2
+  template <typename _GeometryType>
+  size_type estimate_overlap(_GeometryType const& search_range) const
+  {
+    if (_leaf_level == 0)
+    {
+      return root()->as_leaf()->size();
+    }
+    double subtree = (MIN_LEAF_ENTRIES + MAX_LEAF_ENTRIES) / 2.0;
+    for (int level = 1; level < _leaf_level; ++level)
+    {
+      subtree *= (MIN_ENTRIES + MAX_ENTRIES) / 2.0;
+    }
+    double estimate = 0;
+    for (auto const& c : *root()->as_node())
+    {
+      if (traits::is_overlap(c.first, search_range) == false)
+      {
+        continue;
+      }
+      const double area = static_cast<double>(traits::area(c.first));
+      const double covered = static_cast<double>(
+          traits::area(traits::intersection(c.first, search_range)));
+      estimate += subtree * (area > 0 ? covered / area : 1.0);
+    }
+    return static_cast<size_type>(estimate);
+  }
+
+public:
+  /*
+   * visit the (at most) `k` entries nearest to `query` (a point or a bound)
+   * in increasing traits::min_distance order; ties in no particular order.
+   * best-first search: nodes and leaf entries share one min-heap keyed on
+   * their distance to `query`, so only nodes closer than the k-th result
+   * are ever opened.
+   * `functor(value_type const&)` returning true stops the search.
+   */
+  template <typename QueryType, typename Functor>
+  void search_nearest(QueryType const& query, size_type k, Functor functor) const
+  {
+    using distance_type = decltype(traits::min_distance(
+        std::declval<geometry_type const&>(), query));
+    struct candidate_t
+    {
+      distance_type distance;
+      // subtree `height` levels above the leaves, or an entry if null
+      node_base_type const* node;
+      value_type const* entry;
+      int height;
+
+      bool operator<(candidate_t const& rhs) const
+      {
+        // reversed, std heaps are max-heaps
+        return rhs.distance < distance;
+      }
+    };
+
+    if (k == 0 || _root == nullptr)
+    {
+      return;
+    }
+    std::vector<candidate_t> heap;
+    heap.push_back({ distance_type {}, _root, nullptr, _leaf_level });
+    while (heap.empty() == false)
+    {
+      std::pop_heap(heap.begin(), heap.end());
+      const candidate_t top = heap.back();
+      heap.pop_back();
+      if (top.entry)
+      {
+        if (functor(*top.entry) || --k == 0)
+        {
+          return;
+        }
+      }
+      else if (top.height == 0)
+      {
+        for (auto const& c : *top.node->as_leaf())
+        {
+          heap.push_back(
+              { traits::min_distance(c.first, query), nullptr, &c, 0 });
+          std::push_heap(heap.begin(), heap.end());
+        }
+      }
+      else
+      {
+        for (auto const& c : *top.node->as_node())
+        {
+          heap.push_back({ traits::min_distance(c.first, query), c.second,
+                           nullptr, top.height - 1 });
+          std::push_heap(heap.begin(), heap.end());
+        }
+      }
+    }
+  }
+
+public:
+
   struct flatten_node_t
   {
     // offset in global dense buffer
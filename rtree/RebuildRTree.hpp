@@ -0,0 +1,305 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "ConcurrentRTree.hpp"
+#include "Global.hpp"
+
+namespace rtree
+{
+
+/*
+ * rebuilding_rtree works like concurrent_rtree and can also rebuild a
+ * better packed copy of its tree on a background thread while it keeps
+ * serving queries and writes.
+ * rebuild_async() copies the entries (begin() .. end()) under the shared
+ * lock and starts logging writes, then, on its own thread, sorts the
+ * copies into sort-tile-recursive order and packs them, in that order,
+ * into the full leaves and parents of a new tree. The write log is replayed
+ * onto the new tree in rounds without any lock until it is short, the last
+ * round runs under the exclusive lock right before the new tree is moved
+ * in place of the live one.
+ * rebuild_async() and wait() must be called from a single thread.
+ * Functors passed to the queries run while the lock is held and must not
+ * call back into this object.
+ */
+template <typename TreeType, typename MutexType = distributed_shared_mutex>
+class rebuilding_rtree
+{
+public:
+  using tree_type = TreeType;
+  using mutex_type = MutexType;
+  using size_type = typename TreeType::size_type;
+  using geometry_type = typename TreeType::geometry_type;
+  using traits = typename TreeType::traits;
+  using key_type = typename TreeType::key_type;
+  using mapped_type = typename TreeType::mapped_type;
+  using value_type = typename TreeType::value_type;
+
+  // log rounds replayed without the lock before the final swap, at most
+  constexpr static int MAX_REPLAY_ROUNDS = 4;
+  // the final round runs under the exclusive lock once the log is this short
+  constexpr static size_type SWAP_LOG_SIZE = 256;
+
+protected:
+  enum class op_kind
+  {
+    insert,
+    erase
+  };
+  struct op_t
+  {
+    op_kind kind;
+    value_type value;
+  };
+
+  TreeType _tree;
+  mutable MutexType _mutex;
+
+  // writes made while a rebuild is running; guarded by _log_mutex,
+  // _logging is only changed while holding both locks.
+  // a clear() drops the log and sets _log_cleared instead
+  std::vector<op_t> _log;
+  bool _log_cleared = false;
+  bool _logging = false;
+  std::mutex _log_mutex;
+
+  std::thread _worker;
+  std::atomic<bool> _rebuilding { false };
+  std::atomic<size_type> _rebuilds { 0 };
+
+  // called with the exclusive lock held
+  void log(op_kind kind, value_type const& value)
+  {
+    std::lock_guard<std::mutex> lock(_log_mutex);
+    if (_logging)
+    {
+      _log.push_back({ kind, value });
+    }
+  }
+  static void replay(TreeType& tree, bool cleared, std::vector<op_t>& ops)
+  {
+    if (cleared)
+    {
+      tree.clear();
+    }
+    for (op_t& op : ops)
+    {
+      switch (op.kind)
+      {
+      case op_kind::insert:
+        tree.insert(std::move(op.value));
+        break;
+      case op_kind::erase:
+        tree.deleteEntrie(op.value);
+        break;
+      }
+    }
+    ops.clear();
+  }
+
+  template <typename _KeyType>
+  static double center(_KeyType const& key, int axis)
+  {
+    return (static_cast<double>(traits::min_point(key, axis))
+            + static_cast<double>(traits::max_point(key, axis)))
+           / 2;
+  }
+  // sort-tile-recursive order: sort on `axis`, cut into slices holding a
+  // whole number of leaves and sort every slice on the next axis
+  static void sort_tile(typename std::vector<value_type>::iterator first,
+                        typename std::vector<value_type>::iterator last,
+                        int axis)
+  {
+    std::sort(first, last, [axis](value_type const& a, value_type const& b) {
+      return center(a.first, axis) < center(b.first, axis);
+    });
+    if (axis + 1 >= traits::DIM)
+    {
+      return;
+    }
+    const double count = static_cast<double>(last - first);
+    const double leaves
+        = std::ceil(count / static_cast<double>(TreeType::MAX_LEAF_ENTRIES));
+    const double slices
+        = std::ceil(std::pow(leaves, 1.0 / (traits::DIM - axis)));
+    const auto slice_size = static_cast<std::ptrdiff_t>(
+        std::ceil(leaves / slices) * TreeType::MAX_LEAF_ENTRIES);
+    while (first != last)
+    {
+      auto slice_last = last - first > slice_size ? first + slice_size : last;
+      sort_tile(first, slice_last, axis + 1);
+      first = slice_last;
+    }
+  }
+
+  void run_rebuild(std::vector<value_type> entries)
+  {
+    sort_tile(entries.begin(), entries.end(), 0);
+    TreeType fresh;
+    fresh.build_packed(entries.begin(), entries.end());
+    entries.clear();
+    entries.shrink_to_fit();
+
+    std::vector<op_t> ops;
+    bool cleared = false;
+    // take the log (and its clear flag) for replay
+    auto take_log = [&] {
+      ops.swap(_log);
+      cleared = _log_cleared;
+      _log_cleared = false;
+    };
+    for (int round = 0; round < MAX_REPLAY_ROUNDS; ++round)
+    {
+      {
+        std::lock_guard<std::mutex> lock(_log_mutex);
+        if (_log.size() <= SWAP_LOG_SIZE && _log_cleared == false)
+        {
+          break;
+        }
+        take_log();
+      }
+      replay(fresh, cleared, ops);
+    }
+
+    TreeType old;
+    {
+      std::unique_lock<MutexType> lock(_mutex);
+      {
+        std::lock_guard<std::mutex> log_lock(_log_mutex);
+        take_log();
+        _logging = false;
+      }
+      replay(fresh, cleared, ops);
+      old = std::move(_tree);
+      _tree = std::move(fresh);
+    }
+    // old nodes are released outside the lock
+    _rebuilds.fetch_add(1, std::memory_order_relaxed);
+    _rebuilding.store(false, std::memory_order_release);
+  }
+
+public:
+  rebuilding_rtree() = default;
+  explicit rebuilding_rtree(TreeType tree)
+      : _tree(std::move(tree))
+  {
+  }
+  rebuilding_rtree(rebuilding_rtree const&) = delete;
+  rebuilding_rtree& operator=(rebuilding_rtree const&) = delete;
+  ~rebuilding_rtree()
+  {
+    wait();
+  }
+
+  // start a background rebuild; false if one is already running
+  bool rebuild_async()
+  {
+    if (_rebuilding.exchange(true, std::memory_order_acq_rel))
+    {
+      return false;
+    }
+    if (_worker.joinable())
+    {
+      _worker.join();
+    }
+    std::vector<value_type> entries;
+    {
+      std::shared_lock<MutexType> lock(_mutex);
+      TreeType const& tree = _tree;
+      entries.assign(tree.begin(), tree.end());
+      // no writer holds the exclusive lock, so no write is lost in between
+      std::lock_guard<std::mutex> log_lock(_log_mutex);
+      _logging = true;
+    }
+    _worker = std::thread(
+        [this, entries = std::move(entries)]() mutable {
+          run_rebuild(std::move(entries));
+        });
+    return true;
+  }
+  // block until the running rebuild, if any, has been swapped in
+  void wait()
+  {
+    if (_worker.joinable())
+    {
+      _worker.join();
+    }
+  }
+  bool rebuilding() const
+  {
+    return _rebuilding.load(std::memory_order_acquire);
+  }
+  // number of rebuilds swapped in so far
+  size_type rebuilds() const
+  {
+    return _rebuilds.load(std::memory_order_relaxed);
+  }
+
+  void insert(value_type new_val)
+  {
+    std::unique_lock<MutexType> lock(_mutex);
+    log(op_kind::insert, new_val);
+    _tree.insert(std::move(new_val));
+  }
+  template <typename... Args>
+  void emplace(Args&&... args)
+  {
+    insert(value_type(std::forward<Args>(args)...));
+  }
+  void deleteEntrie(value_type const& entrie)
+  {
+    std::unique_lock<MutexType> lock(_mutex);
+    log(op_kind::erase, entrie);
+    _tree.deleteEntrie(entrie);
+  }
+  void clear()
+  {
+    std::unique_lock<MutexType> lock(_mutex);
+    {
+      std::lock_guard<std::mutex> log_lock(_log_mutex);
+      if (_logging)
+      {
+        // nothing logged before a clear matters
+        _log.clear();
+        _log_cleared = true;
+      }
+    }
+    _tree.clear();
+  }
+
+  template <typename _GeometryType, typename Functor>
+  void search_inside(_GeometryType const& search_range, Functor functor) const
+  {
+    std::shared_lock<MutexType> lock(_mutex);
+    _tree.search_inside(search_range, functor);
+  }
+  template <typename _GeometryType, typename Functor>
+  void search_overlap(_GeometryType const& search_range, Functor functor) const
+  {
+    std::shared_lock<MutexType> lock(_mutex);
+    _tree.search_overlap(search_range, functor);
+  }
+  size_type size() const
+  {
+    std::shared_lock<MutexType> lock(_mutex);
+    return _tree.size();
+  }
+
+  // run `functor(tree_type const&)` under the shared lock
+  template <typename Functor>
+  decltype(auto) read(Functor functor) const
+  {
+    std::shared_lock<MutexType> lock(_mutex);
+    return functor(static_cast<TreeType const&>(_tree));
+  }
+};
+
+}
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <type_traits>
+
+#include "Global.hpp"
+#include "StaticVector.hpp"
+
+namespace rtree {
+
+// FNV-1a, 64 bit
+struct checksum_t {
+  std::uint64_t value = 14695981039346656037ull;
+
+  void update(void const* data, std::size_t bytes) {
+    unsigned char const* p = static_cast<unsigned char const*>(data);
+    for (std::size_t i = 0; i < bytes; ++i) {
+      value = (value ^ p[i]) * 1099511628211ull;
+    }
+  }
+};
+
+/*
+ * binary_writer_t / binary_reader_t write and read raw bytes in host byte
+ * order to a std::ostream / std::istream, keeping a checksum of every byte
+ * that went through them.
+ */
+class binary_writer_t {
+protected:
+  std::ostream& _out;
+  checksum_t _checksum;
+
+public:
+  explicit binary_writer_t(std::ostream& out)
+      : _out(out)
+  {
+  }
+
+  void write_bytes(void const* data, std::size_t bytes) {
+    _checksum.update(data, bytes);
+    _out.write(static_cast<char const*>(data),
+               static_cast<std::streamsize>(bytes));
+  }
+  template <typename T>
+  void write(T const& value) {
+    static_assert(is_bitwise_copyable<T>::value,
+                  "only bitwise copyable types are written raw");
+    write_bytes(&value, sizeof(T));
+  }
+
+  std::uint64_t checksum() const {
+    return _checksum.value;
+  }
+  bool good() const {
+    return _out.good();
+  }
+};
+
+class binary_reader_t {
+protected:
+  std::istream& _in;
+  checksum_t _checksum;
+
+public:
+  explicit binary_reader_t(std::istream& in)
+      : _in(in)
+  {
+  }
+
+  bool read_bytes(void* data, std::size_t bytes) {
+    if (!_in.read(static_cast<char*>(data), static_cast<std::streamsize>(bytes))) {
+      return false;
+    }
+    _checksum.update(data, bytes);
+    return true;
+  }
+  template <typename T>
+  bool read(T& value) {
+    static_assert(is_bitwise_copyable<T>::value,
+                  "only bitwise copyable types are read raw");
+    return read_bytes(&value, sizeof(T));
+  }
+
+  std::uint64_t checksum() const {
+    return _checksum.value;
+  }
+};
+
+// storage for a bitwise copyable T that need not be default constructible
+template <typename T>
+struct raw_storage_t {
+  alignas(T) unsigned char bytes[sizeof(T)];
+
+  bool read(binary_reader_t& in) {
+    return in.read_bytes(bytes, sizeof(T));
+  }
+  T const& get() const {
+    return *reinterpret_cast<T const*>(bytes);
+  }
+};
+
+/*
+ * codecs for RTree::save / RTree::load; a codec writes a mapped_type with
+ *   void write(binary_writer_t&, T const&)
+ * and reads it back into a default constructed T with
+ *   bool read(binary_reader_t&, T&)
+ */
+template <typename T>
+struct raw_codec_t {
+  void write(binary_writer_t& out, T const& value) const {
+    out.write(value);
+  }
+  bool read(binary_reader_t& in, T& value) const {
+    return in.read(value);
+  }
+};
+
+// length prefixed std::string
+struct string_codec_t {
+  void write(binary_writer_t& out, std::string const& value) const {
+    const std::uint64_t length = value.size();
+    out.write(length);
+    out.write_bytes(value.data(), value.size());
+  }
+  bool read(binary_reader_t& in, std::string& value) const {
+    std::uint64_t length;
+    if (!in.read(length)) {
+      return false;
+    }
+    // the length is not checked by the checksum yet: grow the string as
+    // the bytes arrive, so a corrupt length fails at the end of the stream
+    // instead of allocating it up front
+    if (length > value.max_size()) {
+      return false;
+    }
+    constexpr std::size_t CHUNK = 1 << 16;
+    value.clear();
+    while (value.size() < length) {
+      const std::size_t offset = value.size();
+      const std::size_t bytes = static_cast<std::size_t>(
+          length - offset < CHUNK ? length - offset : CHUNK);
+      value.resize(offset + bytes);
+      if (!in.read_bytes(&value[offset], bytes)) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+// how RTree::save writes leaf entries
+enum class leaf_encoding : std::uint32_t {
+  // key raw, mapped value through the codec
+  raw = 0,
+  // delta_leaf_codec_t (see LeafCodec.hpp)
+  delta = 1
+};
+
+/*
+ * header of the binary format written by RTree::save
+ * followed by the nodes level by level from the root, each as a uint32
+ * entry count and its entries (bounds for internal nodes, key and encoded
+ * mapped value for leaves), and by the uint64 checksum of everything
+ * before it.
+ * with leaf_encoding::delta a leaf's count is followed by the uint32 size
+ * of the packed keys (and integer mapped values) and those bytes; mapped
+ * values that are not packed follow them through the codec.
+ * version 1 ends before leaf_encoding and always has raw leaves.
+ */
+struct serialized_header_t {
+  constexpr static std::uint32_t MAGIC = 0x45525452; // "RTRE" little endian
+  constexpr static std::uint32_t VERSION = 2;
+  // read back as 0x04030201 on a machine of the other byte order
+  constexpr static std::uint32_t ENDIAN_TAG = 0x01020304;
+
+  std::uint32_t magic = MAGIC;
+  std::uint32_t version = VERSION;
+  std::uint32_t endian = ENDIAN_TAG;
+  std::uint32_t geometry_bytes = 0;
+  std::uint32_t key_bytes = 0;
+  std::uint32_t max_entries = 0;
+  std::uint32_t max_leaf_entries = 0;
+  std::int32_t leaf_level = 0;
+  std::uint64_t size = 0;
+  // version 2
+  leaf_encoding encoding = leaf_encoding::raw;
+  std::uint32_t reserved = 0;
+
+  // bytes of a version 1 header
+  constexpr static std::size_t V1_BYTES = 40;
+};
+static_assert(offsetof(serialized_header_t, encoding)
+                  == serialized_header_t::V1_BYTES,
+              "version 2 fields must follow the version 1 header");
+
+}
@@ -0,0 +1,288 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <utility>
+
+#include "ConcurrentRTree.hpp"
+#include "Global.hpp"
+
+namespace rtree
+{
+
+/*
+ * sharded_rtree splits space into a grid of `cells` per axis over a fixed
+ * `world` bound, each cell backed by its own TreeType (an RTree
+ * instantiation) and lock, so writers in different regions don't contend.
+ * An entry lives in exactly one shard, the cell containing the center of
+ * its key (keys outside `world` go to the nearest border cell). Every shard
+ * keeps the bound of all keys it ever held, which may reach into
+ * neighbouring cells, and the tree keeps the largest half extent of any key
+ * per axis. A query only locks the cells whose centers could belong to an
+ * overlapping key, the query grown by that half extent, and of those
+ * searches the shards whose bound overlaps it; keys straddling a cell
+ * border are still found, once.
+ * The shard bounds only grow until clear(), the half extents for the
+ * lifetime of the tree.
+ * Functors passed to the queries run while a shard lock is held and must
+ * not call back into this object.
+ */
+template <typename TreeType, typename MutexType = distributed_shared_mutex>
+class sharded_rtree
+{
+public:
+  using tree_type = TreeType;
+  using mutex_type = MutexType;
+  using size_type = typename TreeType::size_type;
+  using geometry_type = typename TreeType::geometry_type;
+  using traits = typename TreeType::traits;
+  using key_type = typename TreeType::key_type;
+  using mapped_type = typename TreeType::mapped_type;
+  using value_type = typename TreeType::value_type;
+
+  constexpr static int DIM = traits::DIM;
+
+protected:
+  struct shard_t
+  {
+    TreeType tree;
+    // bound of every key inserted since the last clear
+    std::optional<geometry_type> bound;
+    mutable MutexType mutex;
+  };
+
+  std::array<double, DIM> _origin;
+  std::array<double, DIM> _cell_size;
+  size_type _cells;
+  size_type _shard_count;
+  std::unique_ptr<shard_t[]> _shards;
+  // largest (max - min) / 2 of any key inserted, per axis
+  std::array<std::atomic<double>, DIM> _half_extent;
+
+  // cell along `axis` holding `coordinate`, clamped to the grid
+  size_type cell_of(double coordinate, int axis) const
+  {
+    const double cell = std::floor((coordinate - _origin[axis])
+                                   / _cell_size[axis]);
+    // also catches NaN
+    if ((cell > 0) == false)
+    {
+      return 0;
+    }
+    return static_cast<size_type>(
+        std::min(cell, static_cast<double>(_cells - 1)));
+  }
+
+  template <typename _KeyType>
+  size_type shard_of(_KeyType const& key) const
+  {
+    size_type index = 0;
+    for (int axis = DIM - 1; axis >= 0; --axis)
+    {
+      const double center
+          = (static_cast<double>(traits::min_point(key, axis))
+             + static_cast<double>(traits::max_point(key, axis)))
+            / 2;
+      index = index * _cells + cell_of(center, axis);
+    }
+    return index;
+  }
+
+  // grow the per axis half extents to cover `key`; done before the key is
+  // inserted so a query that can see it also sees its extent
+  template <typename _KeyType>
+  void note_extent(_KeyType const& key)
+  {
+    for (int axis = 0; axis < DIM; ++axis)
+    {
+      const double half
+          = (static_cast<double>(traits::max_point(key, axis))
+             - static_cast<double>(traits::min_point(key, axis)))
+            / 2;
+      double current = _half_extent[axis].load();
+      while (half > current
+             && _half_extent[axis].compare_exchange_weak(current, half)
+                    == false)
+      {
+      }
+    }
+  }
+
+  template <typename Functor>
+  void for_each_shard(Functor functor)
+  {
+    for (size_type i = 0; i < _shard_count; ++i)
+    {
+      functor(_shards[i]);
+    }
+  }
+
+  // visit the shards whose bound overlaps `search_range` until one search
+  // reports a stop; only cells an overlapping key could be centered in are
+  // locked
+  template <typename _GeometryType, typename Search>
+  void search_shards(_GeometryType const& search_range, Search search) const
+  {
+    std::array<size_type, DIM> first, last, cell;
+    for (int axis = 0; axis < DIM; ++axis)
+    {
+      const double half = _half_extent[axis].load();
+      const double low
+          = static_cast<double>(traits::min_point(search_range, axis)) - half;
+      const double high
+          = static_cast<double>(traits::max_point(search_range, axis)) + half;
+      first[axis] = cell_of(low, axis);
+      last[axis] = std::isnan(high) ? _cells - 1 : cell_of(high, axis);
+      if (first[axis] > last[axis])
+      {
+        return;
+      }
+    }
+    cell = first;
+    while (true)
+    {
+      size_type index = 0;
+      for (int axis = DIM - 1; axis >= 0; --axis)
+      {
+        index = index * _cells + cell[axis];
+      }
+      shard_t const& shard = _shards[index];
+      {
+        std::shared_lock<MutexType> lock(shard.mutex);
+        if (shard.bound.has_value()
+            && traits::is_overlap(*shard.bound, search_range)
+            && search(shard.tree))
+        {
+          return;
+        }
+      }
+      // next cell of the range, axis 0 fastest
+      int axis = 0;
+      while (axis < DIM && cell[axis] == last[axis])
+      {
+        cell[axis] = first[axis];
+        ++axis;
+      }
+      if (axis == DIM)
+      {
+        return;
+      }
+      ++cell[axis];
+    }
+  }
+
+public:
+  sharded_rtree(geometry_type const& world, size_type cells)
+      : _cells(std::max<size_type>(cells, 1))
+      , _shard_count(1)
+  {
+    for (int axis = 0; axis < DIM; ++axis)
+    {
+      _origin[axis] = static_cast<double>(traits::min_point(world, axis));
+      const double extent
+          = static_cast<double>(traits::max_point(world, axis))
+            - _origin[axis];
+      _cell_size[axis] = extent > 0 ? extent / _cells : 1.0;
+      _half_extent[axis].store(0);
+      _shard_count *= _cells;
+    }
+    _shards.reset(new shard_t[_shard_count]);
+  }
+  sharded_rtree(sharded_rtree const&) = delete;
+  sharded_rtree& operator=(sharded_rtree const&) = delete;
+
+  void insert(value_type new_val)
+  {
+    note_extent(new_val.first);
+    shard_t& shard = _shards[shard_of(new_val.first)];
+    std::unique_lock<MutexType> lock(shard.mutex);
+    if (shard.bound.has_value())
+    {
+      shard.bound = traits::merge(*shard.bound, new_val.first);
+    }
+    else
+    {
+      shard.bound.emplace(new_val.first);
+    }
+    shard.tree.insert(std::move(new_val));
+  }
+  template <typename... Args>
+  void emplace(Args&&... args)
+  {
+    insert(value_type(std::forward<Args>(args)...));
+  }
+  void deleteEntrie(value_type const& entrie)
+  {
+    shard_t& shard = _shards[shard_of(entrie.first)];
+    std::unique_lock<MutexType> lock(shard.mutex);
+    shard.tree.deleteEntrie(entrie);
+  }
+  void clear()
+  {
+    for_each_shard([](shard_t& shard) {
+      std::unique_lock<MutexType> lock(shard.mutex);
+      shard.tree.clear();
+      shard.bound.reset();
+    });
+  }
+
+  template <typename _GeometryType, typename Functor>
+  void search_inside(_GeometryType const& search_range, Functor functor) const
+  {
+    bool stop = false;
+    search_shards(search_range, [&](TreeType const& tree) {
+      tree.search_inside(search_range, [&](value_type const& c) {
+        return stop = functor(c);
+      });
+      return stop;
+    });
+  }
+  template <typename _GeometryType, typename Functor>
+  void search_overlap(_GeometryType const& search_range, Functor functor) const
+  {
+    bool stop = false;
+    search_shards(search_range, [&](TreeType const& tree) {
+      tree.search_overlap(search_range, [&](value_type const& c) {
+        return stop = functor(c);
+      });
+      return stop;
+    });
+  }
+
+  size_type size() const
+  {
+    size_type ret = 0;
+    for (size_type i = 0; i < _shard_count; ++i)
+    {
+      std::shared_lock<MutexType> lock(_shards[i].mutex);
+      ret += _shards[i].tree.size();
+    }
+    return ret;
+  }
+  size_type shard_count() const
+  {
+    return _shard_count;
+  }
+  // index of the shard an entry with `key` lives in
+  template <typename _KeyType>
+  size_type shard_index(_KeyType const& key) const
+  {
+    return shard_of(key);
+  }
+
+  // run `functor(tree_type const&)` on shard `index` under its shared lock
+  template <typename Functor>
+  decltype(auto) read_shard(size_type index, Functor functor) const
+  {
+    std::shared_lock<MutexType> lock(_shards[index].mutex);
+    return functor(static_cast<TreeType const&>(_shards[index].tree));
+  }
+};
+
+}
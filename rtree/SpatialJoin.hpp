@@ -0,0 +1,389 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <iterator>
+#include <vector>
+
+#include "GeometryTraits.hpp"
+#include "Global.hpp"
+#include "ThreadPool.hpp"
+
+namespace rtree
+{
+
+/*
+ * pbsm_join_t is a partition based spatial merge join of two entry ranges.
+ * Both inputs are scattered over a uniform grid (an entry goes to every
+ * cell its key overlaps), then every cell is joined independently by a
+ * plane sweep along axis 0, cells spread over the workers of a
+ * thread_pool_t.
+ * A pair overlapping several cells is met in each of them; it is only
+ * reported by the cell containing its reference point, the lowest corner
+ * of the intersection of the two keys, so each pair is reported once.
+ * Keys are read through geometry_traits<GeometryType>::min_point /
+ * max_point, so points and bounds can be joined in any combination.
+ */
+template <typename GeometryType>
+class pbsm_join_t
+{
+public:
+  using traits = geometry_traits<GeometryType>;
+  constexpr static int DIM = traits::DIM;
+  // cells a task joins, at most
+  constexpr static size_type CELLS_PER_TASK = 8;
+  // average entries per cell picked by cells == 0
+  constexpr static size_type ENTRIES_PER_CELL = 1024;
+
+protected:
+  std::array<double, DIM> _origin;
+  std::array<double, DIM> _cell_size;
+  size_type _cells = 1;
+  size_type _cell_count = 1;
+
+  template <typename KeyType>
+  static double low(KeyType const& key, int axis)
+  {
+    return static_cast<double>(traits::min_point(key, axis));
+  }
+  template <typename KeyType>
+  static double high(KeyType const& key, int axis)
+  {
+    return static_cast<double>(traits::max_point(key, axis));
+  }
+
+  size_type cell(int axis, double v) const
+  {
+    const double c = std::floor((v - _origin[axis]) / _cell_size[axis]);
+    return static_cast<size_type>(
+        std::min(std::max(c, 0.0), static_cast<double>(_cells - 1)));
+  }
+
+  // call `functor(cell index)` for every cell `key` overlaps
+  template <typename KeyType, typename Functor>
+  void for_each_cell(KeyType const& key, Functor functor) const
+  {
+    std::array<size_type, DIM> first, last, at;
+    for (int axis = 0; axis < DIM; ++axis)
+    {
+      first[axis] = at[axis] = cell(axis, low(key, axis));
+      last[axis] = cell(axis, high(key, axis));
+    }
+    for (;;)
+    {
+      size_type index = 0;
+      for (int axis = DIM - 1; axis >= 0; --axis)
+      {
+        index = index * _cells + at[axis];
+      }
+      functor(index);
+      int axis = 0;
+      while (axis < DIM && at[axis] == last[axis])
+      {
+        at[axis] = first[axis];
+        ++axis;
+      }
+      if (axis == DIM)
+      {
+        return;
+      }
+      ++at[axis];
+    }
+  }
+
+  // grid over the bound of every key of both inputs
+  template <typename LeftType, typename RightType>
+  void build_grid(std::vector<LeftType const*> const& left,
+                  std::vector<RightType const*> const& right,
+                  size_type cells)
+  {
+    std::array<double, DIM> lo, hi;
+    lo.fill(0);
+    hi.fill(0);
+    bool first = true;
+    auto extend = [&](auto const& key) {
+      for (int axis = 0; axis < DIM; ++axis)
+      {
+        const double l = low(key, axis), h = high(key, axis);
+        lo[axis] = first ? l : std::min(lo[axis], l);
+        hi[axis] = first ? h : std::max(hi[axis], h);
+      }
+      first = false;
+    };
+    for (LeftType const* v : left)
+    {
+      extend(v->first);
+    }
+    for (RightType const* v : right)
+    {
+      extend(v->first);
+    }
+    if (cells == 0)
+    {
+      const double target = static_cast<double>(left.size() + right.size())
+                            / ENTRIES_PER_CELL;
+      cells = static_cast<size_type>(
+          std::ceil(std::pow(std::max(target, 1.0), 1.0 / DIM)));
+    }
+    _cells = std::max<size_type>(cells, 1);
+    _cell_count = 1;
+    for (int axis = 0; axis < DIM; ++axis)
+    {
+      _origin[axis] = lo[axis];
+      const double extent = hi[axis] - lo[axis];
+      _cell_size[axis] = extent > 0 ? extent / _cells : 1.0;
+      _cell_count *= _cells;
+    }
+  }
+
+  /*
+   * scatter `input` into `output` grouped by cell; the entries of cell c
+   * are output[offsets[c], offsets[c + 1]), in input order.
+   * chunks of the input count and then scatter their entries in parallel.
+   */
+  template <typename ValueType>
+  void partition(std::vector<ValueType const*> const& input,
+                 thread_pool_t& pool,
+                 std::vector<size_type>& offsets,
+                 std::vector<ValueType const*>& output) const
+  {
+    const size_type size = static_cast<size_type>(input.size());
+    const size_type chunks
+        = std::max<size_type>(std::min(pool.size() * 4, size / 1024), 1);
+    const size_type chunk_size = (size + chunks - 1) / chunks;
+    std::vector<size_type> counts(chunks * _cell_count, 0);
+    auto chunk_range = [&](size_type c) {
+      const size_type b = std::min(c * chunk_size, size);
+      return std::make_pair(b, std::min(b + chunk_size, size));
+    };
+    {
+      task_group_t tasks(pool);
+      for (size_type c = 0; c < chunks; ++c)
+      {
+        tasks.run([&, c] {
+          size_type* count = counts.data() + c * _cell_count;
+          const auto range = chunk_range(c);
+          for (size_type i = range.first; i < range.second; ++i)
+          {
+            for_each_cell(input[i]->first,
+                          [count](size_type index) { ++count[index]; });
+          }
+        });
+      }
+      tasks.wait();
+    }
+    // counts become the first output slot of every (chunk, cell)
+    offsets.assign(_cell_count + 1, 0);
+    size_type total = 0;
+    for (size_type index = 0; index < _cell_count; ++index)
+    {
+      offsets[index] = total;
+      for (size_type c = 0; c < chunks; ++c)
+      {
+        const size_type n = counts[c * _cell_count + index];
+        counts[c * _cell_count + index] = total;
+        total += n;
+      }
+    }
+    offsets[_cell_count] = total;
+    output.resize(total);
+    {
+      task_group_t tasks(pool);
+      for (size_type c = 0; c < chunks; ++c)
+      {
+        tasks.run([&, c] {
+          size_type* slot = counts.data() + c * _cell_count;
+          const auto range = chunk_range(c);
+          for (size_type i = range.first; i < range.second; ++i)
+          {
+            ValueType const* v = input[i];
+            for_each_cell(v->first, [&output, slot, v](size_type index) {
+              output[slot[index]++] = v;
+            });
+          }
+        });
+      }
+      tasks.wait();
+    }
+  }
+
+  // true if `a` and `b` overlap and their reference point is in `index`
+  template <typename KeyA, typename KeyB>
+  bool report(KeyA const& a, KeyB const& b, size_type index) const
+  {
+    size_type owner = 0;
+    for (int axis = DIM - 1; axis >= 0; --axis)
+    {
+      if (low(a, axis) > high(b, axis) || low(b, axis) > high(a, axis))
+      {
+        return false;
+      }
+      owner = owner * _cells
+              + cell(axis, std::max(low(a, axis), low(b, axis)));
+    }
+    return owner == index;
+  }
+
+  // plane sweep of one cell along axis 0; returns true to stop
+  template <typename LeftType, typename RightType, typename Functor>
+  bool sweep(size_type index,
+             std::vector<LeftType const*>& left,
+             std::vector<RightType const*>& right,
+             Functor& functor,
+             std::atomic<bool>& stop) const
+  {
+    auto by_low = [](auto const* x, auto const* y) {
+      return low(x->first, 0) < low(y->first, 0);
+    };
+    std::sort(left.begin(), left.end(), by_low);
+    std::sort(right.begin(), right.end(), by_low);
+    const size_type left_size = static_cast<size_type>(left.size());
+    const size_type right_size = static_cast<size_type>(right.size());
+    size_type i = 0, j = 0;
+    while (i < left_size && j < right_size)
+    {
+      if (stop.load(std::memory_order_relaxed))
+      {
+        return true;
+      }
+      if (low(left[i]->first, 0) <= low(right[j]->first, 0))
+      {
+        LeftType const& l = *left[i];
+        const double end = high(l.first, 0);
+        for (size_type k = j;
+             k < right_size && low(right[k]->first, 0) <= end; ++k)
+        {
+          if (report(l.first, right[k]->first, index)
+              && functor(l, *right[k]))
+          {
+            return true;
+          }
+        }
+        ++i;
+      }
+      else
+      {
+        RightType const& r = *right[j];
+        const double end = high(r.first, 0);
+        for (size_type k = i;
+             k < left_size && low(left[k]->first, 0) <= end; ++k)
+        {
+          if (report(left[k]->first, r.first, index)
+              && functor(*left[k], r))
+          {
+            return true;
+          }
+        }
+        ++j;
+      }
+    }
+    return false;
+  }
+
+public:
+  /*
+   * call `functor(left entry, right entry)` for every pair of entries of
+   * [left_first, left_last) and [right_first, right_last) whose keys
+   * overlap. Entries are `std::pair<key, mapped>`-like, as stored in an
+   * RTree; any forward iterators will do, including RTree::begin().
+   * `cells` is the grid resolution per axis, 0 picks one with about
+   * ENTRIES_PER_CELL entries per cell.
+   * Cells are joined in tasks of up to CELLS_PER_TASK consecutive cells,
+   * each with its own copy of `functor`; the copies are returned in cell
+   * order. Once a copy returns true the other tasks stop soon after.
+   * The inputs must not be modified until the call returns.
+   */
+  template <typename LeftIterator, typename RightIterator, typename Functor>
+  static std::vector<Functor> run(LeftIterator left_first,
+                                  LeftIterator left_last,
+                                  RightIterator right_first,
+                                  RightIterator right_last,
+                                  Functor functor,
+                                  thread_pool_t& pool,
+                                  size_type cells = 0)
+  {
+    using left_type = typename std::iterator_traits<LeftIterator>::value_type;
+    using right_type =
+        typename std::iterator_traits<RightIterator>::value_type;
+
+    std::vector<left_type const*> left;
+    std::vector<right_type const*> right;
+    for (; left_first != left_last; ++left_first)
+    {
+      left.push_back(&*left_first);
+    }
+    for (; right_first != right_last; ++right_first)
+    {
+      right.push_back(&*right_first);
+    }
+    std::vector<Functor> sinks;
+    if (left.empty() || right.empty())
+    {
+      return sinks;
+    }
+
+    pbsm_join_t join;
+    join.build_grid(left, right, cells);
+    std::vector<size_type> left_offsets, right_offsets;
+    std::vector<left_type const*> left_cells;
+    std::vector<right_type const*> right_cells;
+    join.partition(left, pool, left_offsets, left_cells);
+    join.partition(right, pool, right_offsets, right_cells);
+
+    const size_type tasks_count
+        = (join._cell_count + CELLS_PER_TASK - 1) / CELLS_PER_TASK;
+    sinks.assign(tasks_count, functor);
+    std::atomic<bool> stop { false };
+    task_group_t tasks(pool);
+    for (size_type t = 0; t < tasks_count; ++t)
+    {
+      tasks.run([&, t] {
+        Functor& f = sinks[t];
+        std::vector<left_type const*> l;
+        std::vector<right_type const*> r;
+        const size_type last
+            = std::min((t + 1) * CELLS_PER_TASK, join._cell_count);
+        for (size_type index = t * CELLS_PER_TASK; index < last; ++index)
+        {
+          l.assign(left_cells.begin() + left_offsets[index],
+                   left_cells.begin() + left_offsets[index + 1]);
+          r.assign(right_cells.begin() + right_offsets[index],
+                   right_cells.begin() + right_offsets[index + 1]);
+          if (l.empty() || r.empty())
+          {
+            continue;
+          }
+          if (join.sweep(index, l, r, f, stop))
+          {
+            stop.store(true, std::memory_order_relaxed);
+            return;
+          }
+        }
+      });
+    }
+    tasks.wait();
+    return sinks;
+  }
+};
+
+// pbsm_join_t<GeometryType>::run
+template <typename GeometryType,
+          typename LeftIterator,
+          typename RightIterator,
+          typename Functor>
+std::vector<Functor> spatial_join(LeftIterator left_first,
+                                  LeftIterator left_last,
+                                  RightIterator right_first,
+                                  RightIterator right_last,
+                                  Functor functor,
+                                  thread_pool_t& pool,
+                                  size_type cells = 0)
+{
+  return pbsm_join_t<GeometryType>::run(left_first, left_last, right_first,
+                                        right_last, std::move(functor), pool,
+                                        cells);
+}
+
+}
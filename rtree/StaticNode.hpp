@@ -14,34 +14,48 @@ namespace rtree {
 template <typename GeometryType, // bounding box representation
           typename KeyType, // key type, either bounding box or point
           typename MappedType, // mapped type, user defined
-          size_type MinEntry, // m
-          size_type MaxEntry // M
+          size_type MinEntry, // m of internal nodes
+          size_type MaxEntry, // M of internal nodes
+          size_type MinLeafEntry, // m of leaf nodes
+          size_type MaxLeafEntry // M of leaf nodes
           >
 struct static_node_t;
 
 template <typename GeometryType, // bounding box representation
           typename KeyType, // key type, either bounding box or point
           typename MappedType, // mapped type, user defined
-          size_type MinEntry, // m
-          size_type MaxEntry // M
+          size_type MinEntry, // m of internal nodes
+          size_type MaxEntry, // M of internal nodes
+          size_type MinLeafEntry, // m of leaf nodes
+          size_type MaxLeafEntry // M of leaf nodes
           >
 struct static_leaf_node_t;
 
 template <typename GeometryType, // bounding box representation
           typename KeyType, // key type, either bounding box or point
           typename MappedType, // mapped type, user defined
-          size_type MinEntry, // m
-          size_type MaxEntry // M
+          size_type MinEntry, // m of internal nodes
+          size_type MaxEntry, // M of internal nodes
+          size_type MinLeafEntry, // m of leaf nodes
+          size_type MaxLeafEntry // M of leaf nodes
           >
 struct static_node_base_t {
   using node_base_type = static_node_base_t;
   using node_type
-      = static_node_t<GeometryType, KeyType, MappedType, MinEntry, MaxEntry>;
+      = static_node_t<GeometryType,
+                      KeyType,
+                      MappedType,
+                      MinEntry,
+                      MaxEntry,
+                      MinLeafEntry,
+                      MaxLeafEntry>;
   using leaf_type = static_leaf_node_t<GeometryType,
                                        KeyType,
                                        MappedType,
                                        MinEntry,
-                                       MaxEntry>;
+                                       MaxEntry,
+                                       MinLeafEntry,
+                                       MaxLeafEntry>;
 
   using size_type = ::rtree::size_type;
   using geometry_type = GeometryType;
@@ -174,28 +188,36 @@ struct static_node_base_t {
 template <typename GeometryType, // bounding box representation
           typename KeyType, // key type, either bounding box or point
           typename MappedType, // mapped type, user defined
-          size_type MinEntry, // m
-          size_type MaxEntry // M
+          size_type MinEntry, // m of internal nodes
+          size_type MaxEntry, // M of internal nodes
+          size_type MinLeafEntry, // m of leaf nodes
+          size_type MaxLeafEntry // M of leaf nodes
           >
 struct static_node_t
     : public static_node_base_t<GeometryType,
                                 KeyType,
                                 MappedType,
                                 MinEntry,
-                                MaxEntry>
+                                MaxEntry,
+                                MinLeafEntry,
+                                MaxLeafEntry>
 {
   using parent_type = static_node_base_t<GeometryType,
                                          KeyType,
                                          MappedType,
                                          MinEntry,
-                                         MaxEntry>;
+                                         MaxEntry,
+                                         MinLeafEntry,
+                                         MaxLeafEntry>;
   using node_base_type = parent_type;
   using node_type = static_node_t;
   using leaf_type = static_leaf_node_t<GeometryType,
                                        KeyType,
                                        MappedType,
                                        MinEntry,
-                                       MaxEntry>;
+                                       MaxEntry,
+                                       MinLeafEntry,
+                                       MaxLeafEntry>;
   using size_type = typename parent_type::size_type;
   using geometry_type = GeometryType;
   using key_type = KeyType;
@@ -205,6 +227,9 @@ struct static_node_t
   using iterator = value_type*;
   using const_iterator = value_type const*;
 
+  constexpr static size_type MIN_ENTRIES = MinEntry;
+  constexpr static size_type MAX_ENTRIES = MaxEntry;
+
   static_vector<value_type, MaxEntry> _children;
 
   static_node_t() = default;
@@ -412,24 +437,36 @@ struct static_node_t
 template <typename GeometryType, // bounding box representation
           typename KeyType, // key type, either bounding box or point
           typename MappedType, // mapped type, user defined
-          size_type MinEntry, // m
-          size_type MaxEntry // M
+          size_type MinEntry, // m of internal nodes
+          size_type MaxEntry, // M of internal nodes
+          size_type MinLeafEntry, // m of leaf nodes
+          size_type MaxLeafEntry // M of leaf nodes
           >
 struct static_leaf_node_t
     : public static_node_base_t<GeometryType,
                                 KeyType,
                                 MappedType,
                                 MinEntry,
-                                MaxEntry>
+                                MaxEntry,
+                                MinLeafEntry,
+                                MaxLeafEntry>
 {
   using parent_type = static_node_base_t<GeometryType,
                                          KeyType,
                                          MappedType,
                                          MinEntry,
-                                         MaxEntry>;
+                                         MaxEntry,
+                                         MinLeafEntry,
+                                         MaxLeafEntry>;
   using node_base_type = parent_type;
   using node_type
-      = static_node_t<GeometryType, KeyType, MappedType, MinEntry, MaxEntry>;
+      = static_node_t<GeometryType,
+                      KeyType,
+                      MappedType,
+                      MinEntry,
+                      MaxEntry,
+                      MinLeafEntry,
+                      MaxLeafEntry>;
   using leaf_type = static_leaf_node_t;
   using size_type = typename parent_type::size_type;
   using geometry_type = GeometryType;
@@ -440,7 +477,10 @@ struct static_leaf_node_t
   using iterator = value_type*;
   using const_iterator = value_type const*;
 
-  static_vector<value_type, MaxEntry> _children;
+  constexpr static size_type MIN_ENTRIES = MinLeafEntry;
+  constexpr static size_type MAX_ENTRIES = MaxLeafEntry;
+
+  static_vector<value_type, MaxLeafEntry> _children;
 
   static_leaf_node_t() = default;
   static_leaf_node_t(static_leaf_node_t const&) = delete;
@@ -451,7 +491,7 @@ struct static_leaf_node_t
   // add child node with bounding box
   void insert(value_type child)
   {
-    assert(size() < MaxEntry);
+    assert(size() < MaxLeafEntry);
     _children.emplace_back(std::move(child));
   }
   void erase(value_type* pos)
@@ -581,10 +621,8 @@ struct static_leaf_node_t
   leaf_type* clone_recursive(TreeType& tree) const
   {
     leaf_type* new_node = tree.template construct_node<leaf_type>();
-    for (auto& c : *this)
-    {
-      new_node->insert(c);
-    }
+    // a single memcpy when the entries are bitwise copyable
+    new_node->_children = _children;
     return new_node;
   }
   size_type size_recursive() const
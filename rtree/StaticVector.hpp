@@ -1,12 +1,27 @@
 #pragma once
 
 #include <cassert>
+#include <cstring>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
 #include "Global.hpp"
 
   namespace rtree {
+  /*
+   * is_bitwise_copyable<T> is true if copying a T is the same as copying its
+   * bytes. std::pair of such types qualifies, although std::pair itself is
+   * never trivially copyable because of its user-provided assignment.
+   */
+  template <typename T>
+  struct is_bitwise_copyable : std::is_trivially_copyable<T> {};
+  template <typename A, typename B>
+  struct is_bitwise_copyable<std::pair<A, B>>
+      : std::integral_constant<bool,
+                               is_bitwise_copyable<A>::value
+                                   && is_bitwise_copyable<B>::value> {};
+
   /*
    * static_vector is a fixed-size vector container.
    * T element type
@@ -19,6 +34,8 @@
   public:
     using value_type = T;
     using size_type = ::rtree::size_type;
+    // copies and moves are a single memcpy
+    constexpr static bool BITWISE_COPYABLE = is_bitwise_copyable<T>::value;
   protected:
     alignas(T) char data_[sizeof(T) * N]; // aligned storage for T type
     size_type size_;
@@ -26,18 +43,14 @@
     static_vector(): size_(0){}
     // copy constructor
     static_vector(static_vector const& rhs): size_(0) {
-      for (size_type i = 0; i < rhs.size(); ++i) {
-        push_back(rhs[i]);
-      }
+      copy_from(rhs);
     }
     /**
      * move constructor
      * @note that rhs.size() is not changed.
      */
     static_vector(static_vector&& rhs): size_(0) {
-      for (size_type i = 0; i < rhs.size(); ++i) {
-        push_back(std::move(rhs[i]));
-      }
+      move_from(rhs);
     }
 
     /**
@@ -45,9 +58,9 @@
      * @note clear() is called before copying elements, which calls destructor of elements
      */
     static_vector& operator=(static_vector const& rhs) {
-      clear();
-      for (size_type i = 0; i < rhs.size(); ++i){
-        push_back(rhs[i]);
+      if (this != &rhs) {
+        clear();
+        copy_from(rhs);
       }
       return *this;
     }
@@ -56,9 +69,9 @@
      * @note clear() is called before copying elements, which calls destructor of elements
      */
     static_vector& operator=(static_vector&& rhs) {
-      clear();
-      for (size_type i = 0; i < rhs.size(); ++i) {
-        push_back(std::move(rhs[i]));
+      if (this != &rhs) {
+        clear();
+        move_from(rhs);
       }
       return *this;
     }
@@ -94,8 +107,10 @@
       return at(i);
     }
     void clear() {
-      for (size_type i = 0; i < size_; ++i) {
-        at(i).~value_type(); // call destructor explicitly
+      if constexpr (std::is_trivially_destructible<value_type>::value == false) {
+        for (size_type i = 0; i < size_; ++i) {
+          at(i).~value_type(); // call destructor explicitly
+        }
       }
       size_ = 0;
     }
@@ -171,5 +186,30 @@
     {
       return data() + size();
     }
+
+  protected:
+    // both expect this to be empty
+    void copy_from(static_vector const& rhs) {
+      if constexpr (BITWISE_COPYABLE) {
+        std::memcpy(data_, rhs.data_, sizeof(T) * rhs.size_);
+        size_ = rhs.size_;
+      }
+      else {
+        for (size_type i = 0; i < rhs.size(); ++i) {
+          push_back(rhs[i]);
+        }
+      }
+    }
+    void move_from(static_vector& rhs) {
+      if constexpr (BITWISE_COPYABLE) {
+        std::memcpy(data_, rhs.data_, sizeof(T) * rhs.size_);
+        size_ = rhs.size_;
+      }
+      else {
+        for (size_type i = 0; i < rhs.size(); ++i) {
+          push_back(std::move(rhs[i]));
+        }
+      }
+    }
   };
 }
\ No newline at end of file
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Global.hpp"
+
+namespace rtree
+{
+
+/*
+ * thread_pool_t is a work-stealing thread pool.
+ * Every worker owns a task deque: tasks submitted from a worker go to the
+ * back of its own deque and are taken from the back (most recent first,
+ * good for recursive work), idle workers steal from the front of the
+ * others. Tasks submitted from outside are spread round-robin.
+ * Threads waiting for tasks (task_group_t::wait) run queued tasks in the
+ * meantime, so tasks may submit and wait for more tasks.
+ * Tasks must not throw.
+ */
+class thread_pool_t
+{
+public:
+  using task_type = std::function<void()>;
+
+protected:
+  struct alignas(64) queue_t
+  {
+    std::mutex mutex;
+    std::deque<task_type> tasks;
+  };
+
+  std::vector<std::unique_ptr<queue_t>> _queues;
+  std::vector<std::thread> _threads;
+  std::atomic<size_type> _queued { 0 };
+  std::atomic<size_type> _next_queue { 0 };
+  std::atomic<bool> _stop { false };
+  std::mutex _sleep_mutex;
+  std::condition_variable _wake;
+
+  bool pop(size_type queue, task_type& task, bool back)
+  {
+    queue_t& q = *_queues[queue];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.tasks.empty())
+    {
+      return false;
+    }
+    if (back)
+    {
+      task = std::move(q.tasks.back());
+      q.tasks.pop_back();
+    }
+    else
+    {
+      task = std::move(q.tasks.front());
+      q.tasks.pop_front();
+    }
+    _queued.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+  }
+  // own queue first, then steal starting after `self`
+  bool take(int self, task_type& task)
+  {
+    const size_type n = size();
+    if (self >= 0 && pop(static_cast<size_type>(self), task, true))
+    {
+      return true;
+    }
+    const size_type start = self >= 0 ? static_cast<size_type>(self) + 1
+                                      : _next_queue.load(
+                                            std::memory_order_relaxed);
+    for (size_type i = 0; i < n; ++i)
+    {
+      const size_type victim = (start + i) % n;
+      if (static_cast<int>(victim) != self && pop(victim, task, false))
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void work(int index)
+  {
+    bind(index);
+    task_type task;
+    for (;;)
+    {
+      if (take(index, task))
+      {
+        task();
+        task = nullptr;
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(_sleep_mutex);
+      _wake.wait(lock, [this] {
+        return _stop.load() || _queued.load(std::memory_order_relaxed) > 0;
+      });
+      if (_stop.load() && _queued.load(std::memory_order_relaxed) == 0)
+      {
+        return;
+      }
+    }
+  }
+  void bind(int index)
+  {
+    current_pool() = this;
+    current_index() = index;
+  }
+  static thread_pool_t const*& current_pool()
+  {
+    thread_local thread_pool_t const* pool = nullptr;
+    return pool;
+  }
+  static int& current_index()
+  {
+    thread_local int index = -1;
+    return index;
+  }
+  // queue owned by the calling thread, -1 if it is not a worker of this pool
+  int self() const
+  {
+    return current_pool() == this ? current_index() : -1;
+  }
+
+public:
+  explicit thread_pool_t(
+      size_type threads = std::thread::hardware_concurrency())
+  {
+    if (threads == 0)
+    {
+      threads = 1;
+    }
+    _queues.reserve(threads);
+    for (size_type i = 0; i < threads; ++i)
+    {
+      _queues.emplace_back(new queue_t);
+    }
+    _threads.reserve(threads);
+    for (size_type i = 0; i < threads; ++i)
+    {
+      _threads.emplace_back([this, i] { work(static_cast<int>(i)); });
+    }
+  }
+  thread_pool_t(thread_pool_t const&) = delete;
+  thread_pool_t& operator=(thread_pool_t const&) = delete;
+  // runs the remaining tasks, then joins the workers
+  ~thread_pool_t()
+  {
+    {
+      std::lock_guard<std::mutex> lock(_sleep_mutex);
+      _stop.store(true);
+    }
+    _wake.notify_all();
+    for (std::thread& t : _threads)
+    {
+      t.join();
+    }
+  }
+
+  // number of worker threads
+  size_type size() const
+  {
+    return static_cast<size_type>(_queues.size());
+  }
+
+  void submit(task_type task)
+  {
+    const int index = self();
+    const size_type queue
+        = index >= 0 ? static_cast<size_type>(index)
+                     : _next_queue.fetch_add(1, std::memory_order_relaxed)
+                           % size();
+    _queued.fetch_add(1, std::memory_order_relaxed);
+    {
+      queue_t& q = *_queues[queue];
+      std::lock_guard<std::mutex> lock(q.mutex);
+      q.tasks.push_back(std::move(task));
+    }
+    {
+      // pairs with the predicate check of a worker going to sleep
+      std::lock_guard<std::mutex> lock(_sleep_mutex);
+    }
+    _wake.notify_one();
+  }
+
+  // run one queued task on the calling thread
+  // returns false if there was none
+  bool run_one()
+  {
+    task_type task;
+    if (take(self(), task))
+    {
+      task();
+      return true;
+    }
+    return false;
+  }
+};
+
+/*
+ * task_group_t tracks a set of tasks submitted to a thread_pool_t.
+ * wait() returns once all of them have finished, running queued tasks on
+ * the calling thread while it waits.
+ */
+class task_group_t
+{
+protected:
+  thread_pool_t& _pool;
+  std::atomic<size_type> _pending { 0 };
+
+public:
+  explicit task_group_t(thread_pool_t& pool)
+      : _pool(pool)
+  {
+  }
+  task_group_t(task_group_t const&) = delete;
+  task_group_t& operator=(task_group_t const&) = delete;
+  ~task_group_t()
+  {
+    wait();
+  }
+
+  template <typename Functor>
+  void run(Functor functor)
+  {
+    _pending.fetch_add(1, std::memory_order_relaxed);
+    _pool.submit([this, functor]() mutable {
+      functor();
+      _pending.fetch_sub(1, std::memory_order_release);
+    });
+  }
+  void wait()
+  {
+    while (_pending.load(std::memory_order_acquire) != 0)
+    {
+      if (_pool.run_one() == false)
+      {
+        std::this_thread::yield();
+      }
+    }
+  }
+};
+
+}
@@ -0,0 +1,303 @@
+#pragma once
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Global.hpp"
+#include "Serialization.hpp"
+
+namespace rtree {
+
+using lsn_type = std::uint64_t;
+
+// fsync the file or directory at `path`, opened with `flags`
+inline bool sync_path(std::string const& path, int flags) {
+  const int fd = ::open(path.c_str(), flags | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  const bool ok = fsync(fd) == 0;
+  ::close(fd);
+  return ok;
+}
+inline std::string directory_of(std::string const& path) {
+  const auto slash = path.find_last_of('/');
+  if (slash == std::string::npos) {
+    return ".";
+  }
+  return slash == 0 ? std::string("/") : path.substr(0, slash);
+}
+
+/*
+ * a log record is this header followed by `size` payload bytes
+ * checksum covers the header (with checksum 0) and the payload, so a
+ * record torn by a crash is detected and ends the log.
+ */
+struct wal_record_header_t {
+  std::uint32_t size;
+  std::uint32_t kind;
+  lsn_type lsn;
+  std::uint64_t checksum;
+
+  std::uint64_t compute_checksum(void const* payload) const {
+    wal_record_header_t h = *this;
+    h.checksum = 0;
+    checksum_t c;
+    c.update(&h, sizeof(h));
+    c.update(payload, size);
+    return c.value;
+  }
+};
+
+/*
+ * write_ahead_log_t appends records to a log file with group commit.
+ * append() only buffers a record and hands out its log sequence number;
+ * commit(lsn) returns once that record is on stable storage. The first
+ * committing thread becomes the leader: it writes everything buffered so
+ * far and syncs the file once, while later committers wait for it or for
+ * the next leader, so concurrent writers share one fsync per batch.
+ * A failed write or sync is sticky: every later commit returns false.
+ * Thread-safe.
+ */
+class write_ahead_log_t {
+public:
+  struct stats_type {
+    std::uint64_t records = 0;
+    std::uint64_t syncs = 0;
+  };
+
+protected:
+  int _fd = -1;
+  std::uint64_t _end = 0;
+  std::vector<unsigned char> _pending;
+  lsn_type _next_lsn = 1;
+  // every record up to _durable_lsn is on stable storage
+  lsn_type _durable_lsn = 0;
+  bool _leader = false;
+  bool _failed = false;
+  stats_type _stats;
+  mutable std::mutex _mutex;
+  std::condition_variable _synced;
+
+  bool write_all(void const* data, std::size_t bytes, std::uint64_t offset) {
+    std::size_t done = 0;
+    while (done < bytes) {
+      const ssize_t n = pwrite(_fd, static_cast<char const*>(data) + done,
+                               bytes - done,
+                               static_cast<off_t>(offset + done));
+      if (n <= 0) {
+        return false;
+      }
+      done += static_cast<std::size_t>(n);
+    }
+    return true;
+  }
+  bool sync_file() {
+#if defined(__linux__)
+    return fdatasync(_fd) == 0;
+#else
+    return fsync(_fd) == 0;
+#endif
+  }
+
+public:
+  write_ahead_log_t() = default;
+  write_ahead_log_t(write_ahead_log_t const&) = delete;
+  write_ahead_log_t& operator=(write_ahead_log_t const&) = delete;
+  ~write_ahead_log_t() {
+    close();
+  }
+
+  /*
+   * open `path` for appending, creating it if needed
+   * `valid_bytes` is the length of the log's intact prefix (see replay());
+   * anything after it is cut off. `next_lsn` is the number of the next
+   * record.
+   * a newly created log has its directory synced, so the file itself
+   * survives a crash along with the records later committed to it.
+   */
+  bool open(std::string const& path, std::uint64_t valid_bytes,
+            lsn_type next_lsn) {
+    close();
+    bool created = true;
+    _fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (_fd < 0 && errno == EEXIST) {
+      created = false;
+      _fd = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    }
+    if (_fd < 0) {
+      return false;
+    }
+    if (created
+        && sync_path(directory_of(path), O_RDONLY | O_DIRECTORY) == false) {
+      close();
+      return false;
+    }
+    if (ftruncate(_fd, static_cast<off_t>(valid_bytes)) != 0) {
+      close();
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    _end = valid_bytes;
+    _pending.clear();
+    _next_lsn = next_lsn;
+    _durable_lsn = next_lsn - 1;
+    _failed = false;
+    return true;
+  }
+  void close() {
+    if (_fd >= 0) {
+      ::close(_fd);
+      _fd = -1;
+    }
+  }
+  bool is_open() const {
+    return _fd >= 0;
+  }
+
+  // buffer a record; returns its sequence number
+  lsn_type append(std::uint32_t kind, void const* payload, std::size_t bytes) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    wal_record_header_t header;
+    header.size = static_cast<std::uint32_t>(bytes);
+    header.kind = kind;
+    header.lsn = _next_lsn++;
+    header.checksum = header.compute_checksum(payload);
+    unsigned char const* h = reinterpret_cast<unsigned char const*>(&header);
+    unsigned char const* p = static_cast<unsigned char const*>(payload);
+    _pending.insert(_pending.end(), h, h + sizeof(header));
+    _pending.insert(_pending.end(), p, p + bytes);
+    ++_stats.records;
+    return header.lsn;
+  }
+
+  // wait until every record up to `lsn` is durable
+  bool commit(lsn_type lsn) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (_durable_lsn < lsn && _failed == false) {
+      if (_leader) {
+        _synced.wait(lock);
+        continue;
+      }
+      // lead a batch of everything appended so far
+      _leader = true;
+      std::vector<unsigned char> batch;
+      batch.swap(_pending);
+      const lsn_type batch_lsn = _next_lsn - 1;
+      const std::uint64_t offset = _end;
+      lock.unlock();
+      const bool ok
+          = write_all(batch.data(), batch.size(), offset) && sync_file();
+      lock.lock();
+      _leader = false;
+      if (ok) {
+        _end = offset + batch.size();
+        _durable_lsn = batch_lsn;
+        ++_stats.syncs;
+      }
+      else {
+        _failed = true;
+      }
+      _synced.notify_all();
+    }
+    return _failed == false;
+  }
+  // append and commit a single record
+  bool write(std::uint32_t kind, void const* payload, std::size_t bytes) {
+    return commit(append(kind, payload, bytes));
+  }
+
+  /*
+   * empty the log once every record in it is covered by a snapshot
+   * records appended but not committed yet are dropped too; their
+   * committers return true.
+   */
+  bool reset() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _synced.wait(lock, [this] { return _leader == false; });
+    _pending.clear();
+    if (ftruncate(_fd, 0) != 0 || sync_file() == false) {
+      _failed = true;
+    }
+    else {
+      _end = 0;
+      _durable_lsn = _next_lsn - 1;
+    }
+    _synced.notify_all();
+    return _failed == false;
+  }
+
+  // true once a write or sync failed; reset by open()
+  bool failed() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _failed;
+  }
+  lsn_type last_lsn() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _next_lsn - 1;
+  }
+  stats_type stats() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+  }
+
+  /*
+   * call `functor(wal_record_header_t const&, unsigned char const*)` for
+   * every intact record of the log in `path`, in order, stopping at the
+   * first torn or corrupt one. `valid_bytes` receives the length of the
+   * intact prefix and `last_lsn` the number of its last record (unchanged
+   * if there is none).
+   * returns false if the file exists but cannot be read; a missing file is
+   * an empty log.
+   */
+  template <typename Functor>
+  static bool replay(std::string const& path, Functor functor,
+                     std::uint64_t& valid_bytes, lsn_type& last_lsn) {
+    valid_bytes = 0;
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return errno == ENOENT;
+    }
+    std::vector<unsigned char> data;
+    unsigned char buffer[1 << 16];
+    for (;;) {
+      const ssize_t n = ::read(fd, buffer, sizeof(buffer));
+      if (n < 0) {
+        ::close(fd);
+        return false;
+      }
+      if (n == 0) {
+        break;
+      }
+      data.insert(data.end(), buffer, buffer + n);
+    }
+    ::close(fd);
+
+    std::size_t offset = 0;
+    while (data.size() - offset >= sizeof(wal_record_header_t)) {
+      wal_record_header_t header;
+      std::memcpy(&header, data.data() + offset, sizeof(header));
+      unsigned char const* payload = data.data() + offset + sizeof(header);
+      if (header.size > data.size() - offset - sizeof(header)
+          || header.checksum != header.compute_checksum(payload)) {
+        break;
+      }
+      functor(static_cast<wal_record_header_t const&>(header), payload);
+      last_lsn = header.lsn;
+      offset += sizeof(header) + header.size;
+    }
+    valid_bytes = offset;
+    return true;
+  }
+};
+
+}
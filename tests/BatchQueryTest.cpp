@@ -0,0 +1,229 @@
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <type_traits>
+#include <vector>
+
+#include "rtree/AABB.hpp"
+#include "rtree/BatchQuery.hpp"
+#include "rtree/RTree.hpp"
+
+using namespace rtree;
+
+using point_type = point_t<double, 2>;
+using bound_type = aabb_t<point_type>;
+using point_tree = RTree<bound_type, point_type, int>;
+using box_tree = RTree<bound_type, bound_type, int>;
+using traits = geometry_traits<bound_type>;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, \
+                   #cond);                                                  \
+      ++failures;                                                           \
+    }                                                                       \
+  } while (0)
+
+// the key of an entry spanning [a, b]: `a` alone for point keys
+template <typename KeyType>
+static KeyType make_key(point_type const& a, point_type const& b) {
+  if constexpr (std::is_same<KeyType, point_type>::value) {
+    return a;
+  }
+  else {
+    return bound_type(a, b);
+  }
+}
+static bound_type bound_of(point_type const& key) {
+  return bound_type(key);
+}
+static bound_type bound_of(bound_type const& key) {
+  return key;
+}
+
+template <typename TreeType>
+static std::vector<typename TreeType::value_type>
+fill(TreeType& tree, int count, double extent, std::mt19937& gen) {
+  std::uniform_real_distribution<double> coord(0, 1000);
+  std::vector<typename TreeType::value_type> values;
+  for (int i = 0; i < count; ++i) {
+    point_type a;
+    a[0] = coord(gen);
+    a[1] = coord(gen);
+    point_type b = a;
+    b[0] += extent;
+    b[1] += extent;
+    const typename TreeType::value_type v(
+        make_key<typename TreeType::key_type>(a, b), i);
+    values.push_back(v);
+    tree.insert(v);
+  }
+  return values;
+}
+
+// a batch of every kind of query, a few of them large enough to truncate
+template <typename TreeType>
+static std::vector<batch_query_t<TreeType>>
+make_batch(int count, size_type capacity, std::mt19937& gen,
+           std::vector<typename TreeType::value_type const*>& out) {
+  std::uniform_real_distribution<double> coord(0, 1000);
+  std::vector<batch_query_t<TreeType>> queries;
+  out.assign(static_cast<std::size_t>(count) * capacity, nullptr);
+  for (int i = 0; i < count; ++i) {
+    point_type a;
+    a[0] = coord(gen);
+    a[1] = coord(gen);
+    point_type b = a;
+    const double width = i % 50 == 0 ? 500 : 25;
+    b[0] += width;
+    b[1] += width;
+    const query_kind kind = i % 3 == 0   ? query_kind::overlap
+                            : i % 3 == 1 ? query_kind::inside
+                                         : query_kind::nearest;
+    const size_type size = capacity - static_cast<size_type>(i) % capacity;
+    auto* first = out.data() + static_cast<std::size_t>(i) * capacity;
+    queries.emplace_back(kind,
+                         kind == query_kind::nearest ? bound_type(a)
+                                                     : bound_type(a, b),
+                         first, first + size);
+  }
+  return queries;
+}
+
+// execute_batch must give every query exactly what execute_query gives it
+template <typename TreeType>
+static void check_batch(TreeType const& tree, int threads, size_type grain) {
+  std::mt19937 gen(threads * 31 + grain);
+  std::vector<typename TreeType::value_type const*> out, expected_out;
+  auto queries = make_batch<TreeType>(3000, 64, gen, out);
+  std::mt19937 same(threads * 31 + grain);
+  auto expected = make_batch<TreeType>(3000, 64, same, expected_out);
+  for (auto& q : expected) {
+    execute_query(tree, q);
+  }
+
+  thread_pool_t pool(threads);
+  execute_batch(tree, queries, pool, grain);
+  std::size_t truncated = 0;
+  for (std::size_t i = 0; i < queries.size(); ++i) {
+    auto const& q = queries[i];
+    auto const& e = expected[i];
+    CHECK(q.count == e.count);
+    CHECK(q.truncated == e.truncated);
+    CHECK(std::equal(q.first, q.first + q.count, e.first));
+    truncated += q.truncated;
+  }
+  // the large queries must have exercised truncation
+  CHECK(truncated > 0);
+}
+
+// overlap / inside results against a scan of every value
+template <typename TreeType>
+static void check_ranges(TreeType const& tree,
+                         std::vector<typename TreeType::value_type> const& values) {
+  std::mt19937 gen(7);
+  std::vector<typename TreeType::value_type const*> out;
+  auto queries = make_batch<TreeType>(300, 1 << 16, gen, out);
+  thread_pool_t pool(4);
+  execute_batch(tree, queries, pool);
+  for (auto const& q : queries) {
+    if (q.kind == query_kind::nearest) {
+      continue;
+    }
+    std::vector<int> got;
+    for (auto it = q.first; it != q.first + q.count; ++it) {
+      got.push_back((*it)->second);
+    }
+    std::vector<int> want;
+    for (auto const& v : values) {
+      const bound_type bound = bound_of(v.first);
+      const bool match = q.kind == query_kind::overlap
+                             ? traits::is_overlap(bound, q.range)
+                             : traits::is_inside(q.range, bound);
+      if (match) {
+        want.push_back(v.second);
+      }
+    }
+    std::sort(got.begin(), got.end());
+    std::sort(want.begin(), want.end());
+    CHECK(q.truncated == false);
+    CHECK(got == want);
+  }
+}
+
+// search_nearest distances against a brute force sort of every value
+template <typename TreeType>
+static void check_nearest(TreeType const& tree,
+                          std::vector<typename TreeType::value_type> const& values) {
+  std::mt19937 gen(11);
+  std::uniform_real_distribution<double> coord(-100, 1100);
+  for (int i = 0; i < 200; ++i) {
+    point_type p;
+    p[0] = coord(gen);
+    p[1] = coord(gen);
+    const size_type k = 1 + static_cast<size_type>(i) % 40;
+
+    std::vector<double> got;
+    tree.search_nearest(p, k, [&](typename TreeType::value_type const& v) {
+      got.push_back(traits::min_distance(v.first, p));
+      return false;
+    });
+    std::vector<double> want;
+    for (auto const& v : values) {
+      want.push_back(traits::min_distance(v.first, p));
+    }
+    std::sort(want.begin(), want.end());
+    want.resize(k);
+    // visited nearest first; ties may come in any order but have equal
+    // distances
+    CHECK(got == want);
+  }
+
+  // a functor returning true stops the search
+  size_type visited = 0;
+  tree.search_nearest(point_type(), 10, [&](auto const&) {
+    return ++visited == 3;
+  });
+  CHECK(visited == 3);
+}
+
+int main() {
+  std::mt19937 gen(1);
+  point_tree points;
+  const auto point_values = fill(points, 20000, 0, gen);
+  box_tree boxes;
+  const auto box_values = fill(boxes, 20000, 8, gen);
+
+  for (int threads : { 1, 2, 4, 8 }) {
+    for (size_type grain : { 1u, 16u, 1000u }) {
+      check_batch(points, threads, grain);
+      check_batch(boxes, threads, grain);
+    }
+  }
+  check_ranges(points, point_values);
+  check_ranges(boxes, box_values);
+  check_nearest(points, point_values);
+  check_nearest(boxes, box_values);
+
+  // empty tree and empty batch
+  point_tree empty;
+  thread_pool_t pool(2);
+  std::vector<point_tree::value_type const*> out;
+  auto queries = make_batch<point_tree>(10, 4, gen, out);
+  execute_batch(empty, queries, pool);
+  for (auto const& q : queries) {
+    CHECK(q.count == 0 && q.truncated == false);
+  }
+  execute_batch(points, queries.data(), queries.data(), pool);
+
+  if (failures) {
+    std::fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  std::printf("all checks passed\n");
+  return 0;
+}
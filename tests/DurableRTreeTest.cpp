@@ -0,0 +1,267 @@
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <csignal>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "rtree/AABB.hpp"
+#include "rtree/DurableRTree.hpp"
+#include "rtree/RTree.hpp"
+
+using namespace rtree;
+
+using point_type = point_t<double, 2>;
+using bound_type = aabb_t<point_type>;
+using tree_type = RTree<bound_type, bound_type, int>;
+using durable_type = durable_rtree<tree_type>;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, \
+                   #cond);                                                  \
+      ++failures;                                                           \
+    }                                                                       \
+  } while (0)
+
+// the entry with mapped value `id`; keys follow from ids so contents can be
+// compared by id alone
+static tree_type::value_type entry(int id) {
+  point_type a;
+  a[0] = (id * 37) % 1000;
+  a[1] = (id * 91) % 1000;
+  point_type b = a;
+  b[0] += 1 + id % 5;
+  b[1] += 1 + id % 3;
+  return { bound_type(a, b), id };
+}
+
+static std::multiset<int> contents(durable_type const& tree) {
+  std::multiset<int> ids;
+  tree.read([&](tree_type const& t) {
+    for (auto const& v : t) {
+      ids.insert(v.second);
+    }
+    return 0;
+  });
+  return ids;
+}
+
+static long file_size(std::string const& path) {
+  struct stat st;
+  return ::stat(path.c_str(), &st) == 0 ? static_cast<long>(st.st_size) : -1;
+}
+static std::string read_file(std::string const& path) {
+  std::ifstream in(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(in), {});
+}
+static void write_file(std::string const& path, std::string const& bytes) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out << bytes;
+}
+
+// inserts, deletes and a checkpoint survive a reopen
+static void check_reopen(std::string const& path, std::multiset<int>& expected) {
+  {
+    durable_type tree;
+    CHECK(tree.open(path));
+    for (int i = 0; i < 2000; ++i) {
+      CHECK(tree.insert(entry(i)));
+      expected.insert(i);
+    }
+    for (int i = 0; i < 2000; i += 3) {
+      CHECK(tree.deleteEntrie(entry(i)));
+      expected.erase(i);
+    }
+    CHECK(tree.checkpoint());
+    CHECK(file_size(path + ".wal") == 0);
+    for (int i = 2000; i < 2500; ++i) {
+      CHECK(tree.insert(entry(i)));
+      expected.insert(i);
+    }
+    // deletes of entries only in the snapshot
+    for (int i = 1; i < 2000; i += 7) {
+      if (i % 3 != 0) {
+        CHECK(tree.deleteEntrie(entry(i)));
+        expected.erase(i);
+      }
+    }
+    CHECK(contents(tree) == expected);
+  }
+  durable_type tree;
+  CHECK(tree.open(path));
+  CHECK(tree.size() == expected.size());
+  CHECK(contents(tree) == expected);
+}
+
+// a damaged last record is dropped and the log cut back to the intact
+// prefix, which later writes extend
+static void check_torn_tail(std::string const& path,
+                            std::multiset<int>& expected, bool flip) {
+  const std::string log_path = path + ".wal";
+  const int id = flip ? 100001 : 100000;
+  long intact;
+  long full;
+  {
+    durable_type tree;
+    CHECK(tree.open(path));
+    intact = file_size(log_path);
+    CHECK(tree.insert(entry(id)));
+    full = file_size(log_path);
+    CHECK(full > intact);
+  }
+  std::string bytes = read_file(log_path);
+  if (flip) {
+    // a payload byte of the last record
+    bytes[static_cast<std::size_t>(intact) + sizeof(wal_record_header_t) + 2]
+        ^= 0x10;
+  }
+  else {
+    bytes.resize(static_cast<std::size_t>(full) - 3);
+  }
+  write_file(log_path, bytes);
+
+  std::uint64_t valid_bytes = 0;
+  lsn_type last_lsn = 0;
+  CHECK(write_ahead_log_t::replay(
+      log_path, [](wal_record_header_t const&, unsigned char const*) {},
+      valid_bytes, last_lsn));
+  CHECK(valid_bytes == static_cast<std::uint64_t>(intact));
+
+  {
+    durable_type tree;
+    CHECK(tree.open(path));
+    CHECK(contents(tree) == expected);
+    CHECK(file_size(log_path) == intact);
+    CHECK(tree.insert(entry(id + 10)));
+    expected.insert(id + 10);
+  }
+  durable_type tree;
+  CHECK(tree.open(path));
+  CHECK(contents(tree) == expected);
+}
+
+// records a snapshot already covers are skipped when the log was not
+// emptied after it was written (a crash between rename and reset)
+static void check_lsn_skip(std::string const& path,
+                           std::multiset<int>& expected) {
+  const std::string log_path = path + ".wal";
+  std::string covered;
+  {
+    durable_type tree;
+    CHECK(tree.open(path));
+    for (int i = 200000; i < 200100; ++i) {
+      CHECK(tree.insert(entry(i)));
+      expected.insert(i);
+    }
+    CHECK(tree.deleteEntrie(entry(200000)));
+    expected.erase(200000);
+    covered = read_file(log_path);
+    CHECK(tree.checkpoint());
+    CHECK(tree.insert(entry(200200)));
+    expected.insert(200200);
+    write_file(log_path, covered + read_file(log_path));
+  }
+  {
+    durable_type tree;
+    CHECK(tree.open(path));
+    CHECK(tree.size() == expected.size());
+    CHECK(contents(tree) == expected);
+    // numbering goes on after the last record
+    CHECK(tree.insert(entry(200201)));
+    expected.insert(200201);
+  }
+  durable_type tree;
+  CHECK(tree.open(path));
+  CHECK(contents(tree) == expected);
+}
+
+// once a log write fails every later write is refused, and a reopen
+// recovers exactly the acknowledged writes
+static void check_failed(std::string const& dir) {
+  std::signal(SIGXFSZ, SIG_IGN);
+  rlimit saved;
+  CHECK(::getrlimit(RLIMIT_FSIZE, &saved) == 0);
+  rlimit limited = saved;
+  limited.rlim_cur = 4096;
+
+  {
+    write_ahead_log_t log;
+    CHECK(log.open(dir + "/raw.wal", 0, 1));
+    CHECK(::setrlimit(RLIMIT_FSIZE, &limited) == 0);
+    const char payload[100] = {};
+    int written = 0;
+    while (written < 1000 && log.write(1, payload, sizeof(payload))) {
+      ++written;
+    }
+    CHECK(written < 1000);
+    CHECK(log.failed());
+    CHECK(log.write(1, payload, sizeof(payload)) == false);
+    CHECK(::setrlimit(RLIMIT_FSIZE, &saved) == 0);
+    // still refused with room to write again
+    CHECK(log.write(1, payload, sizeof(payload)) == false);
+  }
+
+  const std::string path = dir + "/failing";
+  std::multiset<int> acknowledged;
+  {
+    durable_type tree;
+    CHECK(tree.open(path));
+    CHECK(::setrlimit(RLIMIT_FSIZE, &limited) == 0);
+    int id = 0;
+    while (id < 1000 && tree.insert(entry(id))) {
+      acknowledged.insert(id++);
+    }
+    CHECK(id < 1000);
+    CHECK(::setrlimit(RLIMIT_FSIZE, &saved) == 0);
+    const auto size = tree.size();
+    CHECK(tree.insert(entry(5000)) == false);
+    CHECK(tree.deleteEntrie(entry(0)) == false);
+    CHECK(tree.clear() == false);
+    CHECK(tree.size() == size);
+  }
+  durable_type tree;
+  CHECK(tree.open(path));
+  CHECK(contents(tree) == acknowledged);
+  CHECK(tree.insert(entry(5000)));
+}
+
+int main() {
+  char dir_template[] = "/tmp/durable_rtree_test.XXXXXX";
+  char* dir = ::mkdtemp(dir_template);
+  if (dir == nullptr) {
+    std::perror("mkdtemp");
+    return 1;
+  }
+  const std::string path = std::string(dir) + "/tree";
+
+  std::multiset<int> expected;
+  check_reopen(path, expected);
+  check_torn_tail(path, expected, false);
+  check_torn_tail(path, expected, true);
+  check_lsn_skip(path, expected);
+  check_failed(dir);
+
+  for (char const* name : { "/tree.snapshot", "/tree.wal", "/raw.wal",
+                            "/failing.snapshot", "/failing.wal" }) {
+    std::remove((std::string(dir) + name).c_str());
+  }
+  ::rmdir(dir);
+
+  if (failures) {
+    std::fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  std::printf("all checks passed\n");
+  return 0;
+}
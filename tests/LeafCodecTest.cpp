@@ -0,0 +1,360 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "rtree/AABB.hpp"
+#include "rtree/LeafCodec.hpp"
+#include "rtree/RTree.hpp"
+#include "rtree/Serialization.hpp"
+
+using namespace rtree;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, \
+                   #cond);                                                  \
+      ++failures;                                                           \
+    }                                                                       \
+  } while (0)
+
+template <typename T>
+static bool same_bytes(T const& a, void const* b) {
+  return std::memcmp(&a, b, sizeof(T)) == 0;
+}
+
+// every key packed against `reference` decodes to the same bytes, within
+// MAX_ENTRY_BYTES each, and the input cut short is rejected
+template <typename Codec>
+static void check_keys(typename Codec::reference_type const& reference,
+                       std::vector<typename Codec::key_type> const& keys) {
+  static_assert(Codec::SUPPORTED, "key layout not supported");
+  std::vector<unsigned char> packed;
+  for (auto const& key : keys) {
+    const std::size_t before = packed.size();
+    Codec::encode_key(reference, key, packed);
+    CHECK(packed.size() - before <= Codec::MAX_ENTRY_BYTES);
+  }
+  unsigned char const* p = packed.data();
+  unsigned char const* const end = p + packed.size();
+  for (auto const& key : keys) {
+    raw_storage_t<typename Codec::key_type> decoded;
+    CHECK(Codec::decode_key(reference, p, end, decoded));
+    CHECK(same_bytes(key, decoded.bytes));
+  }
+  CHECK(p == end);
+
+  if (packed.empty() == false) {
+    p = packed.data();
+    bool ok = true;
+    for (std::size_t i = 0; i < keys.size() && ok; ++i) {
+      raw_storage_t<typename Codec::key_type> decoded;
+      ok = Codec::decode_key(reference, p, end - 1, decoded);
+    }
+    CHECK(ok == false);
+  }
+}
+
+// mapped values coded as differences to the previous one, starting at 0
+template <typename Codec>
+static void check_mapped(std::vector<typename Codec::mapped_type> const& values) {
+  using mapped_type = typename Codec::mapped_type;
+  std::vector<unsigned char> packed;
+  mapped_type previous = 0;
+  for (mapped_type v : values) {
+    const std::size_t before = packed.size();
+    Codec::encode_mapped(previous, v, packed);
+    CHECK(packed.size() - before <= 10);
+    previous = v;
+  }
+  unsigned char const* p = packed.data();
+  unsigned char const* const end = p + packed.size();
+  previous = 0;
+  for (mapped_type v : values) {
+    mapped_type decoded;
+    CHECK(Codec::decode_mapped(p, end, previous, decoded));
+    CHECK(decoded == v);
+    previous = decoded;
+  }
+  CHECK(p == end);
+}
+
+template <typename Scalar>
+static void check_integer_keys() {
+  using point_type = point_t<Scalar, 2>;
+  using box_type = aabb_t<point_type>;
+  using limits = std::numeric_limits<Scalar>;
+  const Scalar values[] = { limits::min(), limits::max(), -1, 0, 1,
+                            static_cast<Scalar>(-123456789),
+                            static_cast<Scalar>(limits::min() + 1) };
+  std::vector<point_type> points;
+  std::vector<box_type> boxes;
+  for (Scalar a : values) {
+    for (Scalar b : values) {
+      points.emplace_back(a, b);
+      // max below min as well: extents are differences of any sign
+      boxes.emplace_back(point_type(a, b), point_type(b, a));
+    }
+  }
+  using point_codec = delta_leaf_codec_t<point_type, int, Scalar, 2>;
+  using box_codec = delta_leaf_codec_t<box_type, int, Scalar, 2>;
+  const typename point_codec::reference_type references[]
+      = { { 0, 0 }, { limits::max(), limits::min() }, { -1, 1 },
+          { limits::min(), limits::min() } };
+  for (auto const& reference : references) {
+    check_keys<point_codec>(reference, points);
+    check_keys<box_codec>(reference, boxes);
+  }
+}
+
+template <typename Scalar>
+static void check_floating_keys() {
+  using point_type = point_t<Scalar, 2>;
+  using box_type = aabb_t<point_type>;
+  using limits = std::numeric_limits<Scalar>;
+  using bits_type = std::conditional_t<sizeof(Scalar) == 4, std::uint32_t,
+                                       std::uint64_t>;
+  // a NaN with a payload, which must survive bit for bit
+  bits_type payload_bits;
+  const Scalar quiet = limits::quiet_NaN();
+  std::memcpy(&payload_bits, &quiet, sizeof(quiet));
+  payload_bits |= 0x5;
+  Scalar payload_nan;
+  std::memcpy(&payload_nan, &payload_bits, sizeof(payload_nan));
+
+  const Scalar values[] = { Scalar(0),
+                            -Scalar(0),
+                            quiet,
+                            -quiet,
+                            payload_nan,
+                            limits::infinity(),
+                            -limits::infinity(),
+                            limits::denorm_min(),
+                            -limits::denorm_min(),
+                            limits::min() - limits::denorm_min(),
+                            limits::min(),
+                            limits::max(),
+                            limits::lowest(),
+                            Scalar(1),
+                            Scalar(-1.5),
+                            Scalar(1e-30) };
+  std::vector<point_type> points;
+  std::vector<box_type> boxes;
+  for (Scalar a : values) {
+    for (Scalar b : values) {
+      points.emplace_back(a, b);
+      boxes.emplace_back(point_type(a, b), point_type(b, a));
+    }
+  }
+  using point_codec = delta_leaf_codec_t<point_type, int, Scalar, 2>;
+  using box_codec = delta_leaf_codec_t<box_type, int, Scalar, 2>;
+  const typename point_codec::reference_type references[]
+      = { { 0, 0 },
+          { -Scalar(0), quiet },
+          { limits::denorm_min(), limits::infinity() },
+          { Scalar(1.5), Scalar(-2.25) } };
+  for (auto const& reference : references) {
+    check_keys<point_codec>(reference, points);
+    check_keys<box_codec>(reference, boxes);
+  }
+}
+
+static void check_mapped_wrap() {
+  using point_type = point_t<double, 2>;
+  using int32_codec = delta_leaf_codec_t<point_type, std::int32_t, double, 2>;
+  using int64_codec = delta_leaf_codec_t<point_type, std::int64_t, double, 2>;
+  using uint64_codec = delta_leaf_codec_t<point_type, std::uint64_t, double, 2>;
+  using uint8_codec = delta_leaf_codec_t<point_type, std::uint8_t, double, 2>;
+  using i32 = std::numeric_limits<std::int32_t>;
+  using i64 = std::numeric_limits<std::int64_t>;
+  using u64 = std::numeric_limits<std::uint64_t>;
+  check_mapped<int32_codec>(
+      { i32::max(), i32::min(), -1, 0, i32::max(), i32::max() - 1, 7 });
+  check_mapped<int64_codec>(
+      { i64::min(), i64::max(), 0, i64::min(), -1, i64::max(), 1 });
+  check_mapped<uint64_codec>({ u64::max(), 0, u64::max(), 1, u64::max() - 1 });
+  check_mapped<uint8_codec>({ 255, 0, 1, 255, 254, 3 });
+}
+
+// contents as raw bytes of key and mapped value, in a canonical order
+template <typename TreeType>
+static std::vector<std::string> contents(TreeType const& tree) {
+  std::vector<std::string> out;
+  for (auto const& v : tree) {
+    std::string entry(reinterpret_cast<char const*>(&v.first),
+                      sizeof(v.first));
+    if constexpr (std::is_same<typename TreeType::mapped_type,
+                               std::string>::value) {
+      entry += v.second;
+    }
+    else {
+      entry.append(reinterpret_cast<char const*>(&v.second),
+                   sizeof(v.second));
+    }
+    out.push_back(entry);
+  }
+  std::sort(out.begin(), out.end());
+  return out;
+}
+
+// a delta coded save loads back to the same entries
+template <typename TreeType, typename Codec = raw_codec_t<
+                                 typename TreeType::mapped_type>>
+static void check_tree(TreeType const& tree) {
+  std::stringstream stream;
+  CHECK(tree.save(stream, Codec(), leaf_encoding::delta));
+  TreeType loaded;
+  CHECK(loaded.load(stream, Codec()));
+  CHECK(loaded.size() == tree.size());
+  CHECK(contents(loaded) == contents(tree));
+}
+
+static void check_trees() {
+  std::mt19937 gen(3);
+  std::uniform_real_distribution<double> coord(-5000, 5000);
+
+  using dpoint = point_t<double, 2>;
+  using dbox = aabb_t<dpoint>;
+  RTree<dbox, dbox, int> boxes;
+  RTree<dbox, dbox, std::string> named;
+  using fpoint = point_t<float, 2>;
+  using fbox = aabb_t<fpoint>;
+  RTree<fbox, fpoint, std::int64_t> points;
+  using ipoint = point_t<std::int32_t, 2>;
+  using ibox = aabb_t<ipoint>;
+  RTree<ibox, ibox, std::uint32_t> cells;
+  for (int i = 0; i < 5000; ++i) {
+    dpoint a(coord(gen), coord(gen));
+    dpoint b(a[0] + std::abs(coord(gen)) / 100, a[1] + 0.25);
+    // ids out of order and at the ends of their range
+    const int id = i % 7 == 0   ? std::numeric_limits<int>::min() + i
+                   : i % 7 == 1 ? std::numeric_limits<int>::max() - i
+                                : (i * 7919) % 5000 - 2500;
+    boxes.insert({ dbox(a, b), id });
+    named.insert({ dbox(a, b), std::to_string(id) });
+    points.insert({ fpoint(static_cast<float>(a[0]), static_cast<float>(a[1])),
+                    static_cast<std::int64_t>(id) * 4000000000LL });
+    const ipoint c(static_cast<std::int32_t>(a[0]),
+                   static_cast<std::int32_t>(a[1]));
+    cells.insert({ ibox(c, ipoint(c[0] + i % 9, c[1] + 1)),
+                   static_cast<std::uint32_t>(id) });
+  }
+  check_tree(boxes);
+  check_tree<decltype(named), string_codec_t>(named);
+  check_tree(points);
+  check_tree(cells);
+
+  // a root leaf has no parent bound and is coded against zero
+  using lpoint = point_t<std::int64_t, 2>;
+  using lbox = aabb_t<lpoint>;
+  RTree<lbox, lpoint, std::int64_t> single;
+  single.insert({ lpoint(std::numeric_limits<std::int64_t>::min(),
+                         std::numeric_limits<std::int64_t>::max()),
+                  std::numeric_limits<std::int64_t>::min() });
+  check_tree(single);
+  RTree<dbox, dbox, int> single_box;
+  single_box.insert({ dbox(dpoint(-1e300, 3.5), dpoint(1e300, 3.5)), -1 });
+  check_tree(single_box);
+}
+
+using tree_type = RTree<aabb_t<point_t<double, 2>>,
+                        aabb_t<point_t<double, 2>>,
+                        int>;
+using codec_type = tree_type::leaf_codec_type;
+
+// a delta coded root leaf as save writes it, holding `packed` and
+// claiming `bytes` packed bytes, with a valid checksum
+static std::string root_leaf(std::uint32_t count, std::uint32_t bytes,
+                             std::vector<unsigned char> const& packed) {
+  std::ostringstream out;
+  binary_writer_t writer(out);
+  serialized_header_t header;
+  header.encoding = leaf_encoding::delta;
+  header.geometry_bytes = sizeof(tree_type::geometry_type);
+  header.key_bytes = sizeof(tree_type::key_type);
+  header.max_entries = tree_type::MAX_ENTRIES;
+  header.max_leaf_entries = tree_type::MAX_LEAF_ENTRIES;
+  header.leaf_level = 0;
+  header.size = count;
+  writer.write(header);
+  writer.write(count);
+  writer.write(bytes);
+  writer.write_bytes(packed.data(), packed.size());
+  const std::uint64_t checksum = writer.checksum();
+  writer.write(checksum);
+  return out.str();
+}
+
+// load() of a root leaf whose packed bytes are too many or not all used
+// fails and leaves the tree as it was
+static void check_rejected() {
+  using point_type = point_t<double, 2>;
+  using box_type = aabb_t<point_type>;
+  const std::vector<tree_type::value_type> values
+      = { { box_type(point_type(1, 2), point_type(3, 4)), 10 },
+          { box_type(point_type(-1, 0.5), point_type(0, 0.5)), -3 } };
+  std::vector<unsigned char> packed;
+  const codec_type::reference_type zero {};
+  int previous = 0;
+  for (auto const& v : values) {
+    codec_type::encode_key(zero, v.first, packed);
+  }
+  for (auto const& v : values) {
+    codec_type::encode_mapped(previous, v.second, packed);
+    previous = v.second;
+  }
+  const auto count = static_cast<std::uint32_t>(values.size());
+  const auto size = static_cast<std::uint32_t>(packed.size());
+
+  tree_type tree;
+  {
+    std::istringstream in(root_leaf(count, size, packed));
+    CHECK(tree.load(in));
+    CHECK(tree.size() == 2);
+  }
+
+  std::vector<unsigned char> trailing = packed;
+  trailing.push_back(0);
+  std::istringstream garbage(root_leaf(count, size + 1, trailing));
+  CHECK(tree.load(garbage) == false);
+  CHECK(tree.size() == 2);
+
+  const auto limit
+      = static_cast<std::uint32_t>(count * codec_type::MAX_ENTRY_BYTES);
+  std::vector<unsigned char> padded = packed;
+  padded.resize(limit + 1, 0);
+  std::istringstream oversized(root_leaf(count, limit + 1, padded));
+  CHECK(tree.load(oversized) == false);
+  CHECK(tree.size() == 2);
+  // refused before anything is read or allocated for it
+  std::istringstream huge(root_leaf(count, 0xffffffff, packed));
+  CHECK(tree.load(huge) == false);
+  CHECK(tree.size() == 2);
+}
+
+int main() {
+  check_integer_keys<std::int64_t>();
+  check_integer_keys<std::int32_t>();
+  check_floating_keys<float>();
+  check_floating_keys<double>();
+  check_mapped_wrap();
+  check_trees();
+  check_rejected();
+
+  if (failures) {
+    std::fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  std::printf("all checks passed\n");
+  return 0;
+}
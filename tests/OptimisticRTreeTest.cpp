@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "rtree/AABB.hpp"
+#include "rtree/OptimisticRTree.hpp"
+#include "rtree/RTree.hpp"
+
+using namespace rtree;
+
+using point_type = point_t<float, 2>;
+using bound_type = aabb_t<point_type>;
+using traits = geometry_traits<bound_type>;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, \
+                   #cond);                                                  \
+      ++failures;                                                           \
+    }                                                                       \
+  } while (0)
+
+constexpr int WRITERS = 4;
+constexpr int READERS = 3;
+constexpr int PER_WRITER = 20000;
+// entries inserted before the writers start and never deleted
+constexpr int STABLE = 2000;
+
+// a small box in a small space, so writers keep hitting the same leaves
+template <typename ValueType>
+static ValueType make_value(int id) {
+  std::mt19937 gen(static_cast<unsigned>(id) * 2654435761u);
+  std::uniform_real_distribution<float> coord(0, 100);
+  const point_type a(coord(gen), coord(gen));
+  return { bound_type(a, point_type(a[0] + 1, a[1] + 1)), id };
+}
+
+// parents point back at their children and every entry covers its child
+template <typename TreeType>
+static bool is_valid(TreeType const& tree) {
+  bool valid = true;
+  std::vector<std::pair<typename TreeType::node_base_type const*, int>> stack;
+  stack.emplace_back(tree.root(), 0);
+  while (stack.empty() == false) {
+    const auto [node, level] = stack.back();
+    stack.pop_back();
+    if (level == tree.leaf_level()) {
+      continue;
+    }
+    auto const* n = node->as_node();
+    for (auto const& c : *n) {
+      valid = valid && c.second->parent() == n;
+      valid = valid
+              && traits::is_inside(c.first,
+                                   level + 1 == tree.leaf_level()
+                                       ? c.second->as_leaf()->calculate_bound()
+                                       : c.second->as_node()->calculate_bound());
+      stack.emplace_back(c.second, level + 1);
+    }
+  }
+  return valid;
+}
+
+// writers insert their own entries and delete every third one while
+// readers query; the stable entries must be found by every query that
+// overlaps them, and the final contents must be exactly what survived
+template <typename TreeType>
+static void stress() {
+  using value_type = typename TreeType::value_type;
+  olc_rtree<TreeType> tree;
+  std::vector<value_type> stable;
+  for (int i = 0; i < STABLE; ++i) {
+    stable.push_back(make_value<value_type>(-1 - i));
+    tree.insert(stable.back());
+  }
+
+  std::atomic<bool> done { false };
+  std::atomic<int> reader_failures { 0 };
+  std::atomic<long> queries { 0 };
+  std::vector<std::thread> readers;
+  for (int r = 0; r < READERS; ++r) {
+    readers.emplace_back([&, r] {
+      std::mt19937 gen(100 + r);
+      std::uniform_real_distribution<float> coord(0, 100);
+      while (done.load() == false) {
+        const point_type a(coord(gen), coord(gen));
+        const bound_type range(a, point_type(a[0] + 10, a[1] + 10));
+        std::multiset<int> ids;
+        bool ok = true;
+        auto sink = [&](value_type const& v) {
+          ok = ok && traits::is_overlap(v.first, range)
+               && v.second < WRITERS * PER_WRITER;
+          ids.insert(v.second);
+          return false;
+        };
+        if (r == 0) {
+          tree.search_inside(range, sink);
+        }
+        else {
+          tree.search_overlap(range, sink);
+        }
+        for (value_type const& v : stable) {
+          const bool match = r == 0 ? traits::is_inside(range, v.first)
+                                    : traits::is_overlap(v.first, range);
+          if (match) {
+            ok = ok && ids.count(v.second) == 1;
+          }
+        }
+        if (ok == false) {
+          ++reader_failures;
+        }
+        ++queries;
+      }
+    });
+  }
+
+  std::vector<std::thread> writers;
+  for (int w = 0; w < WRITERS; ++w) {
+    writers.emplace_back([&, w] {
+      std::mt19937 gen(w);
+      std::vector<value_type> deleted;
+      for (int i = 0; i < PER_WRITER; ++i) {
+        const value_type v = make_value<value_type>(w * PER_WRITER + i);
+        tree.insert(v);
+        if (i % 3 == 0) {
+          deleted.push_back(v);
+        }
+        // delete in bursts so leaves underflow and condense
+        if (deleted.size() == 64) {
+          std::shuffle(deleted.begin(), deleted.end(), gen);
+          for (value_type const& d : deleted) {
+            tree.deleteEntrie(d);
+          }
+          deleted.clear();
+        }
+      }
+      for (value_type const& d : deleted) {
+        tree.deleteEntrie(d);
+      }
+    });
+  }
+  for (auto& t : writers) {
+    t.join();
+  }
+  done.store(true);
+  for (auto& t : readers) {
+    t.join();
+  }
+  CHECK(reader_failures.load() == 0);
+  CHECK(queries.load() > 0);
+
+  std::multiset<int> expected;
+  for (int i = 0; i < STABLE; ++i) {
+    expected.insert(-1 - i);
+  }
+  for (int w = 0; w < WRITERS; ++w) {
+    for (int i = 0; i < PER_WRITER; ++i) {
+      if (i % 3 != 0) {
+        expected.insert(w * PER_WRITER + i);
+      }
+    }
+  }
+  std::multiset<int> found;
+  tree.search_overlap(bound_type(point_type(-1, -1), point_type(200, 200)),
+                      [&](value_type const& v) {
+                        found.insert(v.second);
+                        return false;
+                      });
+  CHECK(found == expected);
+  CHECK(tree.size() == expected.size());
+  CHECK(tree.write([](TreeType& t) { return is_valid(t); }));
+}
+
+int main() {
+  // a small fanout splits and condenses often
+  stress<RTree<bound_type, bound_type, int, 2, 4>>();
+  stress<RTree<bound_type, bound_type, int, 4, 8>>();
+  stress<RTree<bound_type, bound_type, int>>();
+
+  if (failures) {
+    std::fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  std::printf("all checks passed\n");
+  return 0;
+}
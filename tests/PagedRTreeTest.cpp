@@ -0,0 +1,259 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "rtree/AABB.hpp"
+#include "rtree/BufferPool.hpp"
+#include "rtree/IoUringReader.hpp"
+#include "rtree/PagedRTree.hpp"
+#include "rtree/RTree.hpp"
+
+using namespace rtree;
+
+using point_type = point_t<double, 2>;
+using bound_type = aabb_t<point_type>;
+using tree_type = RTree<bound_type, bound_type, int>;
+using paged_type = paged_rtree<tree_type>;
+
+// few enough frames that nearly every descent evicts
+constexpr size_type FRAMES = 16;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, \
+                   #cond);                                                  \
+      ++failures;                                                           \
+    }                                                                       \
+  } while (0)
+
+static tree_type::value_type make_value(int id, std::mt19937& gen) {
+  std::uniform_real_distribution<double> coord(0, 1000);
+  point_type a;
+  a[0] = coord(gen);
+  a[1] = coord(gen);
+  point_type b = a;
+  b[0] += 1 + coord(gen) / 100;
+  b[1] += 2;
+  return { bound_type(a, b), id };
+}
+
+static std::vector<bound_type> make_queries(int count, std::mt19937& gen) {
+  std::uniform_real_distribution<double> coord(0, 1000);
+  std::vector<bound_type> queries;
+  for (int i = 0; i < count; ++i) {
+    point_type a;
+    a[0] = coord(gen);
+    a[1] = coord(gen);
+    point_type b = a;
+    // a few queries covering most of the space
+    const double width = i % 25 == 0 ? 700 : 60;
+    b[0] += width;
+    b[1] += width;
+    queries.emplace_back(a, b);
+  }
+  return queries;
+}
+
+template <bool Inside>
+static std::multiset<int> search(tree_type const& tree,
+                                 bound_type const& range) {
+  std::multiset<int> ids;
+  auto sink = [&](tree_type::value_type const& v) {
+    ids.insert(v.second);
+    return false;
+  };
+  if constexpr (Inside) {
+    tree.search_inside(range, sink);
+  }
+  else {
+    tree.search_overlap(range, sink);
+  }
+  return ids;
+}
+// the paged searches also report whether every page could be read
+template <bool Inside>
+static std::multiset<int> search(paged_type const& tree,
+                                 bound_type const& range) {
+  std::multiset<int> ids;
+  auto sink = [&](tree_type::value_type const& v) {
+    ids.insert(v.second);
+    return false;
+  };
+  if constexpr (Inside) {
+    CHECK(tree.search_inside(range, sink));
+  }
+  else {
+    CHECK(tree.search_overlap(range, sink));
+  }
+  return ids;
+}
+
+// every query of the paged tree against the in-memory one
+static void check_same(paged_type const& paged, tree_type const& memory,
+                       std::mt19937& gen) {
+  CHECK(paged.size() == memory.size());
+  for (bound_type const& q : make_queries(100, gen)) {
+    CHECK(search<false>(paged, q) == search<false>(memory, q));
+    CHECK(search<true>(paged, q) == search<true>(memory, q));
+  }
+  point_type lo;
+  lo[0] = -1;
+  lo[1] = -1;
+  point_type hi;
+  hi[0] = 2000;
+  hi[1] = 2000;
+  CHECK(search<false>(paged, bound_type(lo, hi))
+        == search<false>(memory, bound_type(lo, hi)));
+}
+
+// batched queries through `reader` give each query what a single search
+// gives it; a functor returning true stops its own query only
+template <typename Reader>
+static void check_batch(paged_type const& paged, tree_type const& memory,
+                        Reader& reader, std::mt19937& gen) {
+  const std::vector<bound_type> queries = make_queries(200, gen);
+  bound_type const* first = queries.data();
+  bound_type const* last = first + queries.size();
+  std::vector<std::multiset<int>> overlap(queries.size());
+  std::vector<std::multiset<int>> inside(queries.size());
+  CHECK(paged.search_overlap_batch(
+      first, last,
+      [&](size_type q, tree_type::value_type const& v) {
+        overlap[q].insert(v.second);
+        return false;
+      },
+      reader));
+  CHECK(paged.search_inside_batch(
+      first, last,
+      [&](size_type q, tree_type::value_type const& v) {
+        inside[q].insert(v.second);
+        return false;
+      },
+      reader));
+  std::vector<int> visited(queries.size(), 0);
+  CHECK(paged.search_overlap_batch(
+      first, last,
+      [&](size_type q, tree_type::value_type const&) {
+        ++visited[q];
+        return true;
+      },
+      reader));
+  for (std::size_t q = 0; q < queries.size(); ++q) {
+    const auto expected = search<false>(memory, queries[q]);
+    CHECK(overlap[q] == expected);
+    CHECK(inside[q] == search<true>(memory, queries[q]));
+    CHECK(visited[q] == (expected.empty() ? 0 : 1));
+  }
+}
+
+int main() {
+  char dir_template[] = "/tmp/paged_rtree_test.XXXXXX";
+  char* dir = ::mkdtemp(dir_template);
+  if (dir == nullptr) {
+    std::perror("mkdtemp");
+    return 1;
+  }
+  const std::string path = std::string(dir) + "/tree.pages";
+
+  std::mt19937 gen(5);
+  tree_type memory;
+  std::vector<tree_type::value_type> values;
+  int next_id = 0;
+  int height = 0;
+  {
+    paged_type paged(path, FRAMES);
+    CHECK(paged.is_open());
+    for (; next_id < 30000; ++next_id) {
+      values.push_back(make_value(next_id, gen));
+      memory.insert(values.back());
+      CHECK(paged.insert(values.back()));
+    }
+    CHECK(paged.pool_stats().evictions > 0);
+    check_same(paged, memory, gen);
+    const int peak_height = paged.leaf_level();
+
+    // deletes condense underfull nodes and reinsert their orphans
+    std::shuffle(values.begin(), values.end(), gen);
+    for (int i = 0; i < 25000; ++i) {
+      memory.deleteEntrie(values[i]);
+      CHECK(paged.deleteEntrie(values[i]));
+    }
+    values.erase(values.begin(), values.begin() + 25000);
+    CHECK(paged.leaf_level() < peak_height);
+    check_same(paged, memory, gen);
+    const auto pages = paged.page_count();
+
+    // far fewer entries than at the peak fit in the freed pages, so the
+    // file does not grow
+    for (const int end = next_id + 5000; next_id < end; ++next_id) {
+      values.push_back(make_value(next_id, gen));
+      memory.insert(values.back());
+      CHECK(paged.insert(values.back()));
+    }
+    CHECK(paged.page_count() == pages);
+    check_same(paged, memory, gen);
+    height = paged.leaf_level();
+    CHECK(paged.flush());
+  }
+
+  {
+    paged_type paged(path, FRAMES);
+    CHECK(paged.is_open());
+    CHECK(paged.leaf_level() == height);
+    check_same(paged, memory, gen);
+
+    pread_page_reader_t pread_reader;
+    check_batch(paged, memory, pread_reader, gen);
+    io_uring_page_reader_t uring_reader;
+    check_batch(paged, memory, uring_reader, gen);
+
+    // deleting all but a few collapses the root down to a leaf
+    std::shuffle(values.begin(), values.end(), gen);
+    while (values.size() > 10) {
+      memory.deleteEntrie(values.back());
+      CHECK(paged.deleteEntrie(values.back()));
+      values.pop_back();
+    }
+    CHECK(paged.leaf_level() == 0);
+    check_same(paged, memory, gen);
+    check_batch(paged, memory, uring_reader, gen);
+    // not there any more
+    CHECK(paged.deleteEntrie(make_value(-1, gen)) == false);
+  }
+
+  {
+    paged_type paged(path, FRAMES);
+    CHECK(paged.is_open());
+    check_same(paged, memory, gen);
+    for (auto const& v : values) {
+      CHECK(paged.deleteEntrie(v));
+    }
+    CHECK(paged.size() == 0);
+  }
+
+  // a tree of another type does not open the file
+  {
+    paged_rtree<RTree<bound_type, point_type, int>> other(path, FRAMES);
+    CHECK(other.is_open() == false);
+  }
+
+  std::remove(path.c_str());
+  ::rmdir(dir);
+
+  if (failures) {
+    std::fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  std::printf("all checks passed\n");
+  return 0;
+}
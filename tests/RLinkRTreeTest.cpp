@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "rtree/AABB.hpp"
+#include "rtree/RLinkRTree.hpp"
+#include "rtree/RTree.hpp"
+
+using namespace rtree;
+
+using point_type = point_t<float, 2>;
+using bound_type = aabb_t<point_type>;
+using traits = geometry_traits<bound_type>;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, \
+                   #cond);                                                  \
+      ++failures;                                                           \
+    }                                                                       \
+  } while (0)
+
+constexpr int WRITERS = 4;
+constexpr int READERS = 3;
+constexpr int PER_WRITER = 20000;
+// entries that are in the tree for the whole run
+constexpr int STABLE = 2000;
+
+template <typename ValueType>
+static ValueType make_value(int id) {
+  std::mt19937 gen(static_cast<unsigned>(id) * 2246822519u);
+  std::uniform_real_distribution<float> coord(0, 100);
+  const point_type a(coord(gen), coord(gen));
+  return { bound_type(a, point_type(a[0] + 1, a[1] + 1)), id };
+}
+
+// once settled no leaf is reachable only through a right-link: every child
+// points back at its parent, and its entry covers it
+template <typename TreeType>
+static bool is_valid(TreeType const& tree) {
+  bool valid = true;
+  std::vector<std::pair<typename TreeType::node_base_type const*, int>> stack;
+  stack.emplace_back(tree.root(), 0);
+  while (stack.empty() == false) {
+    const auto [node, level] = stack.back();
+    stack.pop_back();
+    if (level == tree.leaf_level()) {
+      continue;
+    }
+    auto const* n = node->as_node();
+    for (auto const& c : *n) {
+      const auto bound = level + 1 == tree.leaf_level()
+                             ? c.second->as_leaf()->calculate_bound()
+                             : c.second->as_node()->calculate_bound();
+      valid = valid && c.second->parent() == n
+              && traits::is_inside(c.first, bound);
+      stack.emplace_back(c.second, level + 1);
+    }
+  }
+  return valid;
+}
+
+// concurrent writers split leaves without locking their parents while
+// readers follow right-links; a reader must never miss a stable entry or
+// see one twice, and the settled tree must hold exactly the survivors
+template <typename TreeType>
+static void stress(size_type link_capacity) {
+  using value_type = typename TreeType::value_type;
+  rlink_rtree<TreeType> tree(link_capacity);
+  std::vector<value_type> stable;
+  for (int i = 0; i < STABLE; ++i) {
+    stable.push_back(make_value<value_type>(-1 - i));
+    tree.insert(stable.back());
+  }
+
+  std::atomic<bool> done { false };
+  std::atomic<int> reader_failures { 0 };
+  std::atomic<long> queries { 0 };
+  std::vector<std::thread> readers;
+  for (int r = 0; r < READERS; ++r) {
+    readers.emplace_back([&, r] {
+      std::mt19937 gen(200 + r);
+      std::uniform_real_distribution<float> coord(0, 100);
+      while (done.load() == false) {
+        const point_type a(coord(gen), coord(gen));
+        const bound_type range(a, point_type(a[0] + 10, a[1] + 10));
+        std::multiset<int> ids;
+        bool ok = true;
+        auto sink = [&](value_type const& v) {
+          ok = ok && traits::is_overlap(v.first, range);
+          ids.insert(v.second);
+          return false;
+        };
+        if (r == 0) {
+          tree.search_inside(range, sink);
+        }
+        else {
+          tree.search_overlap(range, sink);
+        }
+        for (auto it = ids.begin(); it != ids.end();
+             it = ids.upper_bound(*it)) {
+          ok = ok && ids.count(*it) == 1;
+        }
+        for (value_type const& v : stable) {
+          const bool match = r == 0 ? traits::is_inside(range, v.first)
+                                    : traits::is_overlap(v.first, range);
+          ok = ok && (match == false || ids.count(v.second) == 1);
+        }
+        if (ok == false) {
+          ++reader_failures;
+        }
+        ++queries;
+      }
+    });
+  }
+
+  std::vector<std::thread> writers;
+  for (int w = 0; w < WRITERS; ++w) {
+    writers.emplace_back([&, w] {
+      std::mt19937 gen(w + 50);
+      std::vector<value_type> doomed;
+      for (int i = 0; i < PER_WRITER; ++i) {
+        const value_type v = make_value<value_type>(w * PER_WRITER + i);
+        tree.insert(v);
+        if (i % 3 == 0) {
+          doomed.push_back(v);
+        }
+        if (doomed.size() == 48) {
+          std::shuffle(doomed.begin(), doomed.end(), gen);
+          for (value_type const& d : doomed) {
+            tree.deleteEntrie(d);
+          }
+          doomed.clear();
+        }
+      }
+      for (value_type const& d : doomed) {
+        tree.deleteEntrie(d);
+      }
+    });
+  }
+  for (auto& t : writers) {
+    t.join();
+  }
+  done.store(true);
+  for (auto& t : readers) {
+    t.join();
+  }
+  CHECK(reader_failures.load() == 0);
+  CHECK(queries.load() > 0);
+
+  std::multiset<int> expected;
+  for (int i = 0; i < STABLE; ++i) {
+    expected.insert(-1 - i);
+  }
+  for (int w = 0; w < WRITERS; ++w) {
+    for (int i = 0; i < PER_WRITER; ++i) {
+      if (i % 3 != 0) {
+        expected.insert(w * PER_WRITER + i);
+      }
+    }
+  }
+  std::multiset<int> found;
+  tree.search_overlap(bound_type(point_type(-1, -1), point_type(200, 200)),
+                      [&](value_type const& v) {
+                        found.insert(v.second);
+                        return false;
+                      });
+  CHECK(found == expected);
+  rlink_rtree<TreeType> const& view = tree;
+  CHECK(view.size() == expected.size());
+  CHECK(tree.write([](TreeType& t) { return is_valid(t); }));
+}
+
+int main() {
+  using small_tree = RTree<bound_type, bound_type, int, 2, 4>;
+  using default_tree = RTree<bound_type, bound_type, int>;
+  stress<small_tree>(rlink_rtree<small_tree>::DEFAULT_LINK_CAPACITY);
+  // room for two splits' links at a time: most splits take the
+  // exclusive path and settle the others
+  stress<small_tree>(8);
+  stress<default_tree>(rlink_rtree<default_tree>::DEFAULT_LINK_CAPACITY);
+
+  if (failures) {
+    std::fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  std::printf("all checks passed\n");
+  return 0;
+}